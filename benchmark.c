@@ -22,115 +22,531 @@
  * 3. This notice may not be removed or altered from any source distribution.
  */
 
+/* Times groups of workloads and prints the results as JSON:
+ *
+ *     bench [-r repetitions] [-w warmups] [-t milliseconds] [group ...]
+ *
+ * Each workload is first calibrated so that one run takes about -t milliseconds,
+ * then run -w times untimed and -r times timed. It reports the median, p99 and
+ * minimum nanoseconds per operation over the timed runs, with the heap calls
+ * and bytes per operation. The groups are scalar, arrays, lerp, bitwise,
+ * closures, compile and pool; with none named, all of them run. */
+
 #include <stdio.h>
-#include <time.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
-#include "tinyexpr.h"
+#include <time.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+static long heap_calls;
+static size_t heap_bytes;
+
+static void *counted_malloc(size_t size) {++heap_calls; heap_bytes += size; return malloc(size);}
+static void *counted_calloc(size_t count, size_t size) {++heap_calls; heap_bytes += count * size; return calloc(count, size);}
+static void *counted_realloc(void *p, size_t size) {++heap_calls; heap_bytes += size; return realloc(p, size);}
+
+/* The library is built in, so that its allocations are counted. */
+#define malloc counted_malloc
+#define calloc counted_calloc
+#define realloc counted_realloc
+#include "tinyexpr.c"
+#undef malloc
+#undef calloc
+#undef realloc
+
+
+
+#define MAX_REPETITIONS 1000
+#define ROWS 4096
+#define POOL_ROWS (1 << 18)
+
+
+
+/* Nanoseconds from a monotonic clock. */
+static double now(void) {
+#if defined(_WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER count;
+    if (!frequency.QuadPart) QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart * 1e9 / (double)frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+#else
+    return (double)clock() * 1e9 / CLOCKS_PER_SEC;
+#endif
+}
 
 
-#define loops 10000
+static int repetitions = 21, warmups = 3;
+static double target_ns = 2e6;
+static int results;
+static volatile double sink;
 
+/* Runs n operations of a workload. */
+typedef void (*workload)(const void *context, long n);
 
 
-typedef double (*function1)(double);
+static int compare(const void *a, const void *b) {
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
 
-void bench(const char *expr, function1 func) {
-    int i, j;
-    volatile double d;
-    double tmp;
-    clock_t start;
 
-    te_variable lk = {"a", &tmp};
+static void put_string(const char *s) {
+    putchar('"');
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') putchar('\\');
+        putchar(*s);
+    }
+    putchar('"');
+}
 
-    printf("Expression: %s\n", expr);
 
-    printf("native ");
-    start = clock();
-    d = 0;
-    for (j = 0; j < loops; ++j)
-        for (i = 0; i < loops; ++i) {
-            tmp = i;
-            d += func(tmp);
-        }
-    const int nelapsed = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+/* Times the workload and prints its result. key, if not NULL, names a parameter */
+/* of the workload, such as an array size or a thread count, and value gives it. */
+static void measure(const char *group, const char *name, const char *tier, const char *key, long value,
+        workload timed, const void *context) {
+    static double samples[MAX_REPETITIONS];
+    long n = 1;
+    int i;
+
+    /* Doubles n until a run takes long enough to time. */
+    for (;;) {
+        const double start = now();
+        timed(context, n);
+        const double elapsed = now() - start;
+        if (elapsed >= target_ns || n >= (1L << 40)) break;
+        n = elapsed < target_ns / 64 ? n * 8 : n * 2;
+    }
+
+    for (i = 0; i < warmups; ++i) timed(context, n);
+
+    const long calls = heap_calls;
+    const size_t bytes = heap_bytes;
+    for (i = 0; i < repetitions; ++i) {
+        const double start = now();
+        timed(context, n);
+        samples[i] = (now() - start) / n;
+    }
+    const double ops = (double)n * repetitions;
+
+    qsort(samples, repetitions, sizeof(double), compare);
+    const int p99 = (int)ceil(0.99 * repetitions) - 1;
+
+    printf("%s\n    {\"group\": ", results++ ? "," : "");
+    put_string(group);
+    printf(", \"name\": ");
+    put_string(name);
+    printf(", \"tier\": ");
+    put_string(tier);
+    if (key) {
+        printf(", ");
+        put_string(key);
+        printf(": %ld", value);
+    }
+    printf(", \"ops\": %ld, \"median_ns\": %.4g, \"p99_ns\": %.4g, \"min_ns\": %.4g,"
+            " \"allocations\": %.4g, \"bytes\": %.4g}",
+            n, samples[repetitions / 2], samples[p99], samples[0],
+            (heap_calls - calls) / ops, (double)(heap_bytes - bytes) / ops);
+    fflush(stdout);
+}
 
-    /*Million floats per second input.*/
-    printf(" %.5g", d);
-    if (nelapsed)
-        printf("\t%5dms\t%5dmfps\n", nelapsed, loops * loops / nelapsed / 1000);
-    else
-        printf("\tinf\n");
 
 
+/* One compiled expression and its inputs, evaluated by each tier. */
+typedef struct bench_case {
+    te_expr *expr;
+    te_program *program;
+    double (*native)(double);
+    double *x, *y;
+    const double *xs, *ys;
+    te_pool *pool;
+} bench_case;
 
 
-    printf("interp ");
-    te_expr *n = te_compile(expr, &lk, 1, 0);
-    start = clock();
-    d = 0;
-    for (j = 0; j < loops; ++j)
-        for (i = 0; i < loops; ++i) {
-            tmp = i;
-            d += te_eval(n);
-        }
-    const int eelapsed = (clock() - start) * 1000 / CLOCKS_PER_SEC;
-    te_free(n);
+static void time_native(const void *context, long n) {
+    const bench_case *c = context;
+    double d = 0;
+    long i;
+    for (i = 0; i < n; ++i) {
+        *c->x = c->xs[i & (ROWS - 1)];
+        d += c->native(*c->x);
+    }
+    sink += d;
+}
+
+static void time_eval(const void *context, long n) {
+    const bench_case *c = context;
+    double d = 0;
+    long i;
+    for (i = 0; i < n; ++i) {
+        *c->x = c->xs[i & (ROWS - 1)];
+        if (c->y) *c->y = c->ys[i & (ROWS - 1)];
+        d += te_eval(c->expr);
+    }
+    sink += d;
+}
+
+static void time_program(const void *context, long n) {
+    const bench_case *c = context;
+    double d = 0;
+    long i;
+    for (i = 0; i < n; ++i) {
+        *c->x = c->xs[i & (ROWS - 1)];
+        if (c->y) *c->y = c->ys[i & (ROWS - 1)];
+        d += te_program_eval(c->program);
+    }
+    sink += d;
+}
+
+static void time_batch(const void *context, long n) {
+    const bench_case *c = context;
+    static double out[ROWS];
+    te_column columns[] = {{c->x, c->xs, 1}, {c->y, c->ys, 1}};
+    long done;
+    for (done = 0; done < n; done += ROWS) {
+        const int rows = n - done < ROWS ? (int)(n - done) : ROWS;
+        te_eval_batch(c->expr, columns, c->y ? 2 : 1, rows, out);
+        sink += out[rows - 1];
+    }
+}
+
+static void time_pool(const void *context, long n) {
+    const bench_case *c = context;
+    static double out[POOL_ROWS];
+    te_column column = {c->x, c->xs, 1};
+    long done;
+    for (done = 0; done < n; done += POOL_ROWS) {
+        const int rows = n - done < POOL_ROWS ? (int)(n - done) : POOL_ROWS;
+        te_pool_eval_batch(c->pool, c->expr, &column, 1, rows, out);
+        sink += out[rows - 1];
+    }
+}
+
+
+/* Times the expression by te_eval, te_program_eval and te_eval_batch. */
+static void tiers(const char *group, const char *name, const char *key, long value, bench_case *c) {
+    measure(group, name, "eval", key, value, time_eval, c);
+    c->program = te_lower(c->expr);
+    if (c->program) measure(group, name, "program", key, value, time_program, c);
+    te_program_free(c->program);
+    c->program = 0;
+    measure(group, name, "batch", key, value, time_batch, c);
+}
+
 
-    /*Million floats per second input.*/
-    printf(" %.5g", d);
-    if (eelapsed)
-        printf("\t%5dms\t%5dmfps\n", eelapsed, loops * loops / eelapsed / 1000);
-    else
-        printf("\tinf\n");
+static double x, y;
+static double xs[ROWS], ys[ROWS];
 
+static te_expr *compile_case(const char *expression, const te_variable *variables, int count) {
+    int error;
+    te_expr *n = te_compile(expression, variables, count, &error);
+    if (!n) {
+        fprintf(stderr, "bench: cannot compile %s (error at %d)\n", expression, error);
+        exit(1);
+    }
+    return n;
+}
 
-    printf("%.2f%% longer\n", (((double)eelapsed / nelapsed) - 1.0) * 100.0);
 
 
-    printf("\n");
+static double a5(double a) {return a+5;}
+static double a55(double a) {return 5+a+5;}
+static double a5abs(double a) {return fabs(a+5);}
+static double a52(double a) {return (a+5)*2;}
+static double a10(double a) {return a+(5*2);}
+static double as(double a) {return sqrt(pow(a, 1.5) + pow(a, 2.5));}
+static double al(double a) {return (1/(a+1)+2/(a+2)+3/(a+3));}
+
+static void bench_scalar(void) {
+    static const struct {const char *expression; double (*native)(double);} cases[] = {
+        {"a+5", a5}, {"5+a+5", a55}, {"abs(a+5)", a5abs}, {"sqrt(a^1.5+a^2.5)", as},
+        {"a+(5*2)", a10}, {"(a+5)*2", a52}, {"(1/(a+1)+2/(a+2)+3/(a+3))", al},
+    };
+    const te_variable lookup[] = {{"a", &x}};
+    int i;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        bench_case c = {0};
+        c.expr = compile_case(cases[i].expression, lookup, 1);
+        c.native = cases[i].native;
+        c.x = &x;
+        c.xs = xs;
+        measure("scalar", cases[i].expression, "native", 0, 0, time_native, &c);
+        tiers("scalar", cases[i].expression, 0, 0, &c);
+        te_free(c.expr);
+    }
 }
 
 
-double a5(double a) {
-    return a+5;
+static void bench_arrays(void) {
+    static const char *cases[] = {"sum(a)", "variance(a)", "arrmax(a) - arrmin(a)", "dot(a, b)", "argmax(a)",
+        "c[3] + c[x > 50]"};
+    static const int sizes[] = {16, 1024, 65536};
+    int i, j, k;
+    for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); ++j) {
+        double *a = malloc((sizes[j] + 1) * sizeof(double));
+        double *b = malloc((sizes[j] + 1) * sizeof(double));
+        double *fixed = malloc((sizes[j] + 1) * sizeof(double));
+        a[0] = b[0] = fixed[0] = sizes[j];
+        for (k = 1; k <= sizes[j]; ++k) {
+            a[k] = fixed[k] = sin(k * 0.37) * 100;
+            b[k] = cos(k * 0.11);
+        }
+        const te_variable lookup[] = {{"a", a}, {"b", b}, {"x", &x}, {"c", fixed, TE_VARIABLE | TE_FLAG_IMMUTABLE}};
+        for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+            bench_case c = {0};
+            c.expr = compile_case(cases[i], lookup, 4);
+            c.x = &x;
+            c.xs = xs;
+            measure("arrays", cases[i], "eval", "size", sizes[j], time_eval, &c);
+            c.program = te_lower(c.expr);
+            if (c.program) measure("arrays", cases[i], "program", "size", sizes[j], time_program, &c);
+            te_program_free(c.program);
+            te_free(c.expr);
+        }
+        free(a);
+        free(b);
+        free(fixed);
+    }
 }
 
-double a55(double a) {
-    return 5+a+5;
+
+static void bench_lerp(void) {
+    static const int sizes[] = {4, 64, 4096};
+    int j, k;
+    for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); ++j) {
+        double *d = malloc((sizes[j] + 1) * sizeof(double));
+        double *r = malloc((sizes[j] + 1) * sizeof(double));
+        d[0] = r[0] = sizes[j];
+        for (k = 1; k <= sizes[j]; ++k) {
+            d[k] = (k - 1) * 100.0 / (sizes[j] - 1);
+            r[k] = sqrt(d[k]);
+        }
+        const te_variable lookup[] = {
+            {"d", d}, {"r", r}, {"x", &x},
+            {"cd", d, TE_VARIABLE | TE_FLAG_IMMUTABLE}, {"cr", r, TE_VARIABLE | TE_FLAG_IMMUTABLE},
+        };
+        static const char *cases[] = {"linear_interpolate(d, r, x)", "linear_interpolate(cd, cr, x)",
+            "linear_interpolate(cd, cr, if(x < 50, 25, 75))"};
+        for (k = 0; k < sizeof(cases) / sizeof(cases[0]); ++k) {
+            bench_case c = {0};
+            c.expr = compile_case(cases[k], lookup, 5);
+            c.x = &x;
+            c.xs = xs;
+            tiers("lerp", cases[k], "size", sizes[j], &c);
+            te_free(c.expr);
+        }
+        free(d);
+        free(r);
+    }
 }
 
-double a5abs(double a) {
-    return fabs(a+5);
+
+static void bench_bitwise(void) {
+    static const char *cases[] = {
+        "x & 255",
+        "(x & 255) | (y & 65280)",
+        "xor(x, y) & bit(x, 3)",
+        "bit(x, 3) | bit(x, 7)",
+        "(x > 10) & (y < 100) | (x > 90)",
+        "((x & 4095) | (y & 255)) & (x | 7) | xor(y, 21) | bit(y, 5)",
+    };
+    const te_variable lookup[] = {{"x", &x}, {"y", &y}};
+    int i;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        bench_case c = {0};
+        c.expr = compile_case(cases[i], lookup, 2);
+        c.x = &x;
+        c.y = &y;
+        c.xs = xs;
+        c.ys = ys;
+        tiers("bitwise", cases[i], 0, 0, &c);
+        te_free(c.expr);
+    }
 }
 
-double a52(double a) {
-    return (a+5)*2;
+
+static double scaled(void *context, double a, double b) {
+    return *(const double*)context * a + b;
 }
 
-double a10(double a) {
-    return a+(5*2);
+static void scaled_vector(void *context, const double **args, double *out, size_t n) {
+    const double k = *(const double*)context;
+    size_t i;
+    for (i = 0; i < n; ++i) out[i] = k * args[0][i] + args[1][i];
 }
 
-double as(double a) {
-    return sqrt(pow(a, 1.5) + pow(a, 2.5));
+static void bench_closures(void) {
+    static double k = 3;
+    static const char *cases[] = {"f(x, y)", "f(x, 1) + f(y, 2)", "v(x, y)", "v(f(x, y), x) - v(y, 1)"};
+    const te_variable lookup[] = {
+        {"x", &x}, {"y", &y},
+        {"f", scaled, TE_CLOSURE2, &k},
+        {"v", scaled, TE_CLOSURE2 | TE_FLAG_PURE | TE_FLAG_VECTOR, &k, scaled_vector},
+    };
+    int i;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        bench_case c = {0};
+        c.expr = compile_case(cases[i], lookup, 4);
+        c.x = &x;
+        c.y = &y;
+        c.xs = xs;
+        c.ys = ys;
+        tiers("closures", cases[i], 0, 0, &c);
+        te_free(c.expr);
+    }
 }
 
-double al(double a) {
-    return (1/(a+1)+2/(a+2)+3/(a+3));
+
+static double cx, cy, cz, cw;
+static double carr[] = {4, 1, 5, 2, 8};
+
+static const te_variable compile_lookup[] = {
+    {"x", &cx}, {"y", &cy}, {"z", &cz}, {"w", &cw}, {"arr", carr},
+    {"gain", &cx}, {"offset", &cy}, {"threshold", &cz}, {"reading", &cw},
+};
+
+static void time_compile(const void *context, long n) {
+    const char *expression = context;
+    long i;
+    for (i = 0; i < n; ++i) {
+        te_expr *e = te_compile(expression, compile_lookup, sizeof(compile_lookup) / sizeof(compile_lookup[0]), 0);
+        sink += e != 0;
+        te_free(e);
+    }
+}
+
+static void time_interp(const void *context, long n) {
+    long i;
+    for (i = 0; i < n; ++i) sink += te_interp(context, 0);
+}
+
+static void bench_compile(void) {
+    static const char *formulas[] = {
+        "x+5",
+        "sqrt(x^2 + y^2 + z^2)",
+        "(1/(x+1)+2/(x+2)+3/(x+3))",
+        "gain * reading + offset",
+        "if(reading > threshold, (reading - threshold) * gain, 0)",
+        "sum(arr) / arrlen(arr) + arrmax(arr) - arrmin(arr)",
+        "atan2(y, x) * 180 / pi + 0.5 * sin(2 * x) * cos(y / 3)",
+        "0.000123 * x^3 - 12.75 * x^2 + 1024.5 * x - 3.14159",
+        "(x & 255) | (y & 65280) + xor(z, 7)",
+        "x < 0.5 && y >= 2.25 || z != 10",
+    };
+    static const char *constants[] = {
+        "5+5",
+        "sqrt(3^2 + 4^2)",
+        "0.000123 * 12.5^3 - 12.75 * 12.5^2 + 1024.5 * 12.5 - 3.14159",
+        "atan2(1, 2) * 180 / pi + 0.5 * sin(2) * cos(1 / 3)",
+    };
+    int i;
+    for (i = 0; i < sizeof(formulas) / sizeof(formulas[0]); ++i)
+        measure("compile", formulas[i], "te_compile", 0, 0, time_compile, formulas[i]);
+    for (i = 0; i < sizeof(constants) / sizeof(constants[0]); ++i)
+        measure("compile", constants[i], "te_interp", 0, 0, time_interp, constants[i]);
+}
+
+
+static void bench_pool(void) {
+    static const char *cases[] = {"sqrt(a^1.5+a^2.5)", "a & 255 | xor(a, 21)"};
+    const te_variable lookup[] = {{"a", &x}};
+    double *rows = malloc(POOL_ROWS * sizeof(double));
+    te_pool *all = te_pool_new(0, 0);
+    const int cores = all ? te_pool_threads(all) : 1;
+    int i, threads;
+    te_pool_free(all);
+    for (i = 0; i < POOL_ROWS; ++i) rows[i] = xs[i & (ROWS - 1)] + (i >> 12);
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        bench_case c = {0};
+        c.expr = compile_case(cases[i], lookup, 1);
+        c.x = &x;
+        c.xs = rows;
+        /* 1, 2, 4, ... threads, and then one per core. */
+        for (threads = 1;; threads *= 2) {
+            if (threads > cores) threads = cores;
+            c.pool = te_pool_new(threads, 0);
+            if (!c.pool) break;
+            measure("pool", cases[i], "te_pool_eval_batch", "threads", te_pool_threads(c.pool), time_pool, &c);
+            te_pool_free(c.pool);
+            if (threads == cores) break;
+        }
+        te_free(c.expr);
+    }
+    free(rows);
 }
 
-int main(int argc, char *argv[])
-{
 
-    bench("a+5", a5);
-    bench("5+a+5", a55);
-    bench("abs(a+5)", a5abs);
 
-    bench("sqrt(a^1.5+a^2.5)", as);
-    bench("a+(5*2)", a10);
-    bench("(a+5)*2", a52);
-    bench("(1/(a+1)+2/(a+2)+3/(a+3))", al);
+static const struct {const char *name; void (*bench)(void);} groups[] = {
+    {"scalar", bench_scalar}, {"arrays", bench_arrays}, {"lerp", bench_lerp}, {"bitwise", bench_bitwise},
+    {"closures", bench_closures}, {"compile", bench_compile}, {"pool", bench_pool},
+};
 
+int main(int argc, char *argv[])
+{
+    const int group_count = sizeof(groups) / sizeof(groups[0]);
+    int selected[sizeof(groups) / sizeof(groups[0])] = {0};
+    int i, j, any = 0;
+
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc) repetitions = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc) warmups = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc) target_ns = atof(argv[++i]) * 1e6;
+        else {
+            for (j = 0; j < group_count && strcmp(argv[i], groups[j].name); ++j);
+            if (j == group_count) {
+                fprintf(stderr, "usage: %s [-r repetitions] [-w warmups] [-t milliseconds] [group ...]\n", argv[0]);
+                return 1;
+            }
+            selected[j] = any = 1;
+        }
+    }
+    if (repetitions < 1) repetitions = 1;
+    if (repetitions > MAX_REPETITIONS) repetitions = MAX_REPETITIONS;
+    if (warmups < 0) warmups = 0;
+
+    for (i = 0; i < ROWS; ++i) {
+        xs[i] = (i * 7919 % 10000) / 100.0;
+        ys[i] = (i * 104729 % 4096) + 0.25;
+    }
+
+    printf("{\n  \"repetitions\": %d, \"warmups\": %d,\n", repetitions, warmups);
+    printf("  \"options\": [");
+    i = 0;
+#ifdef TE_SIMD
+    printf("%s\"TE_SIMD\"", i++ ? ", " : "");
+#endif
+#ifdef TE_FAST_MATH
+    printf("%s\"TE_FAST_MATH\"", i++ ? ", " : "");
+#endif
+#ifdef TE_ACCURATE_SUM
+    printf("%s\"TE_ACCURATE_SUM\"", i++ ? ", " : "");
+#endif
+#ifdef TE_LERP_CACHE
+    printf("%s\"TE_LERP_CACHE\"", i++ ? ", " : "");
+#endif
+#ifdef TE_JIT
+    printf("%s\"TE_JIT\"", i++ ? ", " : "");
+#endif
+#ifdef TE_PROFILE
+    printf("%s\"TE_PROFILE\"", i++ ? ", " : "");
+#endif
+#ifdef TE_THREADS
+    printf("%s\"TE_THREADS\"", i++ ? ", " : "");
+#endif
+    printf("],\n  \"results\": [");
+
+    for (i = 0; i < group_count; ++i)
+        if (!any || selected[i]) groups[i].bench();
+
+    printf("\n  ]\n}\n");
     return 0;
 }
@@ -0,0 +1,117 @@
+#include "tinyexpr.hpp"
+#include "minctest.h"
+#include <stdio.h>
+#include <string.h>
+#include <utility>
+
+
+static double x, y;
+static double arr[] = {3, 10, 20, 30};
+
+static te_variable lookup[] = {
+    {"x", &x, TE_VARIABLE, 0}, {"y", &y, TE_VARIABLE, 0}, {"arr", arr, TE_VARIABLE, 0},
+};
+
+
+static double absolute(double a) {return fabs(a);}
+
+
+static int same_bits(double a, double b) {
+    return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+
+template <class Text>
+static void check(Text text, int inlined) {
+    /* The fixed expression gives te_eval's bits for a spread of inputs. */
+    int err, err2;
+    auto fixed = te::compile(text, lookup, 3, &err);
+    te_expr *n = te_compile(Text::str(), lookup, 3, &err2);
+    lequal(err, err2);
+    lequal(fixed.inlined(), inlined);
+    if (!n) {
+        lok(!fixed);
+        return;
+    }
+
+    int i, same = 1;
+    for (i = -40; i <= 40; ++i) {
+        x = i * 0.37;
+        y = 2 - i * 0.11;
+        same &= same_bits(te::eval(fixed), te_eval(n));
+    }
+    if (!same) printf("differs: %s\n", Text::str());
+    lok(same);
+    te_free(n);
+}
+
+
+void test_inlined() {
+    check(TE_EXPR("1"), 1);
+    check(TE_EXPR("x+y*2-x/y"), 1);
+    check(TE_EXPR("-x^2"), 1);
+    check(TE_EXPR("--x^-y^2"), 1);
+    check(TE_EXPR("x^y^0.5"), 1);
+    check(TE_EXPR("+-+x % 3"), 1);
+    check(TE_EXPR("(x, y, 2)"), 1);
+    check(TE_EXPR("sin x + cos(y) * tan(x/7)"), 1);
+    check(TE_EXPR("sqrt abs x + exp(y/4) - ln(abs(x)+1) + log(x*x+1) + log10(y*y+1)"), 1);
+    check(TE_EXPR("atan2(x, y) + pow(abs(x), 0.3) + asin(y/10) + acos(-y/10) + atan x"), 1);
+    check(TE_EXPR("floor x + ceil y + sinh(y/3) + cosh(y/3) + tanh x"), 1);
+    check(TE_EXPR("pi * e() + pi() - e"), 1);
+    check(TE_EXPR("(abs(x*4) & 12) | 3 + xor(abs(x), 5) + bit(abs(y*3), 1)"), 1);
+    check(TE_EXPR("x & -1"), 1);
+    check(TE_EXPR("arr[x] + arr[abs(x) / 4] - arr[1.9]"), 1);
+    check(TE_EXPR("arr[arr[0] - 1]"), 1);
+    check(TE_EXPR("0.1 + .5 + 5. + 1e3 + 1.5e-3 + 25E+2 + 0.000123 + 9007199254740992"), 1);
+    check(TE_EXPR(" x\t*\n2\r"), 1);
+}
+
+
+void test_fallback() {
+    /* These go through te_compile, for the same result or error. */
+    check(TE_EXPR("sum(arr) + x"), 0);
+    check(TE_EXPR("fac 5 + ncr(6, 2)"), 0);
+    check(TE_EXPR("0x1f + x"), 0);
+    check(TE_EXPR("123456789012345678901 + x"), 0);
+    check(TE_EXPR("1e300 * x"), 0);
+    check(TE_EXPR("0.1234567890123456789"), 0);
+    check(TE_EXPR("z + 1"), 0);
+    check(TE_EXPR("x +"), 0);
+    check(TE_EXPR("arr[1][2]"), 0);
+    check(TE_EXPR("sin(x"), 0);
+    check(TE_EXPR("atan2(x)"), 0);
+    check(TE_EXPR("."), 0);
+    check(TE_EXPR("1e"), 0);
+    check(TE_EXPR("x ; y"), 0);
+    check(TE_EXPR("x < y && y != 2 || x >= 1"), 0);
+    check(TE_EXPR("if(x, y, 2) + x"), 0);
+
+    /* A table entry shadows a builtin of the same name. */
+    double e = 10;
+    te_variable shadow[] = {{"e", &e, TE_VARIABLE, 0}};
+    auto fixed = te::compile(TE_EXPR("e + 1"), shadow, 1);
+    lok(!fixed.inlined());
+    lfequal(te::eval(fixed), 11);
+
+    /* A name bound to a function. */
+    te_variable function[] = {{"x", (const void*)absolute, TE_FUNCTION1 | TE_FLAG_PURE, 0}};
+    auto called = te::compile(TE_EXPR("x -3"), function, 1);
+    lok(!called.inlined());
+    lfequal(te::eval(called), 3);
+
+    /* Moving keeps the binding. */
+    auto moved = std::move(fixed);
+    lok(!fixed && moved);
+    lfequal(te::eval(moved), 11);
+}
+
+
+int main(int argc, char *argv[])
+{
+    lrun("Inlined", test_inlined);
+    lrun("Fallback", test_fallback);
+    lresults();
+
+    return lfails != 0;
+}
@@ -24,6 +24,8 @@
 
 #include "tinyexpr.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "minctest.h"
 
 
@@ -157,6 +159,11 @@ void test_results() {
         lok(!err);
         lfequal(ev, answer);
 
+        /* te_interp evaluates the tree unoptimized, to the same bits. */
+        te_expr *n = te_compile(expr, 0, 0, 0);
+        lok(n && te_eval(n) == ev);
+        te_free(n);
+
         if (err) {
             printf("FAILED: %s (%d)\n", expr, err);
         }
@@ -204,6 +211,60 @@ void test_syntax() {
         const double k = te_interp(expr, 0);
         lok(k != k);
     }
+
+    /* Expressions too long for te_interp's stack go through te_compile. */
+    static char text[8003];
+    for (i = 0; i < 4000; ++i) memcpy(text + 2 * i, i ? "+1" : " 1", 2);
+    int err;
+    lfequal(te_interp(text, &err), 4000);
+    lequal(err, 0);
+    strcpy(text + 8000, "+)");
+    lok(isnan(te_interp(text, &err)));
+    lequal(err, 8002);
+}
+
+
+void test_numbers() {
+    /* Decimal literals give strtod's bits, whichever way the tokenizer reads them. */
+    const char *fixed[] = {
+        "0", "0.1", "4.35", ".5", "5.", "1e22", "1e23", "1.7976931348623157e308", "2.2250738585072014e-308",
+        "9007199254740992", "9007199254740993", "12345678901234567890", "0.30000000000000004",
+        "1e-22", "1e-23", "123.456e-5", "7E+2", "0000012.5000", "1e0400", "5e-400",
+    };
+    char text[64];
+    int i, failed = 0;
+    for (i = 0; i < sizeof(fixed) / sizeof(fixed[0]); ++i) failed += te_interp(fixed[i], 0) != strtod(fixed[i], 0);
+
+    srand(7);
+    for (i = 0; i < 20000; ++i) {
+        sprintf(text, "%d.%0*de%d", rand() % 100000, rand() % 12, rand() % 1000000, rand() % 61 - 30);
+        failed += te_interp(text, 0) != strtod(text, 0);
+    }
+    lequal(failed, 0);
+
+    /* An exponent without digits isn't part of the number, so e is the next token. */
+    int err;
+    lok(isnan(te_interp("2e+1", &err)) == 0 && err == 0);
+    lok(isnan(te_interp("2e", &err)) && err == 2);
+    lok(isnan(te_interp("2e+", &err)) && err == 2);
+
+    /* Every builtin is found by name, and nothing else. */
+    double x = 0.5, a[] = {2, 1, 2};
+    te_variable lookup[] = {{"x", &x}, {"a", a}};
+    const char *builtins[] = {
+        "abs x", "acos x", "argmax a", "argmin a", "arrlen a", "arrmax a", "arrmin a", "asin x", "atan x",
+        "atan2(x, x)", "bit(x, 1)", "ceil x", "cos x", "cosh x", "dot(a, a)", "e", "exp x", "fac x",
+        "floor x", "if(x, x, x)", "linear_interpolate(a, a, x)", "ln x", "log x", "log10 x", "mean a",
+        "ncr(x, x)", "npr(x, x)", "pi", "pow(x, x)", "sin x", "sinh x", "sqrt x", "sum a", "tan x",
+        "tanh x", "variance a", "xor(x, x)",
+    };
+    for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+        te_expr *n = te_compile(builtins[i], lookup, 2, 0);
+        lok(n);
+        te_free(n);
+    }
+    const char *unknown[] = {"ab x", "absx", "sinhh x", "Sin x", "pii", "linear x", "xo(x, x)"};
+    for (i = 0; i < sizeof(unknown) / sizeof(unknown[0]); ++i) lok(!te_compile(unknown[i], lookup, 2, 0));
 }
 
 
@@ -690,10 +751,1928 @@ void test_combinatorics() {
 }
 
 
+void test_program() {
+    double x, y, extra = 3;
+    double arr[] = {3, 10, 20, 30};
+    double dom[] = {3, 0, 10, 20};
+    te_variable lookup[] = {
+        {"x", &x},
+        {"y", &y},
+        {"arr", arr},
+        {"dom", dom},
+        {"sum3", sum3, TE_FUNCTION3},
+        {"sum7", sum7, TE_FUNCTION7},
+        {"c0", clo0, TE_CLOSURE0, &extra},
+        {"c2", clo2, TE_CLOSURE2, &extra},
+    };
+
+    const char *cases[] = {
+        "x+5", "5+x+5", "abs(x+5)", "sqrt(x^1.5+y^2.5)", "(x+5)*2",
+        "(1/(x+1)+2/(y+2)+3/(x+3))", "x%y", "-x^2", "x,y", "x-y*2",
+        "3&x", "x|4", "xor(x, 6)", "bit(x, 1)", "atan2(x, y)",
+        "sum3(x, y, 1)", "sum7(1, x, 2, y, 3, x, 4)", "c0 + c2(x, y)",
+        "arr[x]", "arr[y-x] + arr[0]", "sum(arr) + arrlen(arr)",
+        "arrmin(arr) * arrmax(arr)", "linear_interpolate(dom, arr, x*3)", "pi*e",
+    };
+
+    int i;
+    for (i = 0; i < sizeof(cases) / sizeof(const char *); ++i) {
+        int err;
+        te_expr *ex = te_compile(cases[i], lookup, sizeof(lookup)/sizeof(te_variable), &err);
+        lok(ex);
+        te_program *p = te_lower(ex);
+        lok(p);
+
+        for (x = 0; x < 4; x += 1) {
+            for (y = 0; y < 3; y += .5) {
+                const double a = te_eval(ex);
+                const double b = te_program_eval(p);
+                if (a != a) {
+                    lok(b != b);
+                } else {
+                    lfequal(a, b);
+                }
+            }
+        }
+
+        te_program_free(p);
+        te_free(ex);
+    }
+}
+
+
+void test_batch() {
+    double x, y, z = 4, extra = 1;
+    double arr[] = {3, 10, 20, 30};
+    double dom[] = {3, 0, 10, 20};
+    te_variable lookup[] = {
+        {"x", &x},
+        {"y", &y},
+        {"z", &z},
+        {"arr", arr},
+        {"dom", dom},
+        {"sum3", sum3, TE_FUNCTION3},
+        {"c2", clo2, TE_CLOSURE2, &extra},
+    };
+
+    const char *cases[] = {
+        "x+5", "5+x+5", "abs(x+5)", "sqrt(x^1.5+y^2.5)", "(x+5)*2",
+        "(1/(x+1)+2/(y+2)+3/(x+3))", "x%y", "-x*z", "x,y", "3&x",
+        "sum3(x, y, z)", "c2(x, y)", "arr[x/100]", "sum(arr)*x",
+        "linear_interpolate(dom, arr, y/50)", "pi*e",
+        "sqrt(x)*abs(y-150)", "floor(y/7)+ceil(-x/3)", "x/y-z*x", "sqrt(-x)",
+    };
+
+    /* x is a packed column, y is interleaved with junk. */
+    enum {rows = 300};
+    double xs[rows], ys[rows * 2], out[rows];
+    te_column columns[] = {{&x, xs, 1}, {&y, ys, 2}};
+
+    int i, r;
+    for (r = 0; r < rows; ++r) {
+        xs[r] = r;
+        ys[r * 2] = rows - r;
+        ys[r * 2 + 1] = -1;
+    }
+
+    for (i = 0; i < sizeof(cases) / sizeof(const char *); ++i) {
+        int err;
+        te_expr *ex = te_compile(cases[i], lookup, sizeof(lookup)/sizeof(te_variable), &err);
+        lok(ex);
+
+        te_eval_batch(ex, columns, 2, rows, out);
+
+        int failed = 0;
+        for (r = 0; r < rows; ++r) {
+            x = xs[r];
+            y = ys[r * 2];
+            const double a = te_eval(ex);
+            if (a != a ? out[r] == out[r] : fabs(a - out[r]) > 1e-9) ++failed;
+        }
+        lequal(failed, 0);
+        if (failed) printf("Failed expression: %s\n", cases[i]);
+
+        te_free(ex);
+    }
+}
+
+
+static float batchf_reference(int i, float x, float y) {
+    /* Each case of test_batchf in C, one rounding at a time. */
+    float a, b;
+    switch (i) {
+        case 0: a = x * x; b = y * y; a = sqrtf(a + b); b = floorf(x) * 0.5f; a = a - b; b = sinf(y) * fabsf(x); return a + b;
+        case 1: a = (x + 1) / (y + 2); b = powf(fabsf(x), 1.5f) * atan2f(y, x); return a + b;
+        case 2: return (float)clo2(0, x, y) * x + 6;
+        case 3: a = sinf(x); b = a * y; return b + a;
+        case 4: a = 30.0f - 10.0f; return a + x;
+        default: return fmodf(x, 7) - y;
+    }
+}
+
+void test_batchf() {
+    double x, y;
+    double arr[] = {3, 10, 20, 30};
+    te_variable lookup[] = {{"x", &x}, {"y", &y}, {"arr", arr}, {"c2", clo2, TE_CLOSURE2}};
+    const char *cases[] = {
+        "sqrt(x*x + y*y) - floor(x) * 0.5 + sin(y) * abs(x)",
+        "(x + 1) / (y + 2) + pow(abs(x), 1.5) * atan2(y, x)",
+        "c2(x, y) * x + fac(3)",
+        "sin(x) * y + sin(x)",
+        "arrmax(arr) - arrmin(arr) + x",
+        "x % 7 - y",
+    };
+
+    /* x is a packed column, y is interleaved with junk. */
+    enum {rows = 300};
+    float xs[rows], ys[rows * 2], out[rows], pooled[rows];
+    te_columnf columns[] = {{&x, xs, 1}, {&y, ys, 2}};
+    te_pool *pool = te_pool_new(3, 0);
+    int i, r;
+    for (r = 0; r < rows; ++r) {
+        xs[r] = r * 0.37f - 40;
+        ys[r * 2] = 60 - r * 0.21f;
+        ys[r * 2 + 1] = -1;
+    }
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i], lookup, 4, 0);
+        lok(ex);
+        te_eval_batchf(ex, columns, 2, rows, out);
+        te_pool_eval_batchf(pool, ex, columns, 2, rows, pooled);
+
+        int failed = 0;
+        for (r = 0; r < rows; ++r) {
+            const float expected = batchf_reference(i, xs[r], ys[r * 2]);
+            if (memcmp(&out[r], &expected, sizeof(float)) || memcmp(&pooled[r], &expected, sizeof(float))) ++failed;
+        }
+        lequal(failed, 0);
+        if (failed) printf("Failed expression: %s\n", cases[i]);
+        te_free(ex);
+    }
+
+    /* Variables without a column read their bound value. */
+    x = 2.5;
+    te_expr *ex = te_compile("x * y", lookup, 4, 0);
+    te_eval_batchf(ex, columns + 1, 1, 3, out);
+    lfequal(out[2], 2.5f * ys[4]);
+    te_free(ex);
+    te_pool_free(pool);
+}
+
+
+static int inside(const te_expr *n, const char *start, const char *end) {
+    /* Checks that a compiled tree lives in [start, end). */
+    const int type = n->type & 0x1F;
+    const int arity = type == TE_ARRAY ? 1 : (type & (TE_FUNCTION0 | TE_CLOSURE0)) ? type & 7 : 0;
+    int i;
+    if ((const char*)n < start || (const char*)n >= end) return 0;
+    for (i = 0; i < arity; ++i) {
+        if (!inside(n->parameters[i], start, end)) return 0;
+    }
+    return 1;
+}
+
+void test_pack() {
+    double x = 2, y = 3, extra = 1;
+    double arr[] = {3, 10, 20, 30};
+    te_variable lookup[] = {
+        {"x", &x},
+        {"y", &y},
+        {"arr", arr},
+        {"c2", clo2, TE_CLOSURE2, &extra},
+    };
+
+    test_case cases[] = {
+        {"x+5", 7},
+        {"sqrt(x^2+y^2)*2", 7.2111},
+        {"c2(x, y) + arr[x]", 36},
+        {"sum(arr) - arr[0]", 50},
+        {"(1+2)*3", 9},
+        {"-x", -2},
+    };
+
+    int i;
+    for (i = 0; i < sizeof(cases) / sizeof(test_case); ++i) {
+        int err;
+        te_expr *ex = te_compile(cases[i].expr, lookup, sizeof(lookup)/sizeof(te_variable), &err);
+        lok(ex);
+        lfequal(te_eval(ex), cases[i].answer);
+
+        /* te_compile gives one contiguous block. */
+        const int size = te_size(ex);
+        lok(size > 0);
+        lok(inside(ex, (const char*)ex, (const char*)ex + size));
+
+        /* Packing into caller memory. */
+        double buffer[64];
+        lok(!te_pack(ex, buffer, size - 1));
+        te_expr *copy = te_pack(ex, buffer, sizeof(buffer));
+        lok(copy == (te_expr*)buffer);
+        lequal(te_size(copy), size);
+        lfequal(te_eval(copy), cases[i].answer);
+
+        te_free(ex);
+    }
+}
+
+
+void test_symbols() {
+    enum {count = 2000};
+    static char names[count][8];
+    static double values[count];
+    static te_variable lookup[count + 3];
+
+    int i;
+    for (i = 0; i < count; ++i) {
+        sprintf(names[i], "v%d", (i * 7919) % count);
+        values[i] = (i * 7919) % count;
+        lookup[i].name = names[i];
+        lookup[i].address = values + i;
+    }
+
+    /* Duplicates resolve to the first entry, as with te_compile. */
+    double first = 1, second = 2;
+    lookup[count].name = "dup"; lookup[count].address = &first;
+    lookup[count + 1].name = "dup"; lookup[count + 1].address = &second;
+    lookup[count + 2].name = "sum2"; lookup[count + 2].address = sum2; lookup[count + 2].type = TE_FUNCTION2;
+
+    te_symbols *symbols = te_symbols_new(lookup, count + 3);
+    lok(symbols);
+
+    test_case cases[] = {
+        {"v0", 0},
+        {"v1999+v1", 2000},
+        {"v10*v20", 200},
+        {"dup", 1},
+        {"sum2(v3, dup)", 4},
+        {"sqrt(v16)", 4},
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(test_case); ++i) {
+        int err;
+        te_expr *ex = te_compile_symbols(cases[i].expr, symbols, &err);
+        lok(ex);
+        lequal(err, 0);
+        lfequal(te_eval(ex), cases[i].answer);
+        te_free(ex);
+
+        ex = te_compile(cases[i].expr, lookup, count + 3, &err);
+        lfequal(te_eval(ex), cases[i].answer);
+        te_free(ex);
+    }
+
+    const char *errors[] = {"v2000", "v", "du", "dupe", "v1+w1"};
+    for (i = 0; i < sizeof(errors) / sizeof(const char *); ++i) {
+        int err, err2;
+        te_expr *ex = te_compile_symbols(errors[i], symbols, &err);
+        lok(!ex);
+        te_compile(errors[i], lookup, count + 3, &err2);
+        lequal(err, err2);
+    }
+
+    te_symbols_free(symbols);
+}
+
+
+void test_frame() {
+    struct record {double x, y; int tag; double z;} layout, rows[3] = {{3, 4, 0, 1}, {5, 12, 1, 2}, {8, 15, 2, 3}};
+    double w = 10;
+
+    te_variable lookup[] = {
+        {"x", &layout.x},
+        {"y", &layout.y},
+        {"z", &layout.z},
+        {"w", &w},
+        {"sum2", sum2, TE_FUNCTION2},
+        {"clo2", clo2, TE_CLOSURE2, &w},
+    };
+
+    test_case cases[] = {
+        {"sqrt(x^2+y^2)", 0},
+        {"x+y*z", 0},
+        {"sum2(x, w)", 0},
+        {"clo2(z, 1)", 0},
+        {"w-z", 0},
+    };
+
+    int i, j;
+    for (i = 0; i < sizeof(cases) / sizeof(test_case); ++i) {
+        int err;
+        te_expr *ex = te_compile_frame(cases[i].expr, lookup, 6, &layout, sizeof(layout), &err);
+        lok(ex);
+        lequal(err, 0);
+        te_program *p = te_lower(ex);
+        lok(p);
+
+        /* The same compiled expression, reading from each record in turn. */
+        for (j = 0; j < 3; ++j) {
+            te_expr *bound = te_compile(cases[i].expr, (te_variable[]){
+                {"x", &rows[j].x}, {"y", &rows[j].y}, {"z", &rows[j].z}, {"w", &w},
+                {"sum2", sum2, TE_FUNCTION2}, {"clo2", clo2, TE_CLOSURE2, &w}}, 6, 0);
+            const double expected = te_eval(bound);
+            lfequal(te_eval_frame(ex, rows + j), expected);
+            lfequal(te_program_eval_frame(p, rows + j), expected);
+            te_free(bound);
+        }
+
+        te_program_free(p);
+        te_free(ex);
+    }
+
+    /* Without a frame, frame variables are NaN; others stay bound. */
+    te_expr *ex = te_compile_frame("x+w", lookup, 6, &layout, sizeof(layout), 0);
+    lok(isnan(te_eval(ex)));
+    lfequal(te_eval_frame(ex, rows), 13);
+    te_free(ex);
+
+    ex = te_compile_frame("w", lookup, 6, &layout, sizeof(layout), 0);
+    lfequal(te_eval(ex), 10);
+    te_free(ex);
+
+    /* Every record in a batch reads its own frame. */
+    double out[3];
+    ex = te_compile_frame("x*y+w", lookup, 6, &layout, sizeof(layout), 0);
+    te_eval_batch_frame(ex, rows, sizeof(struct record), 3, out);
+    lfequal(out[0], 22);
+    lfequal(out[1], 70);
+    lfequal(out[2], 130);
+    te_eval_batch(ex, 0, 0, 1, out);
+    lok(isnan(out[0]));
+    te_free(ex);
+}
+
+
+void test_frame_arrays() {
+    /* Arrays are length-prefixed, like any other array variable. */
+    struct record {double domain[4], range[4], x, i;} layout, rows[2] = {
+        {{3, 0, 1, 2}, {3, 10, 20, 40}, 1.5, 0},
+        {{3, 0, 2, 4}, {3, 5, 1, 3}, 3, 1},
+    };
+
+    te_variable lookup[] = {
+        {"d", layout.domain},
+        {"r", layout.range},
+        {"x", &layout.x},
+        {"i", &layout.i},
+    };
+
+    const char *cases[] = {
+        "d[i]", "r[i+1]*x", "r[2]", "sum(r)", "arrlen(d)", "arrmin(r)+arrmax(r)",
+        "linear_interpolate(d, r, x)", "linear_interpolate(d, r, r[i]/10)"
+    };
+
+    int i, j;
+    for (i = 0; i < sizeof(cases) / sizeof(const char *); ++i) {
+        int err;
+        te_expr *ex = te_compile_frame(cases[i], lookup, 4, &layout, sizeof(layout), &err);
+        lok(ex);
+        lequal(err, 0);
+        te_program *p = te_lower(ex);
+
+        double expected[2], out[2];
+        for (j = 0; j < 2; ++j) {
+            te_expr *bound = te_compile(cases[i], (te_variable[]){
+                {"d", rows[j].domain}, {"r", rows[j].range}, {"x", &rows[j].x}, {"i", &rows[j].i}}, 4, 0);
+            expected[j] = te_eval(bound);
+            te_free(bound);
+
+            lfequal(te_eval_frame(ex, rows + j), expected[j]);
+            lfequal(te_program_eval_frame(p, rows + j), expected[j]);
+        }
+
+        te_eval_batch_frame(ex, rows, sizeof(struct record), 2, out);
+        lfequal(out[0], expected[0]);
+        lfequal(out[1], expected[1]);
+
+        /* Without a frame there is nothing to read. */
+        lok(isnan(te_eval(ex)));
+        lok(isnan(te_program_eval(p)));
+
+        te_program_free(p);
+        te_free(ex);
+    }
+
+    /* Indices are checked against each record's own length. */
+    te_expr *ex = te_compile_frame("r[i+2]", lookup, 4, &layout, sizeof(layout), 0);
+    lfequal(te_eval_frame(ex, rows), 40);
+    lok(isnan(te_eval_frame(ex, rows + 1)));
+    te_free(ex);
+}
+
+
+double counted(void *context, double a) {
+    ++*(int*)context;
+    return a * 3;
+}
+
+
+void test_cse() {
+    double x = 2;
+    int calls = 0, other = 0;
+    double d[] = {3, 0, 1, 2}, r[] = {3, 10, 20, 40};
+
+    te_variable lookup[] = {
+        {"x", &x},
+        {"d", d},
+        {"r", r},
+        {"f", counted, TE_CLOSURE1 | TE_FLAG_PURE, &calls},
+        {"g", counted, TE_CLOSURE1 | TE_FLAG_PURE, &other},
+        {"h", counted, TE_CLOSURE1, &calls},
+    };
+
+    /* Each repeat of a pure call is evaluated once per evaluation. */
+    te_expr *ex = te_compile("f(x+1) + f(x+1) * f(x+1)", lookup, 6, 0);
+    te_program *p = te_lower(ex);
+    lfequal(te_eval(ex), 90);
+    lequal(calls, 1);
+    lfequal(te_program_eval(p), 90);
+    lequal(calls, 2);
+
+    double xs[3] = {0, 1, 2}, out[3];
+    te_column col = {&x, xs, 1};
+    te_eval_batch(ex, &col, 1, 3, out);
+    lequal(calls, 5);
+    lfequal(out[0], 12);
+    lfequal(out[1], 42);
+    lfequal(out[2], 90);
+    te_program_free(p);
+    te_free(ex);
+
+    /* Different contexts and functions not flagged pure are all called. */
+    calls = 0;
+    ex = te_compile("f(x) + g(x) + h(x) + h(x)", lookup, 6, 0);
+    lfequal(te_eval(ex), 24);
+    lequal(calls, 3);
+    lequal(other, 1);
+    te_free(ex);
+
+    /* Nested repeats, and repeats inside a repeat. */
+    test_case cases[] = {
+        {"(x+5)*(x+5) + sqrt((x+5)*(x+5))", 56},
+        {"(x+5) + (x+5)*(x+5) + (x+5)^2", 105},
+        {"linear_interpolate(d, r, x/4) + linear_interpolate(d, r, x/4)", 30},
+        {"sum(r) / sum(r) + arrlen(d) + r[x-1] * r[x-1]", 404},
+        {"f(f(x)) + f(f(x)) + f(x)", 42},
+        /* Repeats in a branch of an if are left alone. */
+        {"sqrt(x+7) + if(sqrt(x+7), sqrt(x+7), 0)", 6},
+        {"sqrt(x+7) * (sqrt(x+7) && sqrt(x+7) > 1)", 3},
+        {"(x+1)*(x+1) + if(x, (x+1)*(x+1), (x+1)*(x+1)) + ((x+1)*(x+1) || 0)", 19},
+    };
+
+    int i;
+    for (i = 0; i < sizeof(cases) / sizeof(test_case); ++i) {
+        ex = te_compile(cases[i].expr, lookup, 6, 0);
+        lok(ex);
+        p = te_lower(ex);
+        lfequal(te_eval(ex), cases[i].answer);
+        lfequal(te_program_eval(p), cases[i].answer);
+        te_eval_batch(ex, 0, 0, 1, out);
+        lfequal(out[0], cases[i].answer);
+        te_program_free(p);
+        te_free(ex);
+    }
+
+    /* More repeats than temps. */
+    char expr[4096] = "0";
+    int len = 1;
+    double expected = 0;
+    for (i = 0; i < 80; ++i) {
+        len += sprintf(expr + len, "+(x+%d)*(x+%d)", i, i);
+        expected += (x + i) * (x + i);
+    }
+    ex = te_compile(expr, lookup, 6, 0);
+    lok(ex);
+    lfequal(te_eval(ex), expected);
+    p = te_lower(ex);
+    lfequal(te_program_eval(p), expected);
+    te_program_free(p);
+    te_free(ex);
+}
+
+static double p2(double x) {return pow(x, 2);}
+static double p0(double x) {return pow(x, 0);}
+static double p1(double x) {return pow(x + 1, 1);}
+static double m1(double x) {return x * 1 - x / 1;}
+static double d4(double x) {return x / 4 + x / -1;}
+static double s0(double x) {return (x - 0) * -1;}
+static double nn(double x) {return -(-(x * 3));}
+static double p3(double x) {return pow(x, 3) + pow(x, 4) + pow(x, 0.5);}
+static double d3(double x) {return x / 3 + (5 + x + 5) * 2 * 3 - 1 - 2;}
+
+void test_simplify() {
+    double x;
+    int calls = 0;
+    te_variable lookup[] = {{"x", &x}, {"h", counted, TE_CLOSURE1, &calls}};
+
+    struct {const char *expr; double (*native)(double); int exact;} cases[] = {
+        {"x^2", p2, 1},
+        {"x^0", p0, 1},
+        {"(x+1)^1", p1, 1},
+        {"x*1 - x/1", m1, 1},
+        {"x/4 + x/-1", d4, 1},
+        {"(x-0) * -1", s0, 1},
+        {"-(-(x*3))", nn, 1},
+#ifdef TE_FAST_MATH
+        /* These may differ in the last bit, so only compare within tolerance. */
+        {"x^3 + x^4 + x^0.5", p3, 0},
+        {"x/3 + (5+x+5)*2*3 - 1 - 2", d3, 0},
+#else
+        {"x^3 + x^4 + x^0.5", p3, 1},
+        {"x/3 + (5+x+5)*2*3 - 1 - 2", d3, 1},
+#endif
+    };
+    const double xs[] = {-2.5, -1, -0.0, 0, 0.5, 3, 1e300, INFINITY, -INFINITY, NAN};
+
+    int i, j;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i].expr, lookup, 2, 0);
+        lok(ex);
+        for (j = 0; j < sizeof(xs) / sizeof(double); ++j) {
+            x = xs[j];
+            const double a = te_eval(ex), b = cases[i].native(x);
+            if (cases[i].exact) {
+                /* Down to the sign of zero. */
+                lok((isnan(a) && isnan(b)) || (a == b && signbit(a) == signbit(b)));
+            } else if (isfinite(b) && fabs(b) < 1e100) {
+                lfequal(a, b);
+            }
+        }
+        te_free(ex);
+    }
+
+    /* Rewrites that always give the same result shrink the tree. */
+    te_expr *a = te_compile("x^2+x*1+x/1+(x-0)", lookup, 2, 0);
+    te_expr *b = te_compile("x*x+x+x+x", lookup, 2, 0);
+    lequal(te_size(a), te_size(b));
+    te_free(a);
+    te_free(b);
+
+#ifdef TE_FAST_MATH
+    a = te_compile("5+x+5", lookup, 2, 0);
+    b = te_compile("x+10", lookup, 2, 0);
+    lequal(te_size(a), te_size(b));
+    te_free(a);
+    te_free(b);
+#endif
+
+    /* Calls that might not be pure are neither repeated nor dropped. */
+    x = 2;
+    a = te_compile("h(x)^2 + h(x)^0", lookup, 2, 0);
+    lfequal(te_eval(a), 37);
+    lequal(calls, 2);
+    te_free(a);
+}
+
+static double scan_lerp(const double *domain, const double *range, double x) {
+    /* The straightforward linear scan, to check against. */
+    int n = (int)domain[0], i;
+    if ((int)range[0] != n || n < 2) return NAN;
+    const double *d = domain + 1, *r = range + 1;
+    int ascending = d[n - 1] > d[0];
+    for (i = 0; i < n - 1; ++i) {
+        if (ascending ? (x >= d[i] && x <= d[i + 1]) : (x <= d[i] && x >= d[i + 1])) {
+            if (d[i + 1] == d[i]) return (r[i] + r[i + 1]) / 2.0;
+            return r[i] + (x - d[i]) / (d[i + 1] - d[i]) * (r[i + 1] - r[i]);
+        }
+    }
+    return NAN;
+}
+
+
+void test_lerp() {
+    enum {points = 1000};
+    static double up[points + 1], down[points + 1], flat[points + 1], range[points + 1];
+    static double cup[points + 1], crange[points + 1];
+    double x;
+    int i, j;
+
+    up[0] = down[0] = flat[0] = range[0] = points;
+    for (i = 1; i <= points; ++i) {
+        up[i] = i * i * 0.01;
+        down[i] = -up[i];
+        flat[i] = (i / 3) * 2.0; /* Repeated knots. */
+        range[i] = sin(i * 0.1) * 100;
+    }
+    memcpy(cup, up, sizeof(up));
+    memcpy(crange, range, sizeof(range));
+
+    te_variable lookup[] = {
+        {"x", &x},
+        {"up", up}, {"down", down}, {"flat", flat}, {"range", range},
+        {"cup", cup, TE_VARIABLE | TE_FLAG_IMMUTABLE},
+        {"crange", crange, TE_VARIABLE | TE_FLAG_IMMUTABLE},
+    };
+
+    struct {const char *expr; const double *domain;} cases[] = {
+        {"linear_interpolate(up, range, x)", up},
+        {"linear_interpolate(down, range, -x)", down},
+        {"linear_interpolate(flat, range, x/8)", flat},
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i].expr, lookup, 7, 0);
+        lok(ex);
+        te_program *p = te_lower(ex);
+
+        static double xs[4 * points], out[4 * points];
+        for (j = 0; j < 4 * points; ++j) {
+            /* Knots, points between them, and some outside the table. */
+            xs[j] = j % 2 ? j * j * 0.000625 : (j / 2) * (j / 2) * 0.0025 - 1;
+        }
+        te_column col = {&x, xs, 1};
+        te_eval_batch(ex, &col, 1, 4 * points, out);
+
+        for (j = 0; j < 4 * points; ++j) {
+            x = xs[j];
+            const double arg = cases[i].domain == down ? -x : cases[i].domain == flat ? x / 8 : x;
+            const double expected = scan_lerp(cases[i].domain, range, arg);
+            const double a = te_eval(ex);
+            lok((isnan(a) && isnan(expected)) || a == expected);
+            lok((isnan(out[j]) && isnan(expected)) || out[j] == expected);
+            if (j % 7 == 0) {
+                const double b = te_program_eval(p);
+                lok((isnan(b) && isnan(expected)) || b == expected);
+            }
+        }
+
+        te_program_free(p);
+        te_free(ex);
+    }
+
+    /* Immutable tables get their slopes precomputed, which can change the last bit. */
+    te_expr *a = te_compile("linear_interpolate(up, range, x)", lookup, 7, 0);
+    te_expr *b = te_compile("linear_interpolate(cup, crange, x)", lookup, 7, 0);
+    lok(te_size(b) > te_size(a));
+    te_program *p = te_lower(b);
+    te_free(a);
+
+    a = te_pack(b, malloc(te_size(b)), te_size(b));
+    for (j = 1; j < 1000; ++j) {
+        x = j * 7.5;
+        const double expected = scan_lerp(up, range, x);
+        lfequal(te_eval(a), expected);
+        lfequal(te_eval(b), expected);
+        lfequal(te_program_eval(p), expected);
+    }
+    x = -1;
+    lok(isnan(te_eval(b)));
+    te_program_free(p);
+    te_free(a);
+    te_free(b);
+}
+
+void test_aggregates() {
+    enum {big = 100003};
+    static double a[big + 1];
+    double x;
+    int i, len;
+
+    te_variable lookup[] = {{"a", a}, {"x", &x}};
+    te_expr *sum = te_compile("sum(a)", lookup, 2, 0);
+    te_expr *mn = te_compile("arrmin(a)", lookup, 2, 0);
+    te_expr *mx = te_compile("arrmax(a)", lookup, 2, 0);
+    te_program *pmn = te_lower(mn);
+    lok(sum && mn && mx && pmn);
+
+    /* Lengths around every kernel width, then one large array. */
+    for (len = 1; len <= 41 || len == big; len = len == 41 ? big : len + 1) {
+        a[0] = len;
+        for (i = 1; i <= len; ++i) a[i] = sin(i * 7.1) * (i % 5 + 1);
+
+        double lo = a[1], hi = a[1], total = 0;
+        for (i = 1; i <= len; ++i) {
+            if (a[i] < lo) lo = a[i];
+            if (a[i] > hi) hi = a[i];
+            total += a[i];
+        }
+        lok(te_eval(mn) == lo);
+        lok(te_eval(mx) == hi);
+        lok(te_program_eval(pmn) == lo);
+#if defined(TE_ACCURATE_SUM) || defined(TE_FAST_MATH)
+        lok(fabs(te_eval(sum) - total) < 1e-9 * len);
+#else
+        lok(te_eval(sum) == total);
+#endif
+    }
+
+    /* The first NaN is kept, later ones are skipped. */
+    a[0] = 20;
+    for (i = 1; i <= 20; ++i) a[i] = i;
+    a[13] = NAN;
+    lok(te_eval(mn) == 1);
+    lok(te_eval(mx) == 20);
+    a[1] = NAN;
+    lok(isnan(te_eval(mn)));
+    lok(isnan(te_eval(mx)));
+
+    /* Of equal zeros the first wins, wherever the lanes put them. */
+    for (i = 1; i <= 20; ++i) a[i] = 1;
+    a[7] = -0.0;
+    a[12] = 0.0;
+    lok(signbit(te_eval(mn)));
+    for (i = 1; i <= 20; ++i) a[i] = -1;
+    a[7] = 0.0;
+    a[12] = -0.0;
+    lok(!signbit(te_eval(mx)));
+
+    a[0] = 0;
+    lok(te_eval(sum) == 0);
+    lok(isnan(te_eval(mn)));
+
+    /* Infinities go through the sum unchanged. */
+    a[0] = 20;
+    for (i = 1; i <= 20; ++i) a[i] = i;
+    a[5] = INFINITY;
+    lok(te_eval(sum) == INFINITY);
+    a[17] = -INFINITY;
+    lok(isnan(te_eval(sum)));
+
+#ifdef TE_ACCURATE_SUM
+    /* Each 1 is lost when added in order. */
+    a[0] = 3000;
+    for (i = 1; i <= 3000; i += 3) {
+        a[i] = 1e16;
+        a[i + 1] = 1;
+        a[i + 2] = -1e16;
+    }
+    lok(te_eval(sum) == 1000);
+#endif
+
+    te_program_free(pmn);
+    te_free(sum);
+    te_free(mn);
+    te_free(mx);
+}
+
+static int same_bits(double a, double b) {
+    /* Exact, and NaN matches NaN. */
+    return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+
+void test_reductions() {
+    enum {len = 1001};
+    static double a[len + 1], b[len + 1], c[len + 1], empty[1];
+    double x = 2;
+    int i;
+
+    te_variable lookup[] = {{"a", a}, {"b", b}, {"c", c}, {"empty", empty}, {"x", &x}};
+
+    a[0] = b[0] = len;
+    c[0] = 3;
+    for (i = 1; i <= len; ++i) {
+        a[i] = 5 + sin(i * 0.37) * i;
+        b[i] = cos(i * 1.3);
+    }
+    c[1] = 4; c[2] = 1; c[3] = 1;
+
+    double total = 0, sq = 0, dev = 0, prod = 0;
+    int lo = 0, hi = 0;
+    for (i = 0; i < len; ++i) {
+        total += a[i + 1];
+        prod += a[i + 1] * b[i + 1];
+        if (a[i + 1] < a[lo + 1]) lo = i;
+        if (a[i + 1] > a[hi + 1]) hi = i;
+    }
+    for (i = 0; i < len; ++i) {
+        const double d = a[i + 1] - total / len;
+        dev += d;
+        sq += d * d;
+    }
+
+    test_case cases[] = {
+        {"mean(a)", total / len},
+        {"variance(a)", (sq - dev * dev / len) / len},
+        {"argmin(a)", lo},
+        {"argmax(a)", hi},
+        {"dot(a, b)", prod},
+        {"argmin(c)", 1},
+        {"argmax(c)", 0},
+        {"variance(c)", 2},
+        {"dot(c, c)", 18},
+        {"dot(empty, empty)", 0},
+        {"mean(c) + x", 4},
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i].expr, lookup, 5, 0);
+        lok(ex);
+        te_program *p = te_lower(ex);
+        double out[3];
+        te_eval_batch(ex, 0, 0, 3, out);
+        lfequal(te_eval(ex), cases[i].answer);
+        lfequal(te_program_eval(p), cases[i].answer);
+        lfequal(out[2], cases[i].answer);
+        te_program_free(p);
+        te_free(ex);
+    }
+
+    const char *nans[] = {"mean(empty)", "variance(empty)", "argmin(empty)", "dot(a, c)"};
+    for (i = 0; i < sizeof(nans) / sizeof(nans[0]); ++i) {
+        te_expr *ex = te_compile(nans[i], lookup, 5, 0);
+        lok(ex && isnan(te_eval(ex)));
+        te_free(ex);
+    }
+
+    /* Arrays must be bare variables, which the parser checks. */
+    struct {const char *expr; int pos;} shapes[] = {
+        {"mean(x+1)", 9}, {"dot(a, b+1)", 11}, {"sum(a[1])", 9}, {"1 + arrmax -a", 13},
+        {"linear_interpolate(a, b*2, x)", 29}, {"argmax(3) + a", 11},
+    };
+    for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+        int err;
+        te_expr *ex = te_compile(shapes[i].expr, lookup, 5, &err);
+        lok(!ex);
+        lequal(err, shapes[i].pos);
+    }
+
+    /* Several reductions of one array share a pass, but give the same bits. */
+    const char *fused[] = {
+        "arrmax(a) - arrmin(a)",
+        "sum(a) / variance(a) + mean(a)",
+        "argmin(a) + argmax(a) * arrmin(a) + x",
+        "sum(a) * sum(a) + arrmax(a)",
+        "arrmin(a) + arrmin(b) + arrmax(a) + arrmax(b) + variance(b)",
+    };
+    const char *parts[][5] = {
+        {"arrmax(a)", "arrmin(a)"},
+        {"sum(a)", "variance(a)", "mean(a)"},
+        {"argmin(a)", "argmax(a)", "arrmin(a)"},
+        {"sum(a)", "arrmax(a)"},
+        {"arrmin(a)", "arrmin(b)", "arrmax(a)", "arrmax(b)", "variance(b)"},
+    };
+    int j, k;
+    for (i = 0; i < sizeof(fused) / sizeof(fused[0]); ++i) {
+        te_expr *ex = te_compile(fused[i], lookup, 5, 0);
+        lok(ex);
+        te_program *p = te_lower(ex);
+        te_expr *copy = te_pack(ex, malloc(te_size(ex)), te_size(ex));
+
+        for (k = 0; k < 2; ++k) {
+            /* The sums are rebuilt from the parts in the same order. */
+            double v[5];
+            for (j = 0; j < 5 && parts[i][j]; ++j) {
+                te_expr *part = te_compile(parts[i][j], lookup, 5, 0);
+                v[j] = te_eval(part);
+                te_free(part);
+            }
+            const double expected =
+                i == 0 ? v[0] - v[1] :
+                i == 1 ? v[0] / v[1] + v[2] :
+                i == 2 ? v[0] + v[1] * v[2] + x :
+                i == 3 ? v[0] * v[0] + v[1] :
+                v[0] + v[1] + v[2] + v[3] + v[4];
+
+            double out[300];
+            te_eval_batch(ex, 0, 0, 300, out);
+            lok(same_bits(te_eval(ex), expected));
+            lok(same_bits(te_program_eval(p), expected));
+            lok(same_bits(te_eval(copy), expected));
+            lok(same_bits(out[0], expected) && same_bits(out[299], expected));
+
+            /* Each evaluation makes a new pass. */
+            a[17] = -1000 * (k + 1);
+            b[3] = 1000;
+        }
+
+        te_program_free(p);
+        te_free(copy);
+        te_free(ex);
+    }
+}
+
+void test_views() {
+    enum {len = 203};
+    static double a[len + 1], d[len + 1], rows[len][3];
+    double x = 17.25;
+    int i, j;
+
+    /* Column 1 of rows holds a's elements and column 2 d's, read in place. */
+    te_view v = {&rows[0][1], len, 3, 0}, w = {a + 1, len, 1, 0}, dv = {&rows[0][2], len, 3, 0};
+    te_variable lookup[] = {
+        {"a", a}, {"d", d, TE_VARIABLE | TE_FLAG_IMMUTABLE}, {"x", &x},
+        {"v", &v, TE_VIEW}, {"w", &w, TE_VIEW}, {"dv", &dv, TE_VIEW | TE_FLAG_IMMUTABLE},
+    };
+
+    a[0] = d[0] = len;
+    for (i = 0; i < len; ++i) {
+        a[i + 1] = rows[i][1] = 5 + sin(i * 0.37) * i;
+        d[i + 1] = rows[i][2] = i * 0.5;
+        rows[i][0] = NAN;
+    }
+
+    /* A view gives the same bits as the prefixed array it describes. */
+    const char *cases[][3] = {
+        {"sum(a)", "sum(v)", "sum(w)"},
+        {"mean(a) + variance(a)", "mean(v) + variance(v)", "mean(w) + variance(w)"},
+        {"arrmin(a) * arrlen(a)", "arrmin(v) * arrlen(v)", "arrmin(w) * arrlen(w)"},
+        {"argmax(a) - arrmax(a)", "argmax(v) - arrmax(v)", "argmax(w) - arrmax(w)"},
+        {"argmin(a)", "argmin(v)", "argmin(w)"},
+        {"dot(a, d)", "dot(v, dv)", "dot(w, d)"},
+        {"a[x] + a[0] - a[202] + a[203]", "v[x] + v[0] - v[202] + v[203]", "w[x] + w[0] - w[202] + w[203]"},
+        {"linear_interpolate(d, a, x)", "linear_interpolate(dv, v, x)", "linear_interpolate(d, w, x)"},
+        {"arrmax(a) - arrmin(a) + sum(a)", "arrmax(v) - arrmin(v) + sum(v)", "arrmax(w) - arrmin(w) + sum(w)"},
+    };
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *base = te_compile(cases[i][0], lookup, 6, 0);
+        const double expected = te_eval(base);
+        for (j = 1; j < 3; ++j) {
+            te_expr *ex = te_compile(cases[i][j], lookup, 6, 0);
+            lok(ex);
+            te_program *p = te_lower(ex);
+            te_incremental *inc = te_incremental_new(ex);
+            double out[3];
+            te_eval_batch(ex, 0, 0, 3, out);
+            lok(same_bits(te_eval(ex), expected));
+            lok(same_bits(te_program_eval(p), expected));
+            lok(same_bits(te_incremental_eval(inc), expected));
+            lok(same_bits(out[2], expected));
+
+            char blob[4096];
+            int err;
+            te_expr *loaded = te_load(blob, te_save(ex, lookup, 6, blob, sizeof(blob)), lookup, 6, &err);
+            lok(loaded && same_bits(te_eval(loaded), expected));
+
+            te_free(loaded);
+            te_incremental_free(inc);
+            te_program_free(p);
+            te_free(ex);
+        }
+        te_free(base);
+    }
+
+    /* The view is read at every evaluation. */
+    int count = 2;
+    te_view live = {a + 1, 0, 2, &count};
+    te_variable more[] = {{"live", &live, TE_VIEW}, {"v", &v, TE_VIEW}};
+    te_expr *ex = te_compile("sum(live) + live[1]", more, 2, 0);
+    te_incremental *inc = te_incremental_new(ex);
+    lok(ex);
+    lfequal(te_eval(ex), a[1] + a[3] + a[3]);
+    count = 3;
+    lfequal(te_eval(ex), a[1] + a[3] + a[5] + a[3]);
+    te_incremental_touch(inc, &live);
+    lfequal(te_incremental_eval(inc), a[1] + a[3] + a[5] + a[3]);
+    live.data = a + 2;
+    live.stride = 1;
+    lfequal(te_eval(ex), a[2] + a[3] + a[4] + a[3]);
+    count = 0;
+    lok(isnan(te_eval(ex)));
+    te_incremental_free(inc);
+    te_free(ex);
+
+    /* A view only has elements. */
+    const char *nans[] = {"v", "v + 1", "mean(live)", "v[-1]", "arrmin(live)"};
+    for (i = 0; i < sizeof(nans) / sizeof(nans[0]); ++i) {
+        ex = te_compile(nans[i], more, 2, 0);
+        lok(ex && isnan(te_eval(ex)));
+        te_free(ex);
+    }
+    int err;
+    ex = te_compile("sum(v + 1)", more, 2, &err);
+    lok(!ex);
+    lequal(err, 10);
+}
+
+/* A scaled sum, whose context counts the rows and blocks that reach each form. */
+typedef struct scaled {double k; int rows, blocks;} scaled;
+
+double scaled_sum(void *context, double a, double b) {
+    scaled *s = context;
+    ++s->rows;
+    return s->k * a + b;
+}
+
+void scaled_sums(void *context, const double **args, double *out, size_t n) {
+    scaled *s = context;
+    size_t i;
+    ++s->blocks;
+    for (i = 0; i < n; ++i) out[i] = s->k * args[0][i] + args[1][i];
+}
+
+static int square_blocks;
+
+double square(double a) {return a * a;}
+
+void squares(void *context, const double **args, double *out, size_t n) {
+    size_t i;
+    ++square_blocks;
+    for (i = 0; i < n; ++i) out[i] = args[0][i] * args[0][i];
+}
+
+void test_vector() {
+    enum {rows = 300};
+    double x, y, xs[rows], out[rows];
+    scaled k = {3};
+    te_variable lookup[] = {
+        {"x", &x}, {"y", &y},
+        {"ks", scaled_sum, TE_CLOSURE2 | TE_FLAG_VECTOR, &k, scaled_sums},
+        {"sq", square, TE_FUNCTION1 | TE_FLAG_PURE | TE_FLAG_VECTOR, 0, squares},
+        {"plain", scaled_sum, TE_CLOSURE2, &k, scaled_sums},
+    };
+    te_column columns[] = {{&x, xs, 1}};
+    int i, r;
+    for (r = 0; r < rows; ++r) xs[r] = r * 0.5 - 20;
+    y = 2;
+
+    const char *cases[] = {"ks(x, y)", "sq(x) + 1", "ks(sq(x), x) - sq(y)", "plain(x, y)"};
+    const int blocks[][2] = {{3, 0}, {0, 3}, {3, 6}, {0, 0}};
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i], lookup, 5, 0);
+        lok(ex);
+
+        /* te_eval keeps calling the scalar form. */
+        k.rows = k.blocks = square_blocks = 0;
+        x = 1.5;
+        te_eval(ex);
+        lequal(k.blocks + square_blocks, 0);
+
+        /* Batches call the vector form once per block of rows. */
+        k.rows = 0;
+        te_eval_batch(ex, columns, 1, rows, out);
+        lequal(k.blocks, blocks[i][0]);
+        lequal(square_blocks, blocks[i][1]);
+        lequal(k.rows, i == 3 ? rows : 0);
+
+        int failed = 0;
+        for (r = 0; r < rows; ++r) {
+            x = xs[r];
+            if (te_eval(ex) != out[r]) ++failed;
+        }
+        lequal(failed, 0);
+
+        /* The vector form survives a copy and a save. */
+        char blob[512];
+        te_expr *copy = te_pack(ex, malloc(te_size(ex)), te_size(ex));
+        te_expr *loaded = te_load(blob, te_save(ex, lookup, 5, blob, sizeof(blob)), lookup, 5, 0);
+        lok(copy && loaded);
+        k.blocks = square_blocks = 0;
+        te_eval_batch(copy, columns, 1, rows, out);
+        te_eval_batch(loaded, columns, 1, rows, out);
+        lequal(k.blocks, 2 * blocks[i][0]);
+        lequal(square_blocks, 2 * blocks[i][1]);
+        te_free(loaded);
+        te_free(copy);
+        te_free(ex);
+    }
+
+    /* A blob naming a vector form needs a table that gives one. */
+    char blob[512];
+    te_expr *ex = te_compile("ks(x, y)", lookup, 5, 0);
+    const int size = te_save(ex, lookup, 5, blob, sizeof(blob));
+    lookup[2].type = TE_CLOSURE2;
+    lok(!te_load(blob, size, lookup, 5, 0));
+    te_free(ex);
+}
+
+void test_bitwise() {
+    /* Trees of bitwise operators work on integers, with the same NaNs as one operator at a time. */
+    double x, y, xs[8], ys[8], out[8];
+    te_variable lookup[] = {{"x", &x}, {"y", &y}};
+    te_column columns[] = {{&x, xs, 1}, {&y, ys, 1}};
+    const double values[] = {0, 1, 2.5, 6.4, 12, -0.4, -3, 52.6, 9007199254740991.0, 9007199254740992.0, NAN, INFINITY};
+    const int count = sizeof(values) / sizeof(values[0]);
+    const char *cases[][2] = {
+        {"(x & y) | 3", "((x & y) + 0) | 3"},
+        {"xor(x | 1, y & 7) & 5.6", "xor((x | 1) + 0, (y & 7) + 0) & 5.6"},
+        {"bit(x & y, 1) | bit(x, y & 3)", "(bit((x & y) + 0, 1) + 0) | (bit(x, (y & 3) + 0) + 0)"},
+        {"(x & 12) | (y | 3) + 1", "((x & 12) + 0) | (y | 3) + 1"},
+        {"sqrt((x | y) & (x | 1))", "sqrt(((x | y) + 0) & ((x | 1) + 0))"},
+    };
+    int i, j, k;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i][0], lookup, 2, 0);
+        te_expr *one = te_compile(cases[i][1], lookup, 2, 0);
+        te_program *p = te_lower(ex);
+        te_incremental *inc = te_incremental_new(ex);
+        char blob[1024];
+        te_expr *loaded = te_load(blob, te_save(ex, lookup, 2, blob, sizeof(blob)), lookup, 2, 0);
+        lok(ex && one && p && inc && loaded);
+
+        int failed = 0;
+        for (j = 0; j < count; ++j) {
+            for (k = 0; k < count; ++k) {
+                x = xs[k % 8] = values[j];
+                y = ys[k % 8] = values[k];
+                te_incremental_touch(inc, &x);
+                te_incremental_touch(inc, &y);
+                const double expected = te_eval(one);
+                failed += !same_bits(te_eval(ex), expected) || !same_bits(te_program_eval(p), expected) ||
+                    !same_bits(te_incremental_eval(inc), expected) || !same_bits(te_eval(loaded), expected);
+                if (k % 8 == 7 || k == count - 1) {
+                    const int rows = k % 8 + 1, first = k - k % 8;
+                    int r;
+                    te_eval_batch(ex, columns, 2, rows, out);
+                    for (r = 0; r < rows; ++r) {
+                        y = values[first + r];
+                        failed += !same_bits(out[r], te_eval(one));
+                    }
+                }
+            }
+        }
+        lequal(failed, 0);
+
+        te_free(loaded);
+        te_incremental_free(inc);
+        te_program_free(p);
+        te_free(one);
+        te_free(ex);
+    }
+
+    /* bit gives NaN, not undefined behavior, for operands out of range. */
+    lok(isnan(te_interp("bit(1/0, 1)", 0)));
+    lok(isnan(te_interp("bit(0/0, 1)", 0)));
+    lok(isnan(te_interp("bit(1, 0/0)", 0)));
+    lok(isnan(te_interp("bit(5 & 7, 53)", 0)));
+    lfequal(te_interp("bit(5 & 7, 2) | 2", 0), 3);
+}
+
+static double conditional_reference(int i, double x, double y) {
+    switch (i) {
+        case 0: return x < y;
+        case 1: return x <= y;
+        case 2: return x > y;
+        case 3: return x >= y;
+        case 4: return x == y;
+        case 5: return x != y;
+        case 6: return x < 1 && y > 1;
+        case 7: return x > 2 || y;
+        case 8: return x < y ? x * 2 : y - 1;
+        case 9: return (x ? y : 3) + 1;
+        case 10: return (x + 1 < y * 2) != 0;
+        default: return (-x < y && x < y) || x == 2;
+    }
+}
+
+
+void test_conditionals() {
+    /* Comparisons give 1 or 0, and NaN compares false to everything, itself included. */
+    double x, y, xs[8], ys[8], out[8];
+    int calls = 0;
+    te_variable lookup[] = {{"x", &x}, {"y", &y}, {"h", counted, TE_CLOSURE1, &calls}};
+    te_column columns[] = {{&x, xs, 1}, {&y, ys, 1}};
+    const double values[] = {-3, -0.5, 0, 1, 2, 2.5, NAN};
+    const int count = sizeof(values) / sizeof(values[0]);
+    const char *cases[] = {
+        "x < y", "x <= y", "x > y", "x >= y", "x == y", "x != y",
+        "x < 1 && y > 1", "x > 2 || y", "if(x < y, x * 2, y - 1)", "if(x, y, 3) + 1",
+        "x + 1 < y * 2 != 0", "-x < y && x < y || x == 2",
+    };
+    int i, j, k, r;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i], lookup, 3, 0);
+        te_program *p = te_lower(ex);
+        te_incremental *inc = te_incremental_new(ex);
+        char blob[1024];
+        te_expr *loaded = te_load(blob, te_save(ex, lookup, 3, blob, sizeof(blob)), lookup, 3, 0);
+        lok(ex && p && inc && loaded);
+
+        int failed = 0, run;
+        for (run = 0; run < 4; ++run) { /* Runs the program often enough for TE_JIT. */
+            for (j = 0; j < count; ++j) {
+                for (k = 0; k < count; ++k) {
+                    x = xs[k] = values[j];
+                    y = ys[k] = values[k];
+                    te_incremental_touch(inc, &x);
+                    te_incremental_touch(inc, &y);
+                    const double expected = conditional_reference(i, x, y);
+                    failed += !same_bits(te_eval(ex), expected) || !same_bits(te_program_eval(p), expected) ||
+                        !same_bits(te_incremental_eval(inc), expected) || !same_bits(te_eval(loaded), expected);
+                }
+                te_eval_batch(ex, columns, 2, count, out);
+                for (r = 0; r < count; ++r) failed += !same_bits(out[r], conditional_reference(i, xs[r], ys[r]));
+            }
+        }
+        lequal(failed, 0);
+
+        te_free(loaded);
+        te_incremental_free(inc);
+        te_program_free(p);
+        te_free(ex);
+    }
+
+    lfequal(te_interp("0/0 == 0/0", 0), 0);
+    lfequal(te_interp("0/0 != 0/0", 0), 1);
+    lfequal(te_interp("if(0/0, 1, 2)", 0), 1);
+    lfequal(te_interp("1 < 2 == 2 > 1", 0), 1);
+    lfequal(te_interp("2 && 0/0", 0), 1);
+    lfequal(te_interp("(1, 0) || 0", 0), 0);
+    lfequal(te_interp("1 + 2 < 4", 0), 1);
+
+    int err;
+    lok(!te_compile("x = 1", lookup, 3, &err) && err == 3);
+    lok(!te_compile("!x", lookup, 3, &err) && err == 1);
+    lok(!te_compile("x <", lookup, 3, &err) && err == 3);
+    lok(!te_compile("x && ", lookup, 3, &err) && err == 5);
+    lok(!te_compile("if(x, 1)", lookup, 3, &err) && err == 8);
+
+    /* Only the branch taken runs, in every tier but the batch. */
+    const char *lazy[] = {"if(x > 0, x, h(x))", "x > 0 || h(x)", "x < 0 && h(x)"};
+    for (i = 0; i < sizeof(lazy) / sizeof(lazy[0]); ++i) {
+        te_expr *ex = te_compile(lazy[i], lookup, 3, 0);
+        te_program *p = te_lower(ex);
+        te_incremental *inc = te_incremental_new(ex);
+        lok(ex && p && inc);
+
+        x = 1;
+        calls = 0;
+        for (j = 0; j < 200; ++j) {
+            te_eval(ex);
+            te_program_eval(p);
+            te_incremental_eval(inc);
+        }
+        for (k = 0; k < 8; ++k) xs[k] = k + 1;
+        te_eval_batch(ex, columns, 2, 8, out);
+        lequal(calls, 0);
+
+        x = -1;
+        te_incremental_touch(inc, &x);
+        te_eval(ex);
+        te_program_eval(p);
+        te_incremental_eval(inc);
+        lequal(calls, 3);
+
+        /* A block whose rows disagree runs both branches, then selects. */
+        xs[3] = -1;
+        te_eval_batch(ex, columns, 2, 8, out);
+        lequal(calls, 3 + 8);
+        lfequal(out[0], i < 2 ? 1 : 0);
+        lfequal(out[3], i == 0 ? -3 : 1);
+
+        te_incremental_free(inc);
+        te_program_free(p);
+        te_free(ex);
+    }
+
+    /* A known condition leaves only its branch. */
+    te_expr *ex = te_compile("if(1 < 2, x, h(x))", lookup, 3, 0);
+    te_expr *plain = te_compile("x", lookup, 3, 0);
+    lequal(te_size(ex), te_size(plain));
+    te_free(plain);
+    te_free(ex);
+    ex = te_compile("0 && h(x)", lookup, 3, 0);
+    calls = 0;
+    lfequal(te_eval(ex), 0);
+    lequal(calls, 0);
+    te_free(ex);
+
+    /* te_eval_batchf compares in single precision. */
+    float fx[4] = {0.1f, 1, 2, 3}, fout[4];
+    te_columnf fcolumns[] = {{&x, fx, 1}};
+    ex = te_compile("if(x < 1.5, x * 2, x == 2 || x - 1)", lookup, 3, 0);
+    te_eval_batchf(ex, fcolumns, 1, 4, fout);
+    lok(fout[0] == 0.1f * 2 && fout[1] == 2 && fout[2] == 1 && fout[3] == 1);
+    te_free(ex);
+}
+
+
+static double opaque(double a) {return a;}
+
+void test_ranges() {
+    /* Each case gives the same bits as its reference, whose opaque() hides what it proves. */
+    static double c[6] = {5, 10, 20, 30, 40, 50}, m[6] = {5, 10, 20, 30, 40, 50};
+    static double d[4] = {3, 0, 50, 100}, r[4] = {3, 0, 1, 4};
+    double x, y, xs[8], ys[8], out[8], expected[8];
+    te_variable lookup[] = {
+        {"x", &x}, {"y", &y}, {"m", m}, {"o", opaque, TE_FUNCTION1},
+        {"c", c, TE_VARIABLE | TE_FLAG_IMMUTABLE}, {"d", d, TE_VARIABLE | TE_FLAG_IMMUTABLE},
+        {"r", r, TE_VARIABLE | TE_FLAG_IMMUTABLE},
+    };
+    te_column columns[] = {{&x, xs, 1}, {&y, ys, 1}};
+    const double values[] = {-3, -0.5, 0, 1, 2.5, 7, 60, 4503599627370496.0, NAN};
+    const int count = sizeof(values) / sizeof(values[0]);
+    const char *cases[][2] = {
+        {"c[3] + c[x > 50]", "c[o(3)] + c[o(x > 50)]"},
+        {"c[if(x < y, 1, 4)] * c[(x == 1) + (y == 1)]", "c[o(if(x < y, 1, 4))] * c[o((x == 1) + (y == 1))]"},
+        {"c[c[0] - 1] + c[(x > 1) * 2 + 1 % 3]", "c[o(c[0] - 1)] + c[o((x > 1) * 2 + 1 % 3)]"},
+        {"c[arrlen(c) - 1] + c[floor(sum(c) / 100)]", "c[o(arrlen(c) - 1)] + c[o(floor(sum(c) / 100))]"},
+        {"c[5] + c[-1] + c[x] + m[1] + m[x > 1]", "c[o(5)] + c[o(-1)] + c[o(x)] + m[o(1)] + m[o(x > 1)]"},
+        {"linear_interpolate(d, r, if(x < 50, 25, 75))", "linear_interpolate(d, r, o(if(x < 50, 25, 75)))"},
+        {"linear_interpolate(d, r, x > 1) + linear_interpolate(d, r, 101 + (x > 1))",
+            "linear_interpolate(d, r, o(x > 1)) + linear_interpolate(d, r, o(101 + (x > 1)))"},
+        {"bit(x, 3) | bit(y, 7) + bit(x, 53 - (y > 1))", "bit(x, o(3)) | bit(y, o(7)) + bit(x, o(53 - (y > 1)))"},
+        {"(x > 10) & (y < 100) | (x > 90)", "o(o(x > 10) & o(y < 100)) | o(x > 90)"},
+        {"xor(x, 255) + (x & c[2]) + (1 | y)", "xor(x, o(255)) + (x & o(c[2])) + (o(1) | y)"},
+        {"xor(x, y) & bit(x, 3) | (x & 6) | 9.5 + bit(x, -1)", "xor(x, y) & bit(x, o(3)) | (x & o(6)) | o(9.5) + bit(x, o(-1))"},
+    };
+    int i, j, k, run;
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i][0], lookup, 7, 0);
+        te_expr *ref = te_compile(cases[i][1], lookup, 7, 0);
+        te_program *p = te_lower(ex);
+        te_incremental *inc = te_incremental_new(ex);
+        char blob[2048];
+        te_expr *loaded = te_load(blob, te_save(ex, lookup, 7, blob, sizeof(blob)), lookup, 7, 0);
+        lok(ex && ref && p && inc && loaded);
+
+        int failed = 0;
+        for (run = 0; run < 4; ++run) { /* Runs the program often enough for TE_JIT. */
+            for (j = 0; j < count; ++j) {
+                for (k = 0; k < count; ++k) {
+                    x = xs[k % 8] = values[j];
+                    y = ys[k % 8] = values[k];
+                    te_incremental_touch(inc, &x);
+                    te_incremental_touch(inc, &y);
+                    expected[k % 8] = te_eval(ref);
+                    failed += !same_bits(te_eval(ex), expected[k % 8]) ||
+                        !same_bits(te_program_eval(p), expected[k % 8]) ||
+                        !same_bits(te_incremental_eval(inc), expected[k % 8]) ||
+                        !same_bits(te_eval(loaded), expected[k % 8]);
+                }
+                te_eval_batch(ex, columns, 2, 8, out);
+                for (k = 0; k < 8; ++k) failed += !same_bits(out[k], expected[k]);
+            }
+        }
+        lequal(failed, 0);
+
+        te_free(loaded);
+        te_incremental_free(inc);
+        te_program_free(p);
+        te_free(ref);
+        te_free(ex);
+    }
+
+    /* What isn't proven still gives NaN. */
+    x = 60;
+    y = NAN;
+    const char *invalid[] = {"c[5]", "c[x]", "m[x]", "y & 255", "255 | y", "bit(7, 53)", "bit(y, 1)",
+        "linear_interpolate(d, r, 101 + (x > 1))", "linear_interpolate(d, r, y)", "c[-1 + (y > 1)]"};
+    for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        te_expr *ex = te_compile(invalid[i], lookup, 7, 0);
+        te_program *p = te_lower(ex);
+        lok(ex && p && isnan(te_eval(ex)) && isnan(te_program_eval(p)));
+        te_program_free(p);
+        te_free(ex);
+    }
+}
+
+
+void test_cache() {
+    double x = 2, y = 3;
+    te_variable lookup[] = {{"x", &x}, {"y", &y}};
+    int err;
+
+    lok(!te_cache_new(0));
+    te_cache *cache = te_cache_new(2);
+    lok(cache);
+
+    const te_expr *a = te_cache_get(cache, "x+y", lookup, 2, &err);
+    lok(a && !err);
+    lfequal(te_eval(a), 5);
+    lequal((int)te_cache_misses(cache), 1);
+
+    /* Same text and table: the same tree, without parsing. */
+    x = 10;
+    lok(te_cache_get(cache, "x+y", lookup, 2, &err) == a);
+    lfequal(te_eval(a), 13);
+    lequal((int)te_cache_hits(cache), 1);
+
+    /* A different table, or a prefix of it, is a different binding. */
+    te_variable other[] = {{"x", &y}, {"y", &x}};
+    const te_expr *b = te_cache_get(cache, "x+y", other, 2, &err);
+    lok(b && b != a);
+    lok(!te_cache_get(cache, "x+y", lookup, 1, &err));
+    lequal(err, 3);
+    lequal((int)te_cache_misses(cache), 3);
+
+    /* "x+y" on lookup is now the oldest, so it goes first. */
+    lok(te_cache_get(cache, "x*y", lookup, 2, &err));
+    lok(te_cache_get(cache, "x+y", other, 2, &err) == b);
+    lequal((int)te_cache_hits(cache), 2);
+    a = te_cache_get(cache, "x+y", lookup, 2, &err);
+    lok(a);
+    lequal((int)te_cache_misses(cache), 5);
+    lfequal(te_eval(a), 13);
+
+    /* Using an entry keeps it. */
+    char text[32];
+    int i;
+    for (i = 0; i < 100; ++i) {
+        sprintf(text, "x+%d", i);
+        lok(te_cache_get(cache, "x+y", lookup, 2, &err) == a);
+        lfequal(te_eval(te_cache_get(cache, text, lookup, 2, &err)), 10 + i);
+    }
+    lequal((int)te_cache_hits(cache), 102);
+
+    te_cache_free(cache);
+    te_cache_free(0);
+}
+
+void test_serialize() {
+    static double arr[4] = {3, 1, 5, 2}, dom[4] = {3, 0, 1, 2}, ran[4] = {3, 10, 20, 40};
+    double x = 1.5, y = 4, w = 10;
+    struct record {double x, y;} layout = {0, 0}, row = {2, 7};
+
+    te_variable lookup[] = {
+        {"x", &x}, {"y", &y}, {"arr", arr},
+        {"dom", dom, TE_VARIABLE | TE_FLAG_IMMUTABLE}, {"ran", ran, TE_VARIABLE | TE_FLAG_IMMUTABLE},
+        {"sum2", sum2, TE_FUNCTION2}, {"clo1", clo1, TE_CLOSURE1, &w},
+        {"fx", &layout.x}, {"fy", &layout.y},
+    };
+
+    /* Same names, other addresses. */
+    static double arr2[4] = {3, 2, 6, 3};
+    double x2 = 0.5, y2 = -4, w2 = 100;
+    te_variable other[] = {
+        {"clo1", clo1, TE_CLOSURE1, &w2}, {"sum2", sum2, TE_FUNCTION2},
+        {"ran", ran, TE_VARIABLE | TE_FLAG_IMMUTABLE}, {"dom", dom, TE_VARIABLE | TE_FLAG_IMMUTABLE},
+        {"arr", arr2}, {"y", &y2}, {"x", &x2},
+    };
+
+    const char *cases[] = {
+        "x+y*2", "-x^2 % 3", "(x & 3) | 4", "sqrt(x+1) * (x+1)^2",
+        "sum(arr) + mean(arr) * arrmax(arr)", "linear_interpolate(dom, ran, x)",
+        "sum2(x, clo1(y))", "pi*e + (1, y)",
+    };
+
+    int i, err;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i], lookup, 7, 0);
+        lok(ex);
+        const int size = te_save(ex, lookup, 7, 0, 0);
+        lok(size > 0);
+
+        /* The blob need not be aligned. */
+        char *buffer = malloc(size + 1);
+        lequal(te_save(ex, lookup, 7, buffer + 1, size - 1), size);
+        lequal(te_save(ex, lookup, 7, buffer + 1, size), size);
+
+        te_expr *loaded = te_load(buffer + 1, size, lookup, 7, &err);
+        lok(loaded);
+        lequal(err, 0);
+        if (loaded) lok(same_bits(te_eval(loaded), te_eval(ex)));
+
+        te_expr *rebound = te_load(buffer + 1, size, other, 7, &err);
+        te_expr *direct = te_compile(cases[i], other, 7, 0);
+        lok(rebound && direct);
+        if (rebound && direct) lok(same_bits(te_eval(rebound), te_eval(direct)));
+
+        /* Every truncation is caught. */
+        int len;
+        for (len = 0; len < size; ++len) {
+            lok(!te_load(buffer + 1, len, lookup, 7, &err));
+            lequal(err, -1);
+        }
+
+        /* Damage may give another valid expression, but never a bad one. */
+        int j;
+        for (j = 1; j <= size; ++j) {
+            buffer[j] ^= 0x5A;
+            te_free(te_load(buffer + 1, size, lookup, 7, &err));
+            buffer[j] ^= 0x5A;
+        }
+
+        te_free(direct);
+        te_free(rebound);
+        te_free(loaded);
+        free(buffer);
+        te_free(ex);
+    }
+
+    /* Frame slots are kept as offsets. */
+    te_expr *ex = te_compile_frame("fx*fy + x", lookup, 9, &layout, sizeof(layout), 0);
+    char blob[256];
+    const int size = te_save(ex, lookup, 9, blob, sizeof(blob));
+    lok(size > 0 && size <= sizeof(blob));
+    te_expr *loaded = te_load(blob, size, other, 7, &err);
+    lok(loaded);
+    if (loaded) lfequal(te_eval_frame(loaded, &row), 14.5);
+    te_free(loaded);
+
+    /* Addresses and names the tables lack. */
+    lok(!te_load(blob, size, other, 6, &err));
+    lequal(err, 1);
+    te_free(ex);
+    ex = te_compile("fx + 1", lookup, 9, 0);
+    lequal(te_save(ex, lookup, 7, blob, sizeof(blob)), -1);
+    te_free(ex);
+
+    lok(!te_load(0, 0, lookup, 7, &err));
+    lequal(err, -1);
+
+    /* An array builtin called as a plain function is refused. */
+    ex = te_compile("sum(arr)", lookup, 7, 0);
+    const int summed = te_save(ex, lookup, 7, blob, sizeof(blob));
+    unsigned type;
+    memcpy(&type, blob + summed - 8 - 2 * sizeof(unsigned), sizeof(type));
+    lok(type == (257 | TE_FLAG_PURE));
+    type = TE_FUNCTION1 | TE_FLAG_PURE;
+    memcpy(blob + summed - 8 - 2 * sizeof(unsigned), &type, sizeof(type));
+    lok(!te_load(blob, summed, lookup, 7, &err));
+    lequal(err, -1);
+    te_free(ex);
+
+    /* A chain of more temps than evaluation keeps is refused, though each is defined. */
+    /* Nodes are the type then its data: 7 is a TE_LET, 3 a TE_TEMP and 1 a constant. */
+    ex = te_compile("1", lookup, 7, 0);
+    const int header = te_save(ex, lookup, 7, blob, sizeof(blob)) - sizeof(unsigned) - sizeof(double);
+    te_free(ex);
+    static char chain[64 + 200 * 20];
+    const int lets[] = {1, 64, 65, 200};
+    for (i = 0; i < sizeof(lets) / sizeof(lets[0]); ++i) {
+        const unsigned let = 7, temp = 3, constant = 1;
+        const double five = 5;
+        unsigned total = header + lets[i] * 20 + 8;
+        int k, at = header;
+        memcpy(chain, blob, header);
+        memcpy(chain + 2 * sizeof(unsigned), &total, sizeof(total));
+        for (k = 0; k < lets[i]; ++k) {
+            memcpy(chain + at, &let, 4);
+            memcpy(chain + at + 4, &k, 4);
+            memcpy(chain + at + 8, &constant, 4);
+            memcpy(chain + at + 12, &five, 8);
+            at += 20;
+        }
+        k = lets[i] - 1;
+        memcpy(chain + at, &temp, 4);
+        memcpy(chain + at + 4, &k, 4);
+        lequal(at + 8, total);
+
+        loaded = te_load(chain, total, lookup, 7, &err);
+        if (lets[i] <= 64) {
+            lok(loaded && te_eval(loaded) == 5);
+        } else {
+            lok(!loaded);
+            lequal(err, -1);
+        }
+        te_free(loaded);
+    }
+
+    /* Frame variables must lie within the frame the blob records, and te_load_frame's. */
+    ex = te_compile_frame("fy", lookup, 9, &layout, sizeof(layout), 0);
+    const int slot = te_save(ex, lookup, 9, blob, sizeof(blob));
+    te_free(ex);
+    loaded = te_load_frame(blob, slot, lookup, 9, sizeof(layout), &err);
+    lok(loaded && err == 0);
+    if (loaded) lfequal(te_eval_frame(loaded, &row), 7);
+    te_free(loaded);
+    lok(!te_load_frame(blob, slot, lookup, 9, sizeof(double), &err));
+    lequal(err, -1);
+    const int offsets[] = {0, 8, 9, -8, 1 << 20};
+    for (i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i) {
+        memcpy(blob + slot - sizeof(int), &offsets[i], sizeof(int));
+        loaded = te_load(blob, slot, lookup, 9, &err);
+        lok(offsets[i] <= 8 && offsets[i] >= 0 ? loaded != 0 : !loaded);
+        te_free(loaded);
+    }
+
+    /* So must the depth of the nodes: 293 is a TE_BITWISE, which has one argument. */
+    const int depths[] = {4000, 4095, 4096, 5000};
+    static char deep[64 + 5000 * 4 + 12];
+    for (i = 0; i < sizeof(depths) / sizeof(depths[0]); ++i) {
+        const unsigned bitwise = 293, constant = 1;
+        const double five = 5;
+        const unsigned total = header + depths[i] * 4 + 12;
+        int k;
+        memcpy(deep, chain, header);
+        memcpy(deep + 2 * sizeof(unsigned), &total, sizeof(total));
+        for (k = 0; k < depths[i]; ++k) memcpy(deep + header + 4 * k, &bitwise, 4);
+        memcpy(deep + header + 4 * k, &constant, 4);
+        memcpy(deep + header + 4 * k + 4, &five, 8);
+
+        loaded = te_load(deep, total, lookup, 7, &err);
+        if (depths[i] < 4096) lok(loaded && te_eval(loaded) == 5);
+        else lok(!loaded && err == -1);
+        te_free(loaded);
+    }
+}
+
+void test_tiers() {
+    /* Programs run often enough to be compiled (with TE_JIT) give the same bits. */
+    static double arr[4] = {3, 1, 5, 2}, dom[4] = {3, 0, 1, 2}, ran[4] = {3, 10, 20, 40};
+    double x = 0.25, y = 3, w = 10;
+    struct record {double x, y;} layout = {0, 0}, row = {2, 7};
+
+    te_variable lookup[] = {
+        {"x", &x}, {"y", &y}, {"arr", arr},
+        {"dom", dom, TE_VARIABLE | TE_FLAG_IMMUTABLE}, {"ran", ran, TE_VARIABLE | TE_FLAG_IMMUTABLE},
+        {"sum3", sum3, TE_FUNCTION3}, {"sum7", sum7, TE_FUNCTION7},
+        {"c0", clo0, TE_CLOSURE0, &w}, {"c2", clo2, TE_CLOSURE2, &w},
+        {"fx", &layout.x}, {"fy", &layout.y},
+    };
+
+    const char *cases[] = {
+        "x+y*2-x/y", "-x^2 % 3 + (x & 3) | 4", "(1, x)",
+        "y - sin(x + cos(y * (x - 1)))",
+        "sum3(x, y*2, sum7(1, x, 2, y, 3, x*y, c0()))",
+        "x * c2(y, x) + c2(x+1, sum3(x, y, x))",
+        "arr[1] + arr[x*8] + sum(arr) * mean(arr) + arrmax(arr) - argmin(arr)",
+        "linear_interpolate(dom, ran, x*4) + dot(arr, arr)",
+        "(x+1)*(x+1) + sqrt(x+1)",
+        "1+(x+(y+(x+(y+(x+(y+(x+(y+(x+(y+(x+(y+(x+(y+(x+(y+(x+y)))))))))))))))))",
+    };
+
+    int i, k;
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        te_expr *ex = te_compile(cases[i], lookup, 9, 0);
+        lok(ex);
+        te_program *p = te_lower(ex);
+        int same = 1;
+        for (k = 0; k < 1000; ++k) {
+            x = k * 0.001 - 0.25;
+            y = 3 + (k & 7);
+            same &= same_bits(te_program_eval(p), te_eval(ex));
+        }
+        lok(same);
+        te_program_free(p);
+        te_free(ex);
+    }
+
+    te_expr *ex = te_compile_frame("fx*fy + x - c2(fx, y)", lookup, 11, &layout, sizeof(layout), 0);
+    te_program *p = te_lower(ex);
+    for (k = 0; k < 1000; ++k) {
+        row.x = k;
+        lfequal(te_program_eval_frame(p, &row), k * 7.0 + x - (10 + k + y));
+    }
+    lok(isnan(te_program_eval(p)));
+    te_program_free(p);
+    te_free(ex);
+}
+
+static int tally;
+static double tallied(double a) {
+    ++tally;
+    return a * 2;
+}
+
+
+void test_incremental() {
+    static double arr[4] = {3, 1, 5, 2}, dom[4] = {3, 0, 1, 2}, ran[4] = {3, 10, 20, 40};
+    double x = 1, y = 2, z = 3;
+    int calls = 0;
+
+    te_variable lookup[] = {
+        {"x", &x}, {"y", &y}, {"z", &z}, {"arr", arr},
+        {"dom", dom, TE_VARIABLE | TE_FLAG_IMMUTABLE}, {"ran", ran, TE_VARIABLE | TE_FLAG_IMMUTABLE},
+        {"t", tallied, TE_FUNCTION1 | TE_FLAG_PURE}, {"u", tallied, TE_FUNCTION1},
+        {"f", counted, TE_CLOSURE1 | TE_FLAG_PURE, &calls},
+    };
+
+    lok(!te_incremental_new(0));
+    te_incremental_free(0);
+
+    /* Only the path from a touched variable is recomputed. */
+    te_expr *ex = te_compile("t(x) + t(y) * z", lookup, 9, 0);
+    te_incremental *inc = te_incremental_new(ex);
+    tally = 0;
+    lfequal(te_incremental_eval(inc), 14);
+    lequal(tally, 2);
+    lfequal(te_incremental_eval(inc), 14);
+    lequal(tally, 2);
+    x = 5;
+    te_incremental_touch(inc, &x);
+    lfequal(te_incremental_eval(inc), 22);
+    lequal(tally, 3);
+    z = 1;
+    te_incremental_touch(inc, &z);
+    te_incremental_touch(inc, &arr); /* Not read by this expression. */
+    lfequal(te_incremental_eval(inc), 14);
+    lequal(tally, 3);
+    te_incremental_free(inc);
+    te_free(ex);
+
+    /* Closures and impure functions always run. */
+    ex = te_compile("f(x) + u(y) + t(z)", lookup, 9, 0);
+    inc = te_incremental_new(ex);
+    tally = 0;
+    lfequal(te_incremental_eval(inc), 21);
+    lfequal(te_incremental_eval(inc), 21);
+    lequal(calls, 2);
+    lequal(tally, 3);
+    te_incremental_free(inc);
+    te_free(ex);
+
+    /* Shared subexpressions and reductions follow their inputs. */
+    ex = te_compile("t(x+1) * t(x+1) + y", lookup, 9, 0);
+    inc = te_incremental_new(ex);
+    tally = 0;
+    lfequal(te_incremental_eval(inc), 146);
+    y = 4;
+    te_incremental_touch(inc, &y);
+    lfequal(te_incremental_eval(inc), 148);
+    x = 0;
+    te_incremental_touch(inc, &x);
+    lfequal(te_incremental_eval(inc), 8);
+    lequal(tally, 2);
+    te_incremental_free(inc);
+    te_free(ex);
+
+    ex = te_compile("mean(arr) * x + variance(arr) + arr[x]", lookup, 9, 0);
+    inc = te_incremental_new(ex);
+    lok(same_bits(te_incremental_eval(inc), te_eval(ex)));
+    arr[1] = 9;
+    te_incremental_touch(inc, arr);
+    lok(same_bits(te_incremental_eval(inc), te_eval(ex)));
+    te_incremental_free(inc);
+    te_free(ex);
+
+    /* Any sequence of changes gives te_eval's bits, if each one is touched. */
+    double *vars[] = {&x, &y, &z, arr + 2};
+    ex = te_compile("t(x)^2 + sqrt(t(x)^2 + z) * (y - arr[z]) + linear_interpolate(dom, ran, z) - sum(arr) / (t(y)+t(x)^2)",
+            lookup, 9, 0);
+    inc = te_incremental_new(ex);
+    lok(ex && inc);
+    int i, same = 1;
+    for (i = 0; i < 500; ++i) {
+        double *v = vars[(i * 7) % 4];
+        *v = (i % 13) * 0.25;
+        te_incremental_touch(inc, v == arr + 2 ? (const void*)arr : v);
+        same &= same_bits(te_incremental_eval(inc), te_eval(ex));
+    }
+    lok(same);
+    te_incremental_free(inc);
+    te_free(ex);
+}
+
+
+void test_many() {
+    static double arr[4] = {3, 1, 5, 2};
+    double x = 2, y = 3;
+    int calls = 0;
+
+    te_variable lookup[] = {
+        {"x", &x}, {"y", &y}, {"arr", arr},
+        {"f", counted, TE_CLOSURE1 | TE_FLAG_PURE, &calls},
+    };
+
+    /* A subexpression shared by several expressions is evaluated once. */
+    const char *exprs[] = {"f(x+1) * y", "f(x+1) + sum(arr)", "(f(x+1), mean(arr) - y)", "x + y"};
+    double out[4], again[4];
+    int i, err, failed;
+    te_expr *ex = te_compile_many(exprs, 4, lookup, 4, &failed, &err);
+    lok(ex);
+    lequal(err, 0);
+    lequal(failed, -1);
+    te_eval_many(ex, 4, out);
+    lequal(calls, 1);
+    for (i = 0; i < 4; ++i) {
+        te_expr *alone = te_compile(exprs[i], lookup, 4, 0);
+        lok(same_bits(out[i], te_eval(alone)));
+        te_free(alone);
+    }
+    lfequal(out[0], 27);
+    lfequal(te_eval(ex), 5);
+
+    /* The tree works wherever an expression does. */
+    te_program *p = te_lower(ex);
+    lfequal(te_program_eval(p), 5);
+    te_program_free(p);
+
+    char blob[1024];
+    const int size = te_save(ex, lookup, 4, blob, sizeof(blob));
+    lok(size > 0 && size <= (int)sizeof(blob));
+    te_expr *loaded = te_load(blob, size, lookup, 4, &err);
+    lok(loaded);
+    calls = 0;
+    te_eval_many(loaded, 4, again);
+    lequal(calls, 1);
+    for (i = 0; i < 4; ++i) lok(same_bits(out[i], again[i]));
+    te_free(loaded);
+    te_free(ex);
+
+    /* Identical expressions share everything. */
+    const char *same[] = {"x*y+1", "x*y+1"};
+    ex = te_compile_many(same, 2, lookup, 4, 0, 0);
+    te_eval_many(ex, 2, out);
+    lfequal(out[0], 7);
+    lfequal(out[1], 7);
+    te_free(ex);
+
+    /* Asking for fewer outputs gives the first ones. */
+    ex = te_compile_many(exprs, 4, lookup, 4, 0, 0);
+    te_eval_many(ex, 4, out);
+    te_eval_many(ex, 2, again);
+    lok(same_bits(out[0], again[0]) && same_bits(out[1], again[1]));
+    te_free(ex);
+
+    /* Errors name the expression, and the position within it. */
+    const char *bad[] = {"x+1", "y*", "z"};
+    lok(!te_compile_many(bad, 3, lookup, 4, &failed, &err));
+    lequal(failed, 1);
+    lequal(err, 2);
+    lok(!te_compile_many(bad, 0, lookup, 4, &failed, &err));
+    lequal(failed, -1);
+    lequal(err, -1);
+}
+
+
+void test_pool() {
+    enum {rows = 5000};
+    static double xs[rows], ys[rows * 2], out[rows], expect[rows];
+    static struct record {double x, y;} frames[rows];
+    static double arr[4] = {3, 1, 5, 2};
+    double x = 0, y = 0;
+    struct record layout = {0, 0};
+    int i, k;
+
+    te_variable lookup[] = {{"x", &x}, {"y", &y}, {"arr", arr}, {"fx", &layout.x}, {"fy", &layout.y}};
+    for (i = 0; i < rows; ++i) {
+        xs[i] = frames[i].x = i * 0.01 - 7;
+        ys[i * 2] = frames[i].y = cos(i * 0.3);
+    }
+    te_column cols[] = {{&x, xs, 1}, {&y, ys, 2}};
+
+    te_pool *serial = te_pool_new(1, 0);
+    te_pool *pools[] = {serial, te_pool_new(4, 0), te_pool_new(0, 0), te_pool_new(3, TE_POOL_DETERMINISTIC), 0};
+    lequal(te_pool_threads(serial), 1);
+    lequal(te_pool_threads(0), 1);
+    lok(te_pool_threads(pools[1]) >= 1);
+
+    /* Each row gets the bits te_eval_batch gives it, however the rows are split. */
+    te_expr *ex = te_compile("sqrt(x*x + y*y) + (x+1)*(x+1) - sum(arr) * sin(y)", lookup, 3, 0);
+    te_eval_batch(ex, cols, 2, rows, expect);
+    for (k = 0; k < 5; ++k) {
+        for (i = 0; i < rows; ++i) out[i] = 0;
+        te_pool_eval_batch(pools[k], ex, cols, 2, rows, out);
+        lequal(memcmp(out, expect, sizeof(out)), 0);
+        te_pool_eval_batch(pools[k], ex, cols, 2, 7, out);
+        lequal(memcmp(out, expect, sizeof(double) * 7), 0);
+    }
+    te_free(ex);
+
+    ex = te_compile_frame("fx*fy - fx/2", lookup, 5, &layout, sizeof(layout), 0);
+    te_eval_batch_frame(ex, frames, sizeof(struct record), rows, expect);
+    for (k = 0; k < 5; ++k) {
+        te_pool_eval_batch_frame(pools[k], ex, frames, sizeof(struct record), rows, out);
+        lequal(memcmp(out, expect, sizeof(out)), 0);
+    }
+    te_free(ex);
+
+    /* Expressions sharing subexpressions. */
+    enum {count = 200};
+    char texts[count][64];
+    const char *exprs[count];
+    for (i = 0; i < count; ++i) {
+        sprintf(texts[i], "sqrt(x*x+y) * %d + mean(arr) / (x + %d)", i, i % 7);
+        exprs[i] = texts[i];
+    }
+    x = 3;
+    y = 4;
+    ex = te_compile_many(exprs, count, lookup, 3, 0, 0);
+    lok(ex);
+    te_eval_many(ex, count, expect);
+    for (k = 0; k < 5; ++k) {
+        for (i = 0; i < count; ++i) out[i] = 0;
+        te_pool_eval_many(pools[k], ex, count, out);
+        lequal(memcmp(out, expect, sizeof(double) * count), 0);
+    }
+    te_free(ex);
+
+    for (k = 0; k < 4; ++k) te_pool_free(pools[k]);
+    te_pool_free(0);
+}
+
+
+void test_profile() {
+    double x = 0.5, xs[300], out[300];
+    int i, calls = 0;
+    for (i = 0; i < 300; ++i) xs[i] = i;
+
+    te_variable lookup[] = {{"x", &x}, {"f", counted, TE_CLOSURE1, &calls}};
+    te_profile_reset(0);
+    te_expr *ex = te_compile("sin(x) + f(x*2)", lookup, 2, 0);
+    for (i = 0; i < 10; ++i) te_eval(ex);
+    te_column col = {&x, xs, 1};
+    te_eval_batch(ex, &col, 1, 300, out);
+
+#ifdef TE_PROFILE
+    /* Each row of a batch counts as one call. */
+    const te_expr *sine = ex->parameters[0], *closure = ex->parameters[1];
+    lequal((int)te_profile_calls(ex), 310);
+    lequal((int)te_profile_calls(sine), 310);
+    lequal((int)te_profile_calls(closure), 310);
+    lequal((int)te_profile_calls(closure->parameters[0]), 310);
+    lok(te_profile_ticks(ex) >= te_profile_ticks(sine) + te_profile_ticks(closure));
+
+    te_profile_reset(ex);
+    lequal((int)te_profile_calls(ex), 0);
+    lok(te_profile_ticks(closure) == 0);
+    te_eval(ex);
+    lequal((int)te_profile_calls(closure), 1);
+
+    const te_compile_profile c = te_profile_compile();
+    lequal((int)c.compiles, 1);
+    lok(c.tokenize > 0 && c.parse > 0);
+    te_profile_reset(0);
+    lequal((int)te_profile_compile().compiles, 0);
+#else
+    lequal((int)te_profile_calls(ex), 0);
+    lequal((int)te_profile_compile().compiles, 0);
+#endif
+    te_free(ex);
+}
+
+
 int main(int argc, char *argv[])
 {
     lrun("Results", test_results);
     lrun("Syntax", test_syntax);
+    lrun("Numbers", test_numbers);
     lrun("NaNs", test_nans);
     lrun("INFs", test_infs);
     lrun("Variables", test_variables);
@@ -703,6 +2682,30 @@ int main(int argc, char *argv[])
     lrun("Optimize", test_optimize);
     lrun("Pow", test_pow);
     lrun("Combinatorics", test_combinatorics);
+    lrun("Program", test_program);
+    lrun("Batch", test_batch);
+    lrun("Batch float", test_batchf);
+    lrun("Pack", test_pack);
+    lrun("Symbols", test_symbols);
+    lrun("Frame", test_frame);
+    lrun("Frame arrays", test_frame_arrays);
+    lrun("CSE", test_cse);
+    lrun("Simplify", test_simplify);
+    lrun("Lerp", test_lerp);
+    lrun("Aggregates", test_aggregates);
+    lrun("Reductions", test_reductions);
+    lrun("Views", test_views);
+    lrun("Vector", test_vector);
+    lrun("Bitwise", test_bitwise);
+    lrun("Conditionals", test_conditionals);
+    lrun("Ranges", test_ranges);
+    lrun("Cache", test_cache);
+    lrun("Serialize", test_serialize);
+    lrun("Tiers", test_tiers);
+    lrun("Incremental", test_incremental);
+    lrun("Many", test_many);
+    lrun("Pool", test_pool);
+    lrun("Profile", test_profile);
     lresults();
 
     return lfails != 0;
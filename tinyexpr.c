@@ -35,13 +35,105 @@ For log = base 10 log do nothing
 For log = natural log uncomment the next line. */
 /* #define TE_NAT_LOG */
 
+/* Batch kernels
+For plain C loops in te_eval_batch do nothing.
+For SIMD kernels (SSE2/AVX2/AVX-512 picked at runtime, or NEON) uncomment the next line. */
+/* #define TE_SIMD */
+
+/* Algebraic rewrites
+For rewrites that never change a result (x^2 = x*x, x*1 = x, x/4 = x*0.25) do nothing.
+To also allow rewrites that can change the last bit of a result, or the sign of
+a zero (x/c = x*(1/c), x^0.5 = sqrt(x), x^3 = x*x*x, x+0 = x, 5+a+5 = a+10),
+uncomment the next line. */
+/* #define TE_FAST_MATH */
+
+/* Interpolation
+For linear_interpolate to binary search its table on every call do nothing.
+To have each call site remember its last segment and try it first, uncomment the next line. */
+/* #define TE_LERP_CACHE */
+
+/* Array sums
+For sum to add its elements in order do nothing (with TE_FAST_MATH, sum adds
+in eight interleaved lanes instead).
+For compensated summation, about as accurate as adding in twice the
+precision and then rounding, uncomment the next line. */
+/* #define TE_ACCURATE_SUM */
+
+/* Native code
+For te_program_eval to always interpret its program do nothing.
+To have a program compiled to machine code once it has run TE_JIT_THRESHOLD
+times, uncomment the next line (x86-64 with mmap only; elsewhere it does nothing). */
+/* #define TE_JIT */
+
+/* Profiling
+For no instrumentation do nothing.
+To count evaluations and time spent in each node, and time each phase of
+te_compile, uncomment the next line (see te_profile_print). */
+/* #define TE_PROFILE */
+
+/* Threads
+For te_pool functions to run on the calling thread alone do nothing.
+To have them spread their work over a pool of POSIX threads, uncomment the next
+line (and link with -pthread). */
+/* #define TE_THREADS */
+
 #include "tinyexpr.h"
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <limits.h>
+#include <float.h>
+
+#if defined(TE_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TE_SIMD_X86
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f")))
+#elif defined(TE_SIMD) && defined(__aarch64__)
+#include <arm_neon.h>
+#define TE_SIMD_NEON
+#endif
+
+#if defined(TE_JIT) && (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__) && \
+    (defined(__unix__) || defined(__APPLE__))
+#include <sys/mman.h>
+#define TE_JIT_X86
+#ifndef TE_JIT_THRESHOLD
+#define TE_JIT_THRESHOLD 100
+#endif
+#endif
+
+#if defined(TE_THREADS) && (defined(__GNUC__) || defined(__clang__)) && (defined(__unix__) || defined(__APPLE__))
+#include <pthread.h>
+#include <unistd.h>
+#define TE_THREADS_POSIX
+#endif
+
+#ifdef TE_PROFILE
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define TICKS() __rdtsc() /* Cycles of the time stamp counter. */
+#elif defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+static unsigned long long ticks(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long long)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+#define TICKS() ticks() /* Nanoseconds. */
+#else
+#include <time.h>
+#define TICKS() ((unsigned long long)clock())
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define PROFILE_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#else
+#define PROFILE_ADD(p, v) (*(p) += (v))
+#endif
+#endif
 
 #ifndef NAN
 #define NAN (0.0/0.0)
@@ -66,6 +158,60 @@ enum {
 
 enum {TE_CONSTANT = 1};
 
+/* A variable or array read from the evaluation frame at a byte offset (see te_compile_frame). */
+enum {TE_SLOT = 2, TE_SLOT_ARRAY = TE_ARRAY | TE_SLOT};
+
+/* A common subexpression (see cse): TE_LET stores its first argument in temp */
+/* `offset` and then evaluates its second, and TE_TEMP reads the temp back. */
+enum {TE_TEMP = 3, TE_LET = 7};
+
+/* linear_interpolate(domain, range, x). parameters[3] holds the table's slopes, */
+/* length prefixed, when both arrays are immutable; offset holds the last segment. */
+enum {TE_LERP = 5};
+
+/* Node kinds past the eight above set this bit, which no function, closure */
+/* or flag uses. */
+enum {TE_KIND_EXT = 256};
+
+/* A fused pass over the array variable in its first argument (see fuse): */
+/* TE_REDUCE stores the statistics in its type's upper bits in temps from */
+/* `offset` on, in bit order, and then evaluates its second argument. */
+enum {TE_REDUCE = TE_KIND_EXT};
+enum {STAT_SUM = 1, STAT_MEAN = 2, STAT_VARIANCE = 4, STAT_MIN = 8,
+    STAT_MAX = 16, STAT_ARGMIN = 32, STAT_ARGMAX = 64};
+#define REDUCE_STATS(TYPE) ((TYPE) >> 16)
+
+/* A builtin reading one bare array variable, e.g. sum(a), and dot(a, b) of two. */
+/* Their arguments are TE_VARIABLE or TE_SLOT nodes, checked by the parser, and */
+/* function takes the arrays themselves (see array_function). */
+enum {TE_AGGREGATE = TE_KIND_EXT | 1, TE_DOT = TE_KIND_EXT | 2};
+
+/* An array bound through a te_view (TE_VIEW, public as TE_KIND_EXT | 3), and */
+/* an index into one. Both keep the te_view in view. */
+enum {TE_VIEW_ARRAY = TE_KIND_EXT | 4};
+
+/* A tree of the builtin bitwise operators, evaluated on integers (see infer_bits). */
+enum {TE_BITWISE = TE_KIND_EXT | 5};
+
+/* if(c, a, b), and the && and || built on it: evaluates its first argument, */
+/* and then only its second if that is nonzero (NaN included), else its third. */
+enum {TE_IF = TE_KIND_EXT | 6};
+
+/* Common subexpressions kept per expression, at most. */
+#define TE_MAX_TEMPS 64
+
+/* Stack bytes te_interp parses into before it falls back to te_compile. */
+#ifndef TE_INTERP_BYTES
+#define TE_INTERP_BYTES 4096
+#endif
+
+/* Marks the root of a tree that lives in one block (see te_pack). */
+enum {TE_FLAG_PACKED = 64};
+
+/* Marks an index into an immutable array, or a linear_interpolate of an */
+/* immutable table, that prove showed to be in bounds, so it goes unchecked. */
+enum {TE_FLAG_PROVEN = 1024};
+
 
 typedef struct state {
     const char *start;
@@ -73,13 +219,34 @@ typedef struct state {
     int type;
     union {double value; const double *bound; const void *function;};
     void *context;
+    te_vector_function vector;
 
     const te_variable *lookup;
     int lookup_len;
+    const te_symbols *symbols;
+
+    const char *frame;
+    int frame_size;
+    int view; /* Whether the TOK_VARIABLE is bound through a te_view. */
+    int immutable; /* Whether it is bound with TE_FLAG_IMMUTABLE. */
+
+    /* For te_interp, nodes are carved out of this buffer instead, and never freed one by one. */
+    char *arena;
+    int arena_size, arena_used;
+    int arena_full; /* A node did not fit, so the tree is incomplete. */
+#ifdef TE_PROFILE
+    unsigned long long tokenize; /* Ticks in next_token, set by parse. */
+#endif
 } state;
 
 
-#define TYPE_MASK(TYPE) ((TYPE)&0x0000001F)
+struct te_symbols {
+    int count;
+    const te_variable *sorted[1];
+};
+
+
+#define TYPE_MASK(TYPE) ((TYPE)&0x0000011F)
 
 #define IS_PURE(TYPE) (((TYPE) & TE_FLAG_PURE) != 0)
 #define IS_FUNCTION(TYPE) (((TYPE) & TE_FUNCTION0) != 0)
@@ -89,14 +256,37 @@ typedef struct state {
 #endif
 #define ARITY(TYPE)                                                       \
    ( ((TYPE) & (TE_FUNCTION0 | TE_CLOSURE0)) ? ((TYPE) & 0x00000007)       \
-     : ((TYPE) == TE_ARRAY ? 1 : 0) )
+     : ((TYPE_MASK(TYPE) & ~TE_SLOT) == TE_ARRAY || TYPE_MASK(TYPE) == TE_AGGREGATE                      \
+        || TYPE_MASK(TYPE) == TE_VIEW_ARRAY || TYPE_MASK(TYPE) == TE_BITWISE ? 1                         \
+     : (TYPE_MASK(TYPE) == TE_LET || TYPE_MASK(TYPE) == TE_REDUCE || TYPE_MASK(TYPE) == TE_DOT ? 2          \
+     : (TYPE_MASK(TYPE) == TE_LERP || TYPE_MASK(TYPE) == TE_IF ? 3 : 0))) )
+/* A function with TE_FLAG_VECTOR keeps its te_vector_function after its arguments and context. */
+#define VECTOR(n) (*(te_vector_function*)&(n)->parameters[ARITY((n)->type) + IS_CLOSURE((n)->type)])
 #define NEW_EXPR(type, ...) new_expr((type), (const te_expr*[]){__VA_ARGS__})
 #define CHECK_NULL(ptr, ...) if ((ptr) == NULL) { __VA_ARGS__; return NULL; }
 
+static int node_base(const int type) {
+    const int psize = sizeof(void*) * ARITY(type);
+    const int extra = (IS_CLOSURE(type) || TYPE_MASK(type) == TE_LERP) + ((type & TE_FLAG_VECTOR) != 0);
+    return (sizeof(te_expr) - sizeof(void*)) + psize + extra * sizeof(void*);
+}
+
+#ifdef TE_PROFILE
+/* Each node's counters follow it, where new_expr zeroes them and te_pack copies them. */
+typedef struct node_stats {unsigned long long count, ticks;} node_stats;
+#define STATS_OFFSET(TYPE) ((node_base(TYPE) + sizeof(double) - 1) / sizeof(double) * sizeof(double))
+#define STATS(n) ((node_stats*)((char*)(n) + STATS_OFFSET((n)->type)))
+#define node_size(TYPE) ((int)(STATS_OFFSET(TYPE) + sizeof(node_stats)))
+
+static te_compile_profile compile_profile;
+#else
+#define node_size node_base
+#endif
+
 static te_expr *new_expr(const int type, const te_expr *parameters[]) {
     const int arity = ARITY(type);
     const int psize = sizeof(void*) * arity;
-    const int size = (sizeof(te_expr) - sizeof(void*)) + psize + (IS_CLOSURE(type) ? sizeof(void*) : 0);
+    const int size = node_size(type);
     te_expr *ret = malloc(size);
     CHECK_NULL(ret);
 
@@ -112,25 +302,78 @@ static te_expr *new_expr(const int type, const te_expr *parameters[]) {
 
 void te_free_parameters(te_expr *n) {
     if (!n) return;
+    if (TYPE_MASK(n->type) == TE_LERP) free(n->parameters[3]);
     switch (TYPE_MASK(n->type)) {
         case TE_FUNCTION7: case TE_CLOSURE7: te_free(n->parameters[6]);     /* Falls through. */
         case TE_FUNCTION6: case TE_CLOSURE6: te_free(n->parameters[5]);     /* Falls through. */
         case TE_FUNCTION5: case TE_CLOSURE5: te_free(n->parameters[4]);     /* Falls through. */
         case TE_FUNCTION4: case TE_CLOSURE4: te_free(n->parameters[3]);     /* Falls through. */
-        case TE_FUNCTION3: case TE_CLOSURE3: te_free(n->parameters[2]);     /* Falls through. */
-        case TE_FUNCTION2: case TE_CLOSURE2: te_free(n->parameters[1]);     /* Falls through. */
-        case TE_FUNCTION1: case TE_CLOSURE1: te_free(n->parameters[0]);
+        case TE_FUNCTION3: case TE_CLOSURE3: case TE_LERP: case TE_IF: te_free(n->parameters[2]);     /* Falls through. */
+        case TE_FUNCTION2: case TE_CLOSURE2: case TE_LET: case TE_REDUCE: case TE_DOT: te_free(n->parameters[1]);     /* Falls through. */
+        case TE_FUNCTION1: case TE_CLOSURE1: case TE_ARRAY: case TE_SLOT_ARRAY: case TE_AGGREGATE: case TE_VIEW_ARRAY:
+        case TE_BITWISE:
+            te_free(n->parameters[0]);
     }
 }
 
 
 void te_free(te_expr *n) {
     if (!n) return;
-    te_free_parameters(n);
+    if (!(n->type & TE_FLAG_PACKED)) te_free_parameters(n);
     free(n);
 }
 
 
+static int slopes_size(const te_expr *n) {
+    /* Bytes in the slope table of a TE_LERP node, if it has one. */
+    const double *slopes = TYPE_MASK(n->type) == TE_LERP ? n->parameters[3] : 0;
+    return slopes ? sizeof(double) * (1 + (int)slopes[0]) : 0;
+}
+
+
+/* Packed nodes are padded so each one stays aligned for its double. */
+#define PACKED_SIZE(TYPE) ((node_size(TYPE) + sizeof(double) - 1) / sizeof(double) * sizeof(double))
+
+int te_size(const te_expr *n) {
+    int i, size;
+    if (!n) return 0;
+    size = PACKED_SIZE(n->type);
+    for (i = 0; i < ARITY(n->type); ++i) size += te_size(n->parameters[i]);
+    return size + slopes_size(n);
+}
+
+
+static te_expr *pack(const te_expr *n, char **next) {
+    /* Depth first, so each node is followed by its first argument. */
+    te_expr *ret = (te_expr*)*next;
+    int i;
+
+    *next += PACKED_SIZE(n->type);
+    memcpy(ret, n, node_size(n->type));
+    ret->type &= ~TE_FLAG_PACKED;
+#ifdef TE_PROFILE
+    /* A node whose type shrank during optimization has stale bytes there. */
+    memset(STATS(ret), 0, sizeof(node_stats));
+#endif
+    for (i = 0; i < ARITY(n->type); ++i) ret->parameters[i] = pack(n->parameters[i], next);
+    if (slopes_size(n)) {
+        /* The slope table follows the node's arguments. */
+        ret->parameters[3] = memcpy(*next, n->parameters[3], slopes_size(n));
+        *next += slopes_size(n);
+    }
+    return ret;
+}
+
+
+te_expr *te_pack(const te_expr *n, void *buffer, int size) {
+    if (!n || !buffer || size < te_size(n)) return 0;
+    char *next = buffer;
+    te_expr *ret = pack(n, &next);
+    ret->type |= TE_FLAG_PACKED;
+    return ret;
+}
+
+
 static double pi(void) {return 3.14159265358979323846;}
 static double e(void) {return 2.71828182845904523536;}
 static double fac(double a) {/* simplest version of fac */
@@ -171,13 +414,16 @@ static int is_valid_bitwise_operand(double x) {
 }
 
 static double fn_bit(double n, double i) {
-    if (n < 0 || i < 0) return NAN;
+    if (!is_valid_bitwise_operand(n) || !is_valid_bitwise_operand(i)) return NAN;
     int64_t iv = (int64_t)round(n);
     int64_t bi = (int64_t)round(i);
-    if (iv > (1LL << 53) - 1 || bi >= 53) return NAN;
+    if (bi >= MAX_BITWISE_WIDTH) return NAN;
     return (iv & (1LL << bi)) ? 1.0 : 0.0;
 }
 
+/* Only for folding constants: the parser turns calls of it into TE_IF nodes. */
+static double fn_if(double c, double a, double b) {return c != 0 ? a : b;}
+
 static double fn_xor(double a, double b) {
     if (!is_valid_bitwise_operand(a) || !is_valid_bitwise_operand(b)) return NAN;
     return ((int64_t)round(a)) ^ ((int64_t)round(b));
@@ -185,58 +431,541 @@ static double fn_xor(double a, double b) {
 
 /*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
 /* Generic array-aggregate functions:                                   */
-/*   arr[0] = length; arr[1..length] = data                                */
+/*   arr[0] = length; arr[1..length] = data, or a te_view                  */
 /*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
-static double te_sum(const double *arr) {
-    int len = (int)arr[0];
-    double s = 0.0;
-    for (int i = 1; i <= len; ++i) s += arr[i];
-    return s;
+/* Either layout reaches the functions below as a span of its elements. */
+typedef struct span {
+    const double *x;
+    int len;
+    int stride;
+} span;
+
+#define AT(a, i) ((a)->x[(ptrdiff_t)(i) * (a)->stride])
+
+static span prefix_span(const double *arr) {
+    span a;
+    a.x = arr + 1;
+    a.len = (int)arr[0];
+    a.stride = 1;
+    return a;
 }
 
-static double te_arrmin(const double *arr) {
-    int len = (int)arr[0];
-    if (len < 1) return NAN;
-    double m = arr[1];
-    for (int i = 2; i <= len; ++i)
-        if (arr[i] < m) m = arr[i];
-    return m;
+static span view_span(const te_view *v) {
+    span a;
+    a.x = v->data;
+    a.len = v->length_ptr ? *v->length_ptr : v->length;
+    a.stride = v->stride;
+    return a;
 }
 
-static double te_arrmax(const double *arr) {
-    int len = (int)arr[0];
-    if (len < 1) return NAN;
-    double m = arr[1];
-    for (int i = 2; i <= len; ++i)
-        if (arr[i] > m) m = arr[i];
-    return m;
+/* The aggregate kernels keep REDUCE_LANES accumulators, lane k taking elements
+ * k, k+REDUCE_LANES, ... Every instruction set lays the lanes out the same way,
+ * so a reassociated sum gives the same bits whichever kernel the CPU picks.
+ * Data starts one element past the length, so all loads are unaligned. Strided
+ * views always take the plain kernel, which gathers the same lanes. */
+#define REDUCE_LANES 8
+
+typedef struct reducer {
+    int (*sum)(const double *x, int stride, int count, double *s);
+    int (*sum2)(const double *x, int stride, int count, double *s, double *c);
+    int (*min)(const double *x, int stride, int count, double *m);
+    int (*max)(const double *x, int stride, int count, double *m);
+    int (*minmax)(const double *x, int stride, int count, double *lo, double *hi);
+    int (*stats)(const double *x, int stride, int count, double *s, double *c, double *lo, double *hi);
+} reducer;
+
+/* Each kernel folds whole rows of REDUCE_LANES elements into its lanes and */
+/* returns how many elements it used. MIN(x, m) must keep m unless x < m. */
+/* sum2 keeps each lane's rounding error in c, by Knuth's TwoSum. stats does */
+/* sum2, min and max at once; its s lanes match both sum and sum2. ELEM(x, j) */
+/* is the address of element j, which only the plain kernel spaces by stride. */
+#define REDUCERS(P, ATTR, VEC, WIDTH, ELEM, LOAD, STORE, ADD, SUB, MIN, MAX) \
+    ATTR static int P##_sum(const double *x, int stride, int count, double *s) { \
+        VEC v[REDUCE_LANES / WIDTH]; \
+        int i = 0, k; \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) v[k] = LOAD(s + k * WIDTH); \
+        for (; i + REDUCE_LANES <= count; i += REDUCE_LANES) \
+            for (k = 0; k < REDUCE_LANES / WIDTH; ++k) v[k] = ADD(v[k], LOAD(ELEM(x, i + k * WIDTH))); \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) STORE(s + k * WIDTH, v[k]); \
+        return i; \
+    } \
+    ATTR static int P##_sum2(const double *x, int stride, int count, double *s, double *c) { \
+        VEC v[REDUCE_LANES / WIDTH], e[REDUCE_LANES / WIDTH]; \
+        int i = 0, k; \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) { \
+            v[k] = LOAD(s + k * WIDTH); \
+            e[k] = LOAD(c + k * WIDTH); \
+        } \
+        for (; i + REDUCE_LANES <= count; i += REDUCE_LANES) \
+            for (k = 0; k < REDUCE_LANES / WIDTH; ++k) { \
+                const VEC y = LOAD(ELEM(x, i + k * WIDTH)), t = ADD(v[k], y), z = SUB(t, v[k]); \
+                e[k] = ADD(e[k], ADD(SUB(v[k], SUB(t, z)), SUB(y, z))); \
+                v[k] = t; \
+            } \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) { \
+            STORE(s + k * WIDTH, v[k]); \
+            STORE(c + k * WIDTH, e[k]); \
+        } \
+        return i; \
+    } \
+    ATTR static int P##_min(const double *x, int stride, int count, double *m) { \
+        VEC v[REDUCE_LANES / WIDTH]; \
+        int i = 0, k; \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) v[k] = LOAD(m + k * WIDTH); \
+        for (; i + REDUCE_LANES <= count; i += REDUCE_LANES) \
+            for (k = 0; k < REDUCE_LANES / WIDTH; ++k) v[k] = MIN(LOAD(ELEM(x, i + k * WIDTH)), v[k]); \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) STORE(m + k * WIDTH, v[k]); \
+        return i; \
+    } \
+    ATTR static int P##_max(const double *x, int stride, int count, double *m) { \
+        VEC v[REDUCE_LANES / WIDTH]; \
+        int i = 0, k; \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) v[k] = LOAD(m + k * WIDTH); \
+        for (; i + REDUCE_LANES <= count; i += REDUCE_LANES) \
+            for (k = 0; k < REDUCE_LANES / WIDTH; ++k) v[k] = MAX(LOAD(ELEM(x, i + k * WIDTH)), v[k]); \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) STORE(m + k * WIDTH, v[k]); \
+        return i; \
+    } \
+    ATTR static int P##_minmax(const double *x, int stride, int count, double *lo, double *hi) { \
+        VEC l[REDUCE_LANES / WIDTH], h[REDUCE_LANES / WIDTH]; \
+        int i = 0, k; \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) { \
+            l[k] = LOAD(lo + k * WIDTH); \
+            h[k] = LOAD(hi + k * WIDTH); \
+        } \
+        for (; i + REDUCE_LANES <= count; i += REDUCE_LANES) \
+            for (k = 0; k < REDUCE_LANES / WIDTH; ++k) { \
+                const VEC y = LOAD(ELEM(x, i + k * WIDTH)); \
+                l[k] = MIN(y, l[k]); \
+                h[k] = MAX(y, h[k]); \
+            } \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) { \
+            STORE(lo + k * WIDTH, l[k]); \
+            STORE(hi + k * WIDTH, h[k]); \
+        } \
+        return i; \
+    } \
+    ATTR static int P##_stats(const double *x, int stride, int count, double *s, double *c, double *lo, double *hi) { \
+        VEC v[REDUCE_LANES / WIDTH], e[REDUCE_LANES / WIDTH], l[REDUCE_LANES / WIDTH], h[REDUCE_LANES / WIDTH]; \
+        int i = 0, k; \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) { \
+            v[k] = LOAD(s + k * WIDTH); \
+            e[k] = LOAD(c + k * WIDTH); \
+            l[k] = LOAD(lo + k * WIDTH); \
+            h[k] = LOAD(hi + k * WIDTH); \
+        } \
+        for (; i + REDUCE_LANES <= count; i += REDUCE_LANES) \
+            for (k = 0; k < REDUCE_LANES / WIDTH; ++k) { \
+                const VEC y = LOAD(ELEM(x, i + k * WIDTH)), t = ADD(v[k], y), z = SUB(t, v[k]); \
+                e[k] = ADD(e[k], ADD(SUB(v[k], SUB(t, z)), SUB(y, z))); \
+                v[k] = t; \
+                l[k] = MIN(y, l[k]); \
+                h[k] = MAX(y, h[k]); \
+            } \
+        for (k = 0; k < REDUCE_LANES / WIDTH; ++k) { \
+            STORE(s + k * WIDTH, v[k]); \
+            STORE(c + k * WIDTH, e[k]); \
+            STORE(lo + k * WIDTH, l[k]); \
+            STORE(hi + k * WIDTH, h[k]); \
+        } \
+        return i; \
+    }
+
+#define PLAIN_ELEM(x, j) ((x) + (ptrdiff_t)(j) * stride)
+#define PLAIN_LOAD(p) (*(p))
+#define PLAIN_STORE(p, v) (*(p) = (v))
+#define PLAIN_ADD(a, b) ((a) + (b))
+#define PLAIN_SUB(a, b) ((a) - (b))
+#define PLAIN_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define PLAIN_MAX(a, b) ((a) > (b) ? (a) : (b))
+REDUCERS(plain, , double, 1, PLAIN_ELEM, PLAIN_LOAD, PLAIN_STORE, PLAIN_ADD, PLAIN_SUB, PLAIN_MIN, PLAIN_MAX)
+#undef PLAIN_ELEM
+#undef PLAIN_LOAD
+#undef PLAIN_STORE
+#undef PLAIN_ADD
+#undef PLAIN_SUB
+#undef PLAIN_MIN
+#undef PLAIN_MAX
+
+static const reducer plain = {plain_sum, plain_sum2, plain_min, plain_max, plain_minmax, plain_stats};
+
+/* Vector kernels read contiguous elements, ignoring stride. */
+#define UNIT_ELEM(x, j) ((x) + (j))
+
+#if defined(TE_SIMD_X86)
+
+/* minpd and maxpd return their second operand on NaN and on equal values. */
+REDUCERS(sse2, SSE2, __m128d, 2, UNIT_ELEM, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, _mm_sub_pd, _mm_min_pd, _mm_max_pd)
+REDUCERS(avx2, AVX2, __m256d, 4, UNIT_ELEM, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_min_pd, _mm256_max_pd)
+REDUCERS(avx512, AVX512, __m512d, 8, UNIT_ELEM, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_min_pd, _mm512_max_pd)
+
+static const reducer *select_reducer(int stride) {
+    static const reducer sse2 = {sse2_sum, sse2_sum2, sse2_min, sse2_max, sse2_minmax, sse2_stats};
+    static const reducer avx2 = {avx2_sum, avx2_sum2, avx2_min, avx2_max, avx2_minmax, avx2_stats};
+    static const reducer avx512 = {avx512_sum, avx512_sum2, avx512_min, avx512_max, avx512_minmax, avx512_stats};
+    if (stride != 1) return &plain;
+    if (__builtin_cpu_supports("avx512f")) return &avx512;
+    if (__builtin_cpu_supports("avx2")) return &avx2;
+    return &sse2;
 }
 
-static double te_arrlen(const double *arr) {
-    return arr[0];
+#elif defined(TE_SIMD_NEON)
+
+#define NEON_MIN(a, b) vbslq_f64(vcltq_f64((a), (b)), (a), (b))
+#define NEON_MAX(a, b) vbslq_f64(vcgtq_f64((a), (b)), (a), (b))
+REDUCERS(neon, , float64x2_t, 2, UNIT_ELEM, vld1q_f64, vst1q_f64, vaddq_f64, vsubq_f64, NEON_MIN, NEON_MAX)
+#undef NEON_MIN
+#undef NEON_MAX
+
+static const reducer *select_reducer(int stride) {
+    static const reducer neon = {neon_sum, neon_sum2, neon_min, neon_max, neon_minmax, neon_stats};
+    return stride != 1 ? &plain : &neon;
 }
 
-static double te_lerp(const double *domain, const double *range, double x) {
-    int n = (int)domain[0];
-    if ((int)range[0] != n || n < 2) {
-        //fprintf(stderr, "linear_interpolate(): mismatched or invalid array lengths\n");
-        return NAN;
+#else
+
+static const reducer *select_reducer(int stride) {
+    (void)stride;
+    return &plain;
+}
+
+#endif
+
+#undef UNIT_ELEM
+#undef REDUCERS
+
+
+#ifdef TE_ACCURATE_SUM
+static void two_sum(double *s, double *c, double x) {
+    /* Adds x to s, and the rounding error of doing so to c. */
+    const double t = *s + x, z = t - *s;
+    *c += (*s - (t - z)) + (x - z);
+    *s = t;
+}
+#endif
+
+
+static double finish_sum(const span *a, int i, const double *s, const double *c) {
+    /* Adds up the lanes a kernel left in s and c, then elements i to the end. */
+#if defined(TE_ACCURATE_SUM)
+    double total = 0, error = 0;
+    int k;
+    for (k = 0; k < REDUCE_LANES; ++k) {
+        two_sum(&total, &error, s[k]);
+        error += c[k];
+    }
+    for (; i < a->len; ++i) two_sum(&total, &error, AT(a, i));
+    /* Infinities leave NaN errors behind. */
+    return isfinite(total) ? total + error : total;
+#elif defined(TE_FAST_MATH)
+    double total = 0;
+    int k;
+    (void)c;
+    for (k = 0; k < REDUCE_LANES; ++k) total += s[k];
+    for (; i < a->len; ++i) total += AT(a, i);
+    return total;
+#else
+    /* Adding in order is a serial chain, kept in s[0], so no kernel can give the same bits. */
+    double total = s[0];
+    (void)c;
+    for (; i < a->len; ++i) total += AT(a, i);
+    return total;
+#endif
+}
+
+static double first_zero(const span *a) {
+    /* Of equal elements the first wins, which only shows for -0 and +0. */
+    int i;
+    for (i = 0; AT(a, i) != 0; ++i);
+    return AT(a, i);
+}
+
+static double finish_min(const span *a, int i, const double *lo) {
+    double best = lo[0];
+    int k;
+    for (k = 1; k < REDUCE_LANES; ++k)
+        if (lo[k] < best) best = lo[k];
+    for (; i < a->len; ++i)
+        if (AT(a, i) < best) best = AT(a, i);
+    return best == 0 ? first_zero(a) : best;
+}
+
+static double finish_max(const span *a, int i, const double *hi) {
+    double best = hi[0];
+    int k;
+    for (k = 1; k < REDUCE_LANES; ++k)
+        if (hi[k] > best) best = hi[k];
+    for (; i < a->len; ++i)
+        if (AT(a, i) > best) best = AT(a, i);
+    return best == 0 ? first_zero(a) : best;
+}
+
+static double te_sum(const span *a) {
+    double s[REDUCE_LANES] = {0}, c[REDUCE_LANES] = {0};
+    int i = 0;
+#if defined(TE_ACCURATE_SUM)
+    if (a->len >= REDUCE_LANES) i = select_reducer(a->stride)->sum2(a->x, a->stride, a->len, s, c);
+#elif defined(TE_FAST_MATH)
+    if (a->len >= REDUCE_LANES) i = select_reducer(a->stride)->sum(a->x, a->stride, a->len, s);
+#endif
+    return finish_sum(a, i, s, c);
+}
+
+static double te_arrmin(const span *a) {
+    double lo[REDUCE_LANES];
+    int i = 0, k;
+    if (a->len < 1) return NAN;
+    for (k = 0; k < REDUCE_LANES; ++k) lo[k] = a->x[0];
+    if (a->len >= REDUCE_LANES) i = select_reducer(a->stride)->min(a->x, a->stride, a->len, lo);
+    return finish_min(a, i, lo);
+}
+
+static double te_arrmax(const span *a) {
+    double hi[REDUCE_LANES];
+    int i = 0, k;
+    if (a->len < 1) return NAN;
+    for (k = 0; k < REDUCE_LANES; ++k) hi[k] = a->x[0];
+    if (a->len >= REDUCE_LANES) i = select_reducer(a->stride)->max(a->x, a->stride, a->len, hi);
+    return finish_max(a, i, hi);
+}
+
+static double te_arrlen(const span *a) {
+    return a->len;
+}
+
+static double te_mean(const span *a) {
+    return te_sum(a) / a->len;
+}
+
+static double deviation(const span *a, double mean) {
+    /* Population variance about mean, corrected for the rounding in mean. */
+    const int len = a->len;
+    double d1 = 0, d2 = 0;
+    int i = 0;
+#ifdef TE_FAST_MATH
+    double s1[REDUCE_LANES] = {0}, s2[REDUCE_LANES] = {0};
+    int k;
+    for (; i + REDUCE_LANES <= len; i += REDUCE_LANES)
+        for (k = 0; k < REDUCE_LANES; ++k) {
+            const double d = AT(a, i + k) - mean;
+            s1[k] += d;
+            s2[k] += d * d;
+        }
+    for (k = 0; k < REDUCE_LANES; ++k) {
+        d1 += s1[k];
+        d2 += s2[k];
+    }
+#endif
+    for (; i < len; ++i) {
+        const double d = AT(a, i) - mean;
+        d1 += d;
+        d2 += d * d;
+    }
+    return (d2 - d1 * d1 / len) / len;
+}
+
+static double te_variance(const span *a) {
+    return a->len < 1 ? NAN : deviation(a, te_mean(a));
+}
+
+static double index_of(const span *a, double m) {
+    /* The first index holding m. Only a NaN in the first element makes an extreme NaN. */
+    int i;
+    if (a->len < 1) return NAN;
+    if (isnan(m)) return 0;
+    for (i = 0; AT(a, i) != m; ++i);
+    return i;
+}
+
+static double te_argmin(const span *a) {
+    return index_of(a, te_arrmin(a));
+}
+
+static double te_argmax(const span *a) {
+    return index_of(a, te_arrmax(a));
+}
+
+static double te_dot(const span *a, const span *b) {
+    const int len = a->len;
+    double total = 0;
+    int i = 0;
+    if (b->len != len) return NAN;
+#ifdef TE_FAST_MATH
+    double s[REDUCE_LANES] = {0};
+    int k;
+    for (; i + REDUCE_LANES <= len; i += REDUCE_LANES)
+        for (k = 0; k < REDUCE_LANES; ++k) s[k] += AT(a, i + k) * AT(b, i + k);
+    for (k = 0; k < REDUCE_LANES; ++k) total += s[k];
+#endif
+    for (; i < len; ++i) total += AT(a, i) * AT(b, i);
+    return total;
+}
+
+static int array_function(const void *function) {
+    /* Whether function is a builtin that reads one bare array, e.g. sum(myArr). */
+    return function == (const void*)te_sum || function == (const void*)te_arrlen ||
+        function == (const void*)te_arrmin || function == (const void*)te_arrmax ||
+        function == (const void*)te_mean || function == (const void*)te_variance ||
+        function == (const void*)te_argmin || function == (const void*)te_argmax;
+}
+
+static int array_stat(const void *function) {
+    /* The statistic a fused pass gives for an array builtin, or 0. */
+    if (function == (const void*)te_sum) return STAT_SUM;
+    if (function == (const void*)te_mean) return STAT_MEAN;
+    if (function == (const void*)te_variance) return STAT_VARIANCE;
+    if (function == (const void*)te_arrmin) return STAT_MIN;
+    if (function == (const void*)te_arrmax) return STAT_MAX;
+    if (function == (const void*)te_argmin) return STAT_ARGMIN;
+    if (function == (const void*)te_argmax) return STAT_ARGMAX;
+    return 0;
+}
+
+static int stat_count(int stats) {
+    int count = 0;
+    for (; stats; stats &= stats - 1) ++count;
+    return count;
+}
+
+static void reduce_stats(const span *a, int stats, double *out) {
+    /* Computes the statistics in stats, each exactly as its builtin would, */
+    /* in as few passes over a as possible. Writes them to out in bit order. */
+    const int len = a->len;
+    const int sums = stats & (STAT_SUM | STAT_MEAN | STAT_VARIANCE);
+    const int extremes = stats & (STAT_MIN | STAT_MAX | STAT_ARGMIN | STAT_ARGMAX);
+    double s[REDUCE_LANES] = {0}, c[REDUCE_LANES] = {0}, lo[REDUCE_LANES], hi[REDUCE_LANES];
+    double sum = NAN, mean, mn = NAN, mx = NAN;
+    int i = 0, k;
+
+    for (k = 0; k < REDUCE_LANES; ++k) lo[k] = hi[k] = len > 0 ? a->x[0] : NAN;
+    if (sums && !extremes) {
+        sum = te_sum(a);
+    } else if (sums) {
+#if defined(TE_ACCURATE_SUM) || defined(TE_FAST_MATH)
+        if (len >= REDUCE_LANES) i = select_reducer(a->stride)->stats(a->x, a->stride, len, s, c, lo, hi);
+#else
+        /* The sum stays in order, the extremes use lanes. */
+        double t = 0, l[REDUCE_LANES], h[REDUCE_LANES];
+        memcpy(l, lo, sizeof(l));
+        memcpy(h, hi, sizeof(h));
+        for (; i + REDUCE_LANES <= len; i += REDUCE_LANES) {
+            for (k = 0; k < REDUCE_LANES; ++k) t += AT(a, i + k);
+            for (k = 0; k < REDUCE_LANES; ++k) {
+                const double x = AT(a, i + k);
+                l[k] = x < l[k] ? x : l[k];
+                h[k] = x > h[k] ? x : h[k];
+            }
+        }
+        s[0] = t;
+        memcpy(lo, l, sizeof(l));
+        memcpy(hi, h, sizeof(h));
+#endif
+        sum = finish_sum(a, i, s, c);
+    } else if (len >= REDUCE_LANES) {
+        i = select_reducer(a->stride)->minmax(a->x, a->stride, len, lo, hi);
+    }
+    if (extremes && len > 0) {
+        mn = finish_min(a, i, lo);
+        mx = finish_max(a, i, hi);
+    }
+    mean = sum / len;
+
+    if (stats & STAT_SUM) *out++ = sum;
+    if (stats & STAT_MEAN) *out++ = mean;
+    if (stats & STAT_VARIANCE) *out++ = len < 1 ? NAN : deviation(a, mean);
+    if (stats & STAT_MIN) *out++ = mn;
+    if (stats & STAT_MAX) *out++ = mx;
+    if (stats & STAT_ARGMIN) *out++ = index_of(a, mn);
+    if (stats & STAT_ARGMAX) *out++ = index_of(a, mx);
+}
+
+/* A segment hint is only a guess that gets checked, so threads may race on it. */
+#if defined(__GNUC__)
+#define LOAD_HINT(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define STORE_HINT(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define LOAD_HINT(p) (*(p))
+#define STORE_HINT(p, v) (*(p) = (v))
+#endif
+
+/* Call sites only keep a hint with TE_LERP_CACHE. */
+#ifdef TE_LERP_CACHE
+#define LERP_HINT(p) ((int*)(p))
+#else
+#define LERP_HINT(p) ((int*)0)
+#endif
+
+static double lerp_segment(const span *domain, const span *range, const double *slopes, double x, int *hint) {
+    /* Same as lerp, for a valid table and an x in its domain, which it doesn't check. */
+    const int n = domain->len;
+    const int ascending = AT(domain, n - 1) > AT(domain, 0);
+    int i = -1;
+    if (hint) {
+        i = LOAD_HINT(hint);
+        if (i < 0 || i > n - 2 || (ascending ? x > AT(domain, i + 1) || (i && x <= AT(domain, i))
+                                             : x < AT(domain, i + 1) || (i && x >= AT(domain, i)))) {
+            i = -1;
+        }
     }
-    const double *d = domain + 1;
-    const double *r = range + 1;
-    int ascending = d[n - 1] > d[0];
-    for (int i = 0; i < n - 1; ++i) {
-        double d0 = d[i], d1 = d[i + 1];
-        double r0 = r[i], r1 = r[i + 1];
-        int in_range = ascending ? (x >= d0 && x <= d1) : (x <= d0 && x >= d1);
-        if (in_range) {
-            if (d1 == d0) return (r0 + r1) / 2.0;
-            double t = (x - d0) / (d1 - d0);
-            return r0 + t * (r1 - r0);
+    if (i < 0) {
+        /* The first i with x before the end of segment i. */
+        int lo = 0, hi = n - 2;
+        while (lo < hi) {
+            const int mid = lo + (hi - lo) / 2;
+            if (ascending ? AT(domain, mid + 1) >= x : AT(domain, mid + 1) <= x) hi = mid; else lo = mid + 1;
         }
+        i = lo;
+        if (hint) STORE_HINT(hint, i);
+    }
+
+    double d0 = AT(domain, i), d1 = AT(domain, i + 1);
+    double r0 = AT(range, i), r1 = AT(range, i + 1);
+    if (d1 == d0) return (r0 + r1) / 2.0;
+    if (slopes) return r0 + (x - d0) * slopes[i + 1];
+    double t = (x - d0) / (d1 - d0);
+    return r0 + t * (r1 - r0);
+}
+
+static double lerp(const span *domain, const span *range, const double *slopes, double x, int *hint) {
+    /* The domain must be monotone. Segment i runs from d[i] to d[i+1]; x goes in the */
+    /* first segment that holds it. slopes and hint may be NULL. */
+    int n = domain->len;
+    if (range->len != n || n < 2) {
+        return NAN;
+    }
+    const double first = AT(domain, 0), last = AT(domain, n - 1);
+    const int ascending = last > first;
+    if (ascending ? !(x >= first && x <= last) : !(x <= first && x >= last)) {
+        return NAN;
+    }
+    return lerp_segment(domain, range, slopes, x, hint);
+}
+
+static double te_lerp(const span *domain, const span *range, double x) {
+    return lerp(domain, range, 0, x, 0);
+}
+
+static double *lerp_slopes(const span *domain, const span *range) {
+    /* Precomputes each segment's slope, length prefixed. */
+    /* Returns NULL if the table is invalid or not monotone, or out of memory. */
+    const int n = domain->len;
+    int i;
+    if (range->len != n || n < 2) return NULL;
+
+    const int ascending = AT(domain, n - 1) > AT(domain, 0);
+    for (i = 0; i < n - 1; ++i) {
+        const double d0 = AT(domain, i), d1 = AT(domain, i + 1);
+        if (ascending ? !(d1 >= d0) : !(d1 <= d0)) return NULL;
+    }
+
+    double *slopes = malloc(sizeof(double) * n);
+    CHECK_NULL(slopes);
+    slopes[0] = n - 1;
+    for (i = 0; i < n - 1; ++i) {
+        const double d0 = AT(domain, i), d1 = AT(domain, i + 1);
+        slopes[i + 1] = d1 == d0 ? 0 : (AT(range, i + 1) - AT(range, i)) / (d1 - d0);
     }
-    //fprintf(stderr, "linear_interpolate(): x=%.3f outside domain range\n", x);
-    return NAN;
+    return slopes;
 }
 
 /*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
@@ -250,6 +979,8 @@ static const te_variable functions[] = {
     /* must be in alphabetical order */
     {"abs", fabs,     TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"acos", acos,    TE_FUNCTION1 | TE_FLAG_PURE, 0},
+    {"argmax",    te_argmax, TE_FUNCTION1 | TE_FLAG_PURE, 0},
+    {"argmin",    te_argmin, TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"arrlen",    te_arrlen, TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"arrmax",    te_arrmax, TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"arrmin",    te_arrmin, TE_FUNCTION1 | TE_FLAG_PURE, 0},
@@ -260,10 +991,12 @@ static const te_variable functions[] = {
     {"ceil", ceil,    TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"cos", cos,      TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"cosh", cosh,    TE_FUNCTION1 | TE_FLAG_PURE, 0},
+    {"dot",    te_dot, TE_FUNCTION2 | TE_FLAG_PURE, 0},
     {"e", e,          TE_FUNCTION0 | TE_FLAG_PURE, 0},
     {"exp", exp,      TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"fac", fac,      TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"floor", floor,  TE_FUNCTION1 | TE_FLAG_PURE, 0},
+    {"if", fn_if,     TE_FUNCTION3 | TE_FLAG_PURE, 0},
     {"linear_interpolate",   te_lerp, TE_FUNCTION3 | TE_FLAG_PURE, 0},
     {"ln", log,       TE_FUNCTION1 | TE_FLAG_PURE, 0},
 #ifdef TE_NAT_LOG
@@ -272,6 +1005,7 @@ static const te_variable functions[] = {
     {"log", log10,    TE_FUNCTION1 | TE_FLAG_PURE, 0},
 #endif
     {"log10", log10,  TE_FUNCTION1 | TE_FLAG_PURE, 0},
+    {"mean",    te_mean, TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"ncr", ncr,      TE_FUNCTION2 | TE_FLAG_PURE, 0},
     {"npr", npr,      TE_FUNCTION2 | TE_FLAG_PURE, 0},
     {"pi", pi,        TE_FUNCTION0 | TE_FLAG_PURE, 0},
@@ -282,34 +1016,100 @@ static const te_variable functions[] = {
     {"sum",    te_sum, TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"tan", tan,      TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"tanh", tanh,    TE_FUNCTION1 | TE_FLAG_PURE, 0},
+    {"variance",    te_variance, TE_FUNCTION1 | TE_FLAG_PURE, 0},
     {"xor", fn_xor,   TE_FUNCTION2 | TE_FLAG_PURE, 0},
     {0, 0, 0, 0}
 };
 
-static const te_variable *find_builtin(const char *name, int len) {
+/* A perfect hash of the names in functions[]: each slot gives the index of the */
+/* one builtin whose name_hash lands there, or -1. Adding a builtin means finding */
+/* a BUILTIN_HASH under which no two names share a slot, and redoing the table. */
+#define BUILTIN_HASH 1089977u
+#define BUILTIN_SLOT(HASH) ((((HASH) * BUILTIN_HASH) & 0xFFFFFFFFu) >> 26)
+
+static const signed char builtin_slots[64] = {
+    -1, 15, 12, -1, 20, 33, -1, -1, -1, -1, 36, -1, -1, 28, -1, 22,
+     7, -1, 14, -1, -1, -1, 18, -1, -1,  1, -1,  8, -1,  0, 13, -1,
+    24, -1,  9, 34,  4, -1, 16,  2, 25, -1, 17,  3, -1, -1, 35, 26,
+    10,  5, -1, 23, -1,  6, 19, -1, 21, 29, 27, 31, 30, 11, -1, 32
+};
+
+
+static unsigned name_hash(const char *name, int len) {
+    /* The tokenizer works this out as it scans a name. */
+    unsigned hash = 0;
+    while (len--) hash = hash * 31 + (unsigned char)*name++;
+    return hash;
+}
+
+
+static const te_variable *find_builtin(const char *name, int len, unsigned hash) {
+    const int i = builtin_slots[BUILTIN_SLOT(hash)];
+    if (i < 0 || strncmp(name, functions[i].name, len) || functions[i].name[len]) return 0;
+    return functions + i;
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    const te_variable *va = *(const te_variable * const *)a;
+    const te_variable *vb = *(const te_variable * const *)b;
+    const int c = strcmp(va->name, vb->name);
+    if (c) return c;
+    /* Keep duplicates in table order, so the first one wins as it does in a linear scan. */
+    return va < vb ? -1 : va > vb;
+}
+
+
+te_symbols *te_symbols_new(const te_variable *variables, int var_count) {
+    int i;
+    te_symbols *ret = malloc(sizeof(te_symbols) + sizeof(const te_variable*) * (var_count > 0 ? var_count - 1 : 0));
+    CHECK_NULL(ret);
+
+    ret->count = var_count > 0 ? var_count : 0;
+    for (i = 0; i < ret->count; ++i) ret->sorted[i] = variables + i;
+    qsort(ret->sorted, ret->count, sizeof(const te_variable*), compare_symbols);
+    return ret;
+}
+
+
+void te_symbols_free(te_symbols *symbols) {
+    free(symbols);
+}
+
+
+static const te_variable *find_symbol(const te_symbols *symbols, const char *name, int len) {
     int imin = 0;
-    int imax = sizeof(functions) / sizeof(te_variable) - 2;
+    int imax = symbols->count;
 
-    /*Binary search.*/
-    while (imax >= imin) {
+    /*Binary search for the first entry not below name.*/
+    while (imin < imax) {
         const int i = (imin + ((imax-imin)/2));
-        int c = strncmp(name, functions[i].name, len);
-        if (!c) c = '\0' - functions[i].name[len];
-        if (c == 0) {
-            return functions + i;
-        } else if (c > 0) {
+        int c = strncmp(name, symbols->sorted[i]->name, len);
+        if (!c) c = '\0' - symbols->sorted[i]->name[len];
+        if (c > 0) {
             imin = i + 1;
         } else {
-            imax = i - 1;
+            imax = i;
         }
     }
 
+    if (imin < symbols->count) {
+        const te_variable *var = symbols->sorted[imin];
+        if (strncmp(name, var->name, len) == 0 && var->name[len] == '\0') return var;
+    }
     return 0;
 }
 
+
+static te_vector_function vector_of(const te_variable *var) {
+    /* The vector form a function is bound with, if any. */
+    return (var->type & TE_FLAG_VECTOR) ? var->vector : 0;
+}
+
+
 static const te_variable *find_lookup(const state *s, const char *name, int len) {
     int iters;
     const te_variable *var;
+    if (s->symbols) return find_symbol(s->symbols, name, len);
     if (!s->lookup) return 0;
 
     for (var = s->lookup, iters = s->lookup_len; iters; ++var, --iters) {
@@ -328,6 +1128,17 @@ static double mul(double a, double b) {return a * b;}
 static double divide(double a, double b) {return a / b;}
 static double negate(double a) {return -a;}
 static double comma(double a, double b) {(void)a; return b;}
+static double less(double a, double b) {return a < b;}
+static double less_equal(double a, double b) {return a <= b;}
+static double greater(double a, double b) {return a > b;}
+static double greater_equal(double a, double b) {return a >= b;}
+static double equal(double a, double b) {return a == b;}
+static double not_equal(double a, double b) {return a != b;}
+/* The tokens for && and ||, which the parser turns into TE_IF nodes. */
+static double logical_and(double a, double b) {return a != 0 && b != 0;}
+static double logical_or(double a, double b) {return a != 0 || b != 0;}
+/* Chains the expressions of te_compile_many. It isn't pure, so cse never merges two links. */
+static double join(double a, double b) {(void)a; return b;}
 static double bitwise_and(double a, double b) {
 	if (!is_valid_bitwise_operand(a) || !is_valid_bitwise_operand(b)) return NAN;
 	int64_t ia = (int64_t)round(a);
@@ -342,10 +1153,87 @@ static double bitwise_or(double a, double b) {
 	return ia | ib;
 }
 
-void next_token(state *s) {
+/* Forms of the bitwise builtins for operands that prove showed to be integers */
+/* from 0 to 2^53-1, and for bit an index below 53. The _right forms only check a. */
+static double bitwise_and_right(double a, double b) {
+    return is_valid_bitwise_operand(a) ? (double)((int64_t)round(a) & (int64_t)b) : NAN;
+}
+static double bitwise_and_proven(double a, double b) {return (double)((int64_t)a & (int64_t)b);}
+static double bitwise_or_right(double a, double b) {
+    return is_valid_bitwise_operand(a) ? (double)((int64_t)round(a) | (int64_t)b) : NAN;
+}
+static double bitwise_or_proven(double a, double b) {return (double)((int64_t)a | (int64_t)b);}
+static double xor_right(double a, double b) {
+    return is_valid_bitwise_operand(a) ? (double)((int64_t)round(a) ^ (int64_t)b) : NAN;
+}
+static double xor_proven(double a, double b) {return (double)((int64_t)a ^ (int64_t)b);}
+static double bit_right(double n, double i) {
+    return is_valid_bitwise_operand(n) ? (double)(((int64_t)round(n) >> (int)i) & 1) : NAN;
+}
+static double bit_proven(double n, double i) {return (double)(((int64_t)n >> (int)i) & 1);}
+
+static int followed_by(state *s, char c) {
+    /* Consumes c if it comes next, for the two-character operators. */
+    if (s->next[0] != c) return 0;
+    ++s->next;
+    return 1;
+}
+
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static int read_decimal(state *s) {
+    /* Reads a decimal number the way strtod would, if its digits make an integer */
+    /* of at most 2^53 and its power of ten is at most 22 either way: both are then */
+    /* exact doubles, so one multiply or divide rounds to the same nearest double. */
+    /* Returns 0, reading nothing, for strtod to handle anything else. */
+#if defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD == 0 || FLT_EVAL_METHOD == 1)
+    const char *p = s->next;
+    unsigned long long digits = 0;
+    int count = 0, scale = 0;
+
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) return 0;
+    for (; *p >= '0' && *p <= '9'; ++p, ++count) digits = digits * 10 + (*p - '0');
+    if (*p == '.') {
+        for (++p; *p >= '0' && *p <= '9'; ++p, ++count, --scale) digits = digits * 10 + (*p - '0');
+    }
+    if (count == 0 || count > 19 || digits > 1ULL << 53) return 0;
+
+    if (*p == 'e' || *p == 'E') {
+        /* An exponent without digits is left for the next token, as strtod leaves it. */
+        const char *e = p + 1 + (p[1] == '+' || p[1] == '-');
+        int exponent = 0;
+        if (*e >= '0' && *e <= '9') {
+            for (; *e >= '0' && *e <= '9'; ++e) if (exponent < 1000) exponent = exponent * 10 + (*e - '0');
+            scale += p[1] == '-' ? -exponent : exponent;
+            p = e;
+        }
+    }
+    if (scale < -22 || scale > 22) return 0;
+
+    s->value = scale < 0 ? (double)digits / powers_of_ten[-scale] : (double)digits * powers_of_ten[scale];
+    s->next = p;
+    return 1;
+#else
+    (void)s;
+    return 0;
+#endif
+}
+
+
+static int is_name_start(char c) {return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');}
+static int is_name_char(char c) {return is_name_start(c) || (c >= '0' && c <= '9') || c == '_';}
+
+
+static void read_token(state *s) {
     s->type = TOK_NULL;
 
     do {
+        while (*s->next == ' ' || *s->next == '\t' || *s->next == '\n' || *s->next == '\r') ++s->next;
 
         if (!*s->next){
             s->type = TOK_END;
@@ -354,26 +1242,28 @@ void next_token(state *s) {
 
         /* Try reading a number. */
         if ((s->next[0] >= '0' && s->next[0] <= '9') || s->next[0] == '.') {
-            s->value = strtod(s->next, (char**)&s->next);
+            if (!read_decimal(s)) s->value = strtod(s->next, (char**)&s->next);
             s->type = TOK_NUMBER;
         } else {
             /* Look for a variable or builtin function call. */
-            if (isalpha(s->next[0])) {
-                const char *start;
-                start = s->next;
-                while (isalpha(s->next[0]) || isdigit(s->next[0]) || (s->next[0] == '_')) s->next++;
-                
+            if (is_name_start(s->next[0])) {
+                const char *start = s->next;
+                unsigned hash = 0;
+                for (; is_name_char(s->next[0]); ++s->next) hash = hash * 31 + (unsigned char)s->next[0];
+
                 const te_variable *var = find_lookup(s, start, s->next - start);
-                if (!var) var = find_builtin(start, s->next - start);
+                if (!var) var = find_builtin(start, s->next - start, hash);
 
                 if (!var) {
                     s->type = TOK_ERROR;
                 } else {
                     switch(TYPE_MASK(var->type))
                     {
-                        case TE_VARIABLE:
+                        case TE_VARIABLE: case TE_VIEW:
                             s->type = TOK_VARIABLE;
                             s->bound = var->address;
+                            s->view = TYPE_MASK(var->type) == TE_VIEW;
+                            s->immutable = (var->type & TE_FLAG_IMMUTABLE) != 0;
                             break;
 
                         case TE_CLOSURE0: case TE_CLOSURE1: case TE_CLOSURE2: case TE_CLOSURE3:         /* Falls through. */
@@ -382,7 +1272,8 @@ void next_token(state *s) {
 
                         case TE_FUNCTION0: case TE_FUNCTION1: case TE_FUNCTION2: case TE_FUNCTION3:     /* Falls through. */
                         case TE_FUNCTION4: case TE_FUNCTION5: case TE_FUNCTION6: case TE_FUNCTION7:     /* Falls through. */
-                            s->type = var->type;
+                            s->vector = vector_of(var);
+                            s->type = s->vector ? var->type : var->type & ~TE_FLAG_VECTOR;
                             s->function = var->address;
                             break;
                     }
@@ -397,8 +1288,12 @@ void next_token(state *s) {
                     case '/': s->type = TOK_INFIX; s->function = divide; break;
                     case '^': s->type = TOK_INFIX; s->function = pow; break;
                     case '%': s->type = TOK_INFIX; s->function = fmod; break;
-                    case '&': s->type = TOK_INFIX; s->function = bitwise_and; break;
-                    case '|': s->type = TOK_INFIX; s->function = bitwise_or; break;
+                    case '&': s->type = TOK_INFIX; s->function = followed_by(s, '&') ? logical_and : bitwise_and; break;
+                    case '|': s->type = TOK_INFIX; s->function = followed_by(s, '|') ? logical_or : bitwise_or; break;
+                    case '<': s->type = TOK_INFIX; s->function = followed_by(s, '=') ? less_equal : less; break;
+                    case '>': s->type = TOK_INFIX; s->function = followed_by(s, '=') ? greater_equal : greater; break;
+                    case '=': s->type = followed_by(s, '=') ? TOK_INFIX : TOK_ERROR; s->function = equal; break;
+                    case '!': s->type = followed_by(s, '=') ? TOK_INFIX : TOK_ERROR; s->function = not_equal; break;
                     case '(': s->type = TOK_OPEN; break;
                     case ')': s->type = TOK_CLOSE; break;
                     case '[': s->type = TOK_OPEN_BRACKET; break;
@@ -413,41 +1308,143 @@ void next_token(state *s) {
 }
 
 
+void next_token(state *s) {
+#ifdef TE_PROFILE
+    const unsigned long long start = TICKS();
+    read_token(s);
+    s->tokenize += TICKS() - start;
+#else
+    read_token(s);
+#endif
+}
+
+
 static te_expr *list(state *s);
-static te_expr *expr(state *s);
+static te_expr *test(state *s);
 static te_expr *power(state *s);
 
+static const double *address(const te_expr *n, const char *frame) {
+    /* Variables and arrays live at their bound pointer, or at their offset into the frame. */
+    switch (TYPE_MASK(n->type)) {
+        case TE_VARIABLE: case TE_ARRAY: return n->bound;
+        case TE_SLOT: case TE_SLOT_ARRAY: return frame ? (const double*)(frame + n->offset) : 0;
+        default: return 0;
+    }
+}
+
+
+static int array_span(const te_expr *n, const char *frame, span *a) {
+    /* Finds the elements of an array or view. Frame arrays have none without a frame. */
+    if (TYPE_MASK(n->type) == TE_VIEW || TYPE_MASK(n->type) == TE_VIEW_ARRAY) {
+        *a = view_span(n->view);
+        return 1;
+    }
+    const double *arr = address(n, frame);
+    if (arr) *a = prefix_span(arr);
+    return arr != 0;
+}
+
+
+static void reduce_node(const te_expr *n, const char *frame, double *out) {
+    /* Makes the fused pass of a TE_REDUCE node, writing its statistics to out. */
+    span a;
+    if (array_span(n->parameters[0], frame, &a)) reduce_stats(&a, REDUCE_STATS(n->type), out);
+}
+
+
+static te_expr *node(state *s, const int type, const te_expr *parameters[]) {
+    /* Same as new_expr, but from the arena if s has one. */
+    if (!s->arena) return new_expr(type, parameters);
+    const int size = PACKED_SIZE(type);
+    if (s->arena_size - s->arena_used < size) {
+        s->arena_full = 1;
+        return 0;
+    }
+    te_expr *ret = (te_expr*)(s->arena + s->arena_used);
+    s->arena_used += size;
+    memset(ret, 0, node_size(type));
+    if (ARITY(type) && parameters) memcpy(ret->parameters, parameters, sizeof(void*) * ARITY(type));
+    ret->type = type;
+    return ret;
+}
+
+#define NODE(s, type, ...) node((s), (type), (const te_expr*[]){__VA_ARGS__})
+
+
+static void discard(const state *s, te_expr *n) {
+    /* Same as te_free, but arena nodes go with their arena. */
+    if (!s->arena) te_free(n);
+}
+
+
+static void release(const state *s, te_expr *n) {
+    /* Frees n alone, keeping its children. */
+    if (!s->arena) free(n);
+}
+
+
+static int bare_array(const te_expr *n) {
+    /* Array builtins take a bare array variable, e.g. sum(myArr), as does indexing. */
+    const int type = n->type & ~TE_FLAG_IMMUTABLE;
+    return type == TE_VARIABLE || type == TE_SLOT || type == TE_VIEW;
+}
+
+
 /*
  * Handle array-lookup postfix: VAR [ expr ].
  * Only variables may be indexed.
  */
 static te_expr *parse_postfix(state *s, te_expr *left) {
     while (s->type == TOK_OPEN_BRACKET) {
-        if (TYPE_MASK(left->type) != TE_VARIABLE) {
+        if (!bare_array(left)) {
             /* left-hand must be a variable */
-            te_free(left);
+            discard(s, left);
             s->type = TOK_ERROR;
             return NULL;
         }
         next_token(s); /* skip '[' */
         te_expr *idx = list(s);
         if (!idx || s->type != TOK_CLOSE_BRACKET) {
-            te_free(idx);
-            te_free(left);
+            discard(s, idx);
+            discard(s, left);
             s->type = TOK_ERROR;
             return NULL;
         }
         next_token(s); /* skip ']' */
         const te_expr *params[1] = { idx };
-        te_expr *node = new_expr(TE_ARRAY, params);
-        CHECK_NULL(node, te_free(idx));
-        node->bound = left->bound;
-        te_free(left);
-        left = node;
+        const int kind = left->type == TE_SLOT ? TE_SLOT_ARRAY : TYPE_MASK(left->type) == TE_VIEW ? TE_VIEW_ARRAY : TE_ARRAY;
+        te_expr *indexed = node(s, kind | (left->type & TE_FLAG_IMMUTABLE), params);
+        CHECK_NULL(indexed, discard(s, idx));
+        if (left->type == TE_SLOT) indexed->offset = left->offset; else indexed->bound = left->bound;
+        discard(s, left);
+        left = indexed;
     }
     return left;
 }
 
+static int immutable(const te_expr *n) {
+    /* Whether n is a variable bound with TE_FLAG_IMMUTABLE, or an index into one, */
+    /* which the parser and te_load mark as they bind it. */
+    return (n->type & TE_FLAG_IMMUTABLE) != 0;
+}
+
+
+static te_expr *lerp_node(state *s, te_expr *call) {
+    /* Turns a call of linear_interpolate into a TE_LERP node. */
+    te_expr *d = call->parameters[0], *r = call->parameters[1];
+    te_expr *ret = NODE(s, TE_LERP | TE_FLAG_PURE, d, r, call->parameters[2]);
+    CHECK_NULL(ret, discard(s, call));
+    release(s, call);
+
+    /* An immutable table can have its slopes worked out now. */
+    span domain, range;
+    if (immutable(d) && immutable(r) && array_span(d, 0, &domain) && array_span(r, 0, &range)) {
+        ret->parameters[3] = lerp_slopes(&domain, &range);
+    }
+    return ret;
+}
+
+
 static te_expr *base(state *s) {
     /* <base>      =    <constant> | <variable> | <function-0> {"(" ")"} | <function-1> <power> | <function-X> "(" <expr> {"," <expr>} ")" | "(" <list> ")" */
     te_expr *ret;
@@ -455,7 +1452,7 @@ static te_expr *base(state *s) {
 
     switch (TYPE_MASK(s->type)) {
         case TOK_NUMBER:
-            ret = new_expr(TE_CONSTANT, 0);
+            ret = node(s, TE_CONSTANT, 0);
             CHECK_NULL(ret);
 
             ret->value = s->value;
@@ -463,21 +1460,27 @@ static te_expr *base(state *s) {
             break;
 
         case TOK_VARIABLE:
-            ret = new_expr(TE_VARIABLE, 0);
+            ret = node(s, (s->view ? TE_VIEW : TE_VARIABLE) | (s->immutable ? TE_FLAG_IMMUTABLE : 0), 0);
             CHECK_NULL(ret);
 
             ret->bound = s->bound;
+            if (!s->view && s->frame && (const char*)s->bound >= s->frame
+                && (const char*)s->bound + sizeof(double) <= s->frame + s->frame_size) {
+                ret->type = TE_SLOT;
+                ret->offset = (int)((const char*)s->bound - s->frame);
+            }
             next_token(s);
 						ret = parse_postfix(s, ret);
             break;
 
         case TE_FUNCTION0:
         case TE_CLOSURE0:
-            ret = new_expr(s->type, 0);
+            ret = node(s, s->type, 0);
             CHECK_NULL(ret);
 
             ret->function = s->function;
             if (IS_CLOSURE(s->type)) ret->parameters[0] = s->context;
+            if (s->type & TE_FLAG_VECTOR) VECTOR(ret) = s->vector;
             next_token(s);
             if (s->type == TOK_OPEN) {
                 next_token(s);
@@ -491,14 +1494,19 @@ static te_expr *base(state *s) {
 
         case TE_FUNCTION1:
         case TE_CLOSURE1:
-            ret = new_expr(s->type, 0);
+            ret = node(s, s->type, 0);
             CHECK_NULL(ret);
 
             ret->function = s->function;
             if (IS_CLOSURE(s->type)) ret->parameters[1] = s->context;
+            if (s->type & TE_FLAG_VECTOR) VECTOR(ret) = s->vector;
             next_token(s);
             ret->parameters[0] = power(s);
-            CHECK_NULL(ret->parameters[0], te_free(ret));
+            CHECK_NULL(ret->parameters[0], discard(s, ret));
+            if (array_function(ret->function)) {
+                if (!bare_array(ret->parameters[0])) s->type = TOK_ERROR;
+                ret->type = TE_AGGREGATE | TE_FLAG_PURE;
+            }
             break;
 
         case TE_FUNCTION2: case TE_FUNCTION3: case TE_FUNCTION4:
@@ -507,11 +1515,12 @@ static te_expr *base(state *s) {
         case TE_CLOSURE5: case TE_CLOSURE6: case TE_CLOSURE7:
             arity = ARITY(s->type);
 
-            ret = new_expr(s->type, 0);
+            ret = node(s, s->type, 0);
             CHECK_NULL(ret);
 
             ret->function = s->function;
             if (IS_CLOSURE(s->type)) ret->parameters[arity] = s->context;
+            if (s->type & TE_FLAG_VECTOR) VECTOR(ret) = s->vector;
             next_token(s);
 
             if (s->type != TOK_OPEN) {
@@ -520,8 +1529,8 @@ static te_expr *base(state *s) {
                 int i;
                 for(i = 0; i < arity; i++) {
                     next_token(s);
-                    ret->parameters[i] = expr(s);
-                    CHECK_NULL(ret->parameters[i], te_free(ret));
+                    ret->parameters[i] = test(s);
+                    CHECK_NULL(ret->parameters[i], discard(s, ret));
 
                     if(s->type != TOK_SEP) {
                         break;
@@ -529,8 +1538,14 @@ static te_expr *base(state *s) {
                 }
                 if(s->type != TOK_CLOSE || i != arity - 1) {
                     s->type = TOK_ERROR;
+                } else if ((ret->function == (const void*)te_dot || ret->function == (const void*)te_lerp) &&
+                           (!bare_array(ret->parameters[0]) || !bare_array(ret->parameters[1]))) {
+                    s->type = TOK_ERROR;
                 } else {
                     next_token(s);
+                    if (ret->function == (const void*)te_dot) ret->type = TE_DOT | TE_FLAG_PURE;
+                    if (ret->function == (const void*)te_lerp) ret = lerp_node(s, ret);
+                    if (ret && ret->function == (const void*)fn_if) ret->type = TE_IF | TE_FLAG_PURE;
                 }
             }
 
@@ -549,7 +1564,7 @@ static te_expr *base(state *s) {
             break;
 
         default:
-            ret = new_expr(0, 0);
+            ret = node(s, 0, 0);
             CHECK_NULL(ret);
 
             s->type = TOK_ERROR;
@@ -577,8 +1592,8 @@ static te_expr *power(state *s) {
         te_expr *b = base(s);
         CHECK_NULL(b);
 
-        ret = NEW_EXPR(TE_FUNCTION1 | TE_FLAG_PURE, b);
-        CHECK_NULL(ret, te_free(b));
+        ret = NODE(s, TE_FUNCTION1 | TE_FLAG_PURE, b);
+        CHECK_NULL(ret, discard(s, b));
 
         ret->function = negate;
     }
@@ -596,7 +1611,7 @@ static te_expr *factor(state *s) {
 
     if (ret->type == (TE_FUNCTION1 | TE_FLAG_PURE) && ret->function == negate) {
         te_expr *se = ret->parameters[0];
-        free(ret);
+        release(s, ret);
         ret = se;
         neg = 1;
     }
@@ -610,21 +1625,21 @@ static te_expr *factor(state *s) {
         if (insertion) {
             /* Make exponentiation go right-to-left. */
             te_expr *p = power(s);
-            CHECK_NULL(p, te_free(ret));
+            CHECK_NULL(p, discard(s, ret));
 
-            te_expr *insert = NEW_EXPR(TE_FUNCTION2 | TE_FLAG_PURE, insertion->parameters[1], p);
-            CHECK_NULL(insert, te_free(p), te_free(ret));
+            te_expr *insert = NODE(s, TE_FUNCTION2 | TE_FLAG_PURE, insertion->parameters[1], p);
+            CHECK_NULL(insert, discard(s, p), discard(s, ret));
 
             insert->function = t;
             insertion->parameters[1] = insert;
             insertion = insert;
         } else {
             te_expr *p = power(s);
-            CHECK_NULL(p, te_free(ret));
+            CHECK_NULL(p, discard(s, ret));
 
             te_expr *prev = ret;
-            ret = NEW_EXPR(TE_FUNCTION2 | TE_FLAG_PURE, ret, p);
-            CHECK_NULL(ret, te_free(p), te_free(prev));
+            ret = NODE(s, TE_FUNCTION2 | TE_FLAG_PURE, ret, p);
+            CHECK_NULL(ret, discard(s, p), discard(s, prev));
 
             ret->function = t;
             insertion = ret;
@@ -633,8 +1648,8 @@ static te_expr *factor(state *s) {
 
     if (neg) {
         te_expr *prev = ret;
-        ret = NEW_EXPR(TE_FUNCTION1 | TE_FLAG_PURE, ret);
-        CHECK_NULL(ret, te_free(prev));
+        ret = NODE(s, TE_FUNCTION1 | TE_FLAG_PURE, ret);
+        CHECK_NULL(ret, discard(s, prev));
 
         ret->function = negate;
     }
@@ -651,11 +1666,11 @@ static te_expr *factor(state *s) {
         te_fun2 t = s->function;
         next_token(s);
         te_expr *p = power(s);
-        CHECK_NULL(p, te_free(ret));
+        CHECK_NULL(p, discard(s, ret));
 
         te_expr *prev = ret;
-        ret = NEW_EXPR(TE_FUNCTION2 | TE_FLAG_PURE, ret, p);
-        CHECK_NULL(ret, te_free(p), te_free(prev));
+        ret = NODE(s, TE_FUNCTION2 | TE_FLAG_PURE, ret, p);
+        CHECK_NULL(ret, discard(s, p), discard(s, prev));
 
         ret->function = t;
     }
@@ -677,11 +1692,11 @@ static te_expr *term(state *s) {
         te_fun2 t = s->function;
         next_token(s);
         te_expr *f = factor(s);
-        CHECK_NULL(f, te_free(ret));
+        CHECK_NULL(f, discard(s, ret));
 
         te_expr *prev = ret;
-        ret = NEW_EXPR(TE_FUNCTION2 | TE_FLAG_PURE, ret, f);
-        CHECK_NULL(ret, te_free(f), te_free(prev));
+        ret = NODE(s, TE_FUNCTION2 | TE_FLAG_PURE, ret, f);
+        CHECK_NULL(ret, discard(s, f), discard(s, prev));
 
         ret->function = t;
     }
@@ -699,11 +1714,11 @@ static te_expr *expr(state *s) {
         te_fun2 t = s->function;
         next_token(s);
         te_expr *te = term(s);
-        CHECK_NULL(te, te_free(ret));
+        CHECK_NULL(te, discard(s, ret));
 
         te_expr *prev = ret;
-        ret = NEW_EXPR(TE_FUNCTION2 | TE_FLAG_PURE, ret, te);
-        CHECK_NULL(ret, te_free(te), te_free(prev));
+        ret = NODE(s, TE_FUNCTION2 | TE_FLAG_PURE, ret, te);
+        CHECK_NULL(ret, discard(s, te), discard(s, prev));
 
         ret->function = t;
     }
@@ -712,83 +1727,193 @@ static te_expr *expr(state *s) {
 }
 
 
-static te_expr *list(state *s) {
-    /* <list>      =    <expr> {"," <expr>} */
+static te_expr *comparison(state *s) {
+    /* <comparison> =   <expr> {("<" | "<=" | ">" | ">=") <expr>} */
     te_expr *ret = expr(s);
     CHECK_NULL(ret);
 
-    while (s->type == TOK_SEP) {
+    while (s->type == TOK_INFIX && (s->function == less || s->function == less_equal ||
+            s->function == greater || s->function == greater_equal)) {
+        te_fun2 t = s->function;
         next_token(s);
         te_expr *e = expr(s);
-        CHECK_NULL(e, te_free(ret));
+        CHECK_NULL(e, discard(s, ret));
 
         te_expr *prev = ret;
-        ret = NEW_EXPR(TE_FUNCTION2 | TE_FLAG_PURE, ret, e);
-        CHECK_NULL(ret, te_free(e), te_free(prev));
+        ret = NODE(s, TE_FUNCTION2 | TE_FLAG_PURE, ret, e);
+        CHECK_NULL(ret, discard(s, e), discard(s, prev));
 
-        ret->function = comma;
+        ret->function = t;
     }
 
     return ret;
 }
 
 
-#define TE_FUN(...) ((double(*)(__VA_ARGS__))n->function)
-#define M(e) te_eval(n->parameters[e])
+static te_expr *equality(state *s) {
+    /* <equality>  =    <comparison> {("==" | "!=") <comparison>} */
+    te_expr *ret = comparison(s);
+    CHECK_NULL(ret);
 
+    while (s->type == TOK_INFIX && (s->function == equal || s->function == not_equal)) {
+        te_fun2 t = s->function;
+        next_token(s);
+        te_expr *c = comparison(s);
+        CHECK_NULL(c, discard(s, ret));
 
-double te_eval(const te_expr *n) {
+        te_expr *prev = ret;
+        ret = NODE(s, TE_FUNCTION2 | TE_FLAG_PURE, ret, c);
+        CHECK_NULL(ret, discard(s, c), discard(s, prev));
+
+        ret->function = t;
+    }
+
+    return ret;
+}
+
+
+static te_expr *logical(state *s, te_expr *a, te_expr *b, int is_and) {
+    /* a && b is if(a, b != 0, 0), and a || b is if(a, 1, b != 0). */
+    /* Takes ownership of a and b. */
+    te_expr *zero = node(s, TE_CONSTANT, 0), *known = node(s, TE_CONSTANT, 0);
+    te_expr *truth = zero ? NODE(s, TE_FUNCTION2 | TE_FLAG_PURE, b, zero) : 0;
+    te_expr *ret = truth && known ? NODE(s, TE_IF | TE_FLAG_PURE, a, is_and ? truth : known, is_and ? known : truth) : 0;
+    if (!ret) {
+        discard(s, a);
+        discard(s, known);
+        if (truth) discard(s, truth); else { discard(s, b); discard(s, zero); }
+        return 0;
+    }
+    ret->function = fn_if;
+    zero->value = 0;
+    truth->function = not_equal;
+    known->value = !is_and;
+    return ret;
+}
+
+
+static te_expr *conjunction(state *s) {
+    /* <conjunction> =  <equality> {"&&" <equality>} */
+    te_expr *ret = equality(s);
+    CHECK_NULL(ret);
+
+    while (s->type == TOK_INFIX && s->function == logical_and) {
+        next_token(s);
+        te_expr *e = equality(s);
+        CHECK_NULL(e, discard(s, ret));
+        ret = logical(s, ret, e, 1);
+        CHECK_NULL(ret);
+    }
+
+    return ret;
+}
+
+
+static te_expr *test(state *s) {
+    /* <test>      =    <conjunction> {"||" <conjunction>} */
+    te_expr *ret = conjunction(s);
+    CHECK_NULL(ret);
+
+    while (s->type == TOK_INFIX && s->function == logical_or) {
+        next_token(s);
+        te_expr *e = conjunction(s);
+        CHECK_NULL(e, discard(s, ret));
+        ret = logical(s, ret, e, 0);
+        CHECK_NULL(ret);
+    }
+
+    return ret;
+}
+
+
+static te_expr *list(state *s) {
+    /* <list>      =    <test> {"," <test>} */
+    te_expr *ret = test(s);
+    CHECK_NULL(ret);
+
+    while (s->type == TOK_SEP) {
+        next_token(s);
+        te_expr *e = test(s);
+        CHECK_NULL(e, discard(s, ret));
+
+        te_expr *prev = ret;
+        ret = NODE(s, TE_FUNCTION2 | TE_FLAG_PURE, ret, e);
+        CHECK_NULL(ret, discard(s, e), discard(s, prev));
+
+        ret->function = comma;
+    }
+
+    return ret;
+}
+
+
+#define TE_FUN(...) ((double(*)(__VA_ARGS__))n->function)
+#define M(e) eval(n->parameters[e], frame, temps)
+
+
+#ifdef TE_PROFILE
+static double eval_node(const te_expr *n, const char *frame, double *temps);
+
+static double eval(const te_expr *n, const char *frame, double *temps) {
+    /* Times n's subtree, its children's own calls included. */
+    if (!n) return NAN;
+    const unsigned long long start = TICKS();
+    const double ret = eval_node(n, frame, temps);
+    PROFILE_ADD(&STATS(n)->ticks, TICKS() - start);
+    PROFILE_ADD(&STATS(n)->count, 1);
+    return ret;
+}
+#else
+#define eval_node eval
+#endif
+
+static int64_t ieval(const te_expr *n, const char *frame, double *temps);
+static double from_bits(int64_t v) {return v < 0 ? NAN : (double)v;}
+
+static double eval_node(const te_expr *n, const char *frame, double *temps) {
+    /* Writes nothing but temps (and counters, with TE_PROFILE), so any number of threads can share n. */
     if (!n) return NAN;
 
     switch(TYPE_MASK(n->type)) {
         case TE_CONSTANT: return n->value;
         case TE_VARIABLE: return *n->bound;
-        case TE_ARRAY: {
-            /* arr[0]=length; arr[1..length]=values */
-            const double *arrv = n->bound;
-            int len = (int)arrv[0];
-            int idx = (int)te_eval(n->parameters[0]);
-            if (idx < 0 || idx >= len) return NAN;
-            return arrv[idx + 1];
-        }
-
-				if(0){
-				case TE_FUNCTION3:
-            if (n->function == (const void*)te_lerp){
-                te_expr *d = n->parameters[0];
-                te_expr *r = n->parameters[1];
-                double   x = te_eval(n->parameters[2]);
-                if (d->type == TE_VARIABLE && r->type == TE_VARIABLE) {
-                    const double *domain = d->bound;
-                    const double *range  = r->bound;
-                    return te_lerp(domain, range, x);
-                }
-                return NAN;
-						}
-				}
-				if(0){
-				case TE_FUNCTION1:
-            if (n->function == (const void*)te_sum ||
-                n->function == (const void*)te_arrlen ||
-                n->function == (const void*)te_arrmin ||
-                n->function == (const void*)te_arrmax)
-            {
-                /* the direct argument must be a raw array variable
-                   e.g. sum(myArr) ; so parameter node is TE_VARIABLE */
-                te_expr *arg = n->parameters[0];
-                if (arg->type == TE_VARIABLE) {
-                    const double *arrp = arg->bound;
-                    if (n->function == (const void*)te_sum) return te_sum(arrp);
-                    if (n->function == (const void*)te_arrmin) return te_arrmin(arrp);
-                    if (n->function == (const void*)te_arrlen) return te_arrlen(arrp);
-                    return te_arrmax(arrp);
-                }
-                return NAN;
+        case TE_SLOT: return frame ? *(const double*)(frame + n->offset) : NAN;
+        case TE_TEMP: return temps[n->offset];
+        case TE_LET: temps[n->offset] = M(0); return M(1);
+        case TE_VIEW: return NAN; /* A view only has elements. */
+        case TE_REDUCE: reduce_node(n, frame, temps + n->offset); return M(1);
+        case TE_BITWISE: return from_bits(ieval(n->parameters[0], frame, temps));
+        case TE_IF: return M(0) != 0 ? M(1) : M(2);
+        case TE_ARRAY: case TE_SLOT_ARRAY: case TE_VIEW_ARRAY: {
+            span a;
+            if (!array_span(n, frame, &a)) return NAN;
+            int idx = (int)M(0);
+            if (n->type & TE_FLAG_PROVEN) return AT(&a, idx);
+            if (idx < 0 || idx >= a.len) return NAN;
+            return AT(&a, idx);
+        }
+
+        case TE_LERP: {
+            double   x = M(2);
+            span domain, range;
+            if (array_span(n->parameters[0], frame, &domain) && array_span(n->parameters[1], frame, &range)) {
+                if (n->type & TE_FLAG_PROVEN) return lerp_segment(&domain, &range, n->parameters[3], x, LERP_HINT(&n->offset));
+                return lerp(&domain, &range, n->parameters[3], x, LERP_HINT(&n->offset));
             }
-            /* otherwise fall through into the normal TE_FUNCTION1 case */
-				}
+            return NAN;
+        }
 
-        case TE_FUNCTION0: case TE_FUNCTION2:
+        case TE_AGGREGATE: {
+            span a;
+            return array_span(n->parameters[0], frame, &a) ? TE_FUN(const span*)(&a) : NAN;
+        }
+
+        case TE_DOT: {
+            span a, b;
+            return array_span(n->parameters[0], frame, &a) && array_span(n->parameters[1], frame, &b) ? te_dot(&a, &b) : NAN;
+        }
+
+        case TE_FUNCTION0: case TE_FUNCTION1: case TE_FUNCTION2: case TE_FUNCTION3:
         case TE_FUNCTION4: case TE_FUNCTION5: case TE_FUNCTION6: case TE_FUNCTION7:
             switch(ARITY(n->type)) {
                 case 0: return TE_FUN(void)();
@@ -823,108 +1948,3693 @@ double te_eval(const te_expr *n) {
 
 #undef TE_FUN
 #undef M
+#undef eval_node
 
-static void optimize(te_expr *n) {
-    /* Evaluates as much as possible. */
-    if (n->type == TE_CONSTANT) return;
-    if (n->type == TE_VARIABLE) return;
 
-    /* Only optimize out functions flagged as pure. */
-    if (IS_PURE(n->type)) {
-        const int arity = ARITY(n->type);
-        int known = 1;
-        int i;
-        for (i = 0; i < arity; ++i) {
-            optimize(n->parameters[i]);
-            if (((te_expr*)(n->parameters[i]))->type != TE_CONSTANT) {
-                known = 0;
-            }
+double te_eval(const te_expr *n) {
+    double temps[TE_MAX_TEMPS];
+    return eval(n, 0, temps);
+}
+
+
+double te_eval_frame(const te_expr *n, const void *frame) {
+    double temps[TE_MAX_TEMPS];
+    return eval(n, frame, temps);
+}
+
+
+/* The builtin bitwise operators, which ieval works on int64_t, where -1 stands for NaN. */
+enum {BIT_NONE, BIT_AND, BIT_OR, BIT_XOR, BIT_BIT};
+
+/* Each operator's checked form, then its forms for a proven b, and for both operands proven. */
+static const void *const bitwise_forms[][3] = {
+    {0, 0, 0},
+    {bitwise_and, bitwise_and_right, bitwise_and_proven},
+    {bitwise_or, bitwise_or_right, bitwise_or_proven},
+    {fn_xor, xor_right, xor_proven},
+    {fn_bit, bit_right, bit_proven},
+};
+
+static int bitwise_op(const te_expr *n) {
+    /* Only the checked forms, which ieval works on; prove's forms are called as they are. */
+    if (TYPE_MASK(n->type) != TE_FUNCTION2) return BIT_NONE;
+    if (n->function == (const void*)bitwise_and) return BIT_AND;
+    if (n->function == (const void*)bitwise_or) return BIT_OR;
+    if (n->function == (const void*)fn_xor) return BIT_XOR;
+    if (n->function == (const void*)fn_bit) return BIT_BIT;
+    return BIT_NONE;
+}
+
+static int bitwise_form(const te_expr *n) {
+    /* The operator of any form in bitwise_forms. */
+    int op, i;
+    if (TYPE_MASK(n->type) != TE_FUNCTION2) return BIT_NONE;
+    for (op = BIT_AND; op <= BIT_BIT; ++op) {
+        for (i = 0; i < 3; ++i) if (n->function == bitwise_forms[op][i]) return op;
+    }
+    return BIT_NONE;
+}
+
+static int64_t to_bits(double x) {return is_valid_bitwise_operand(x) ? (int64_t)round(x) : -1;}
+
+static int64_t ieval(const te_expr *n, const char *frame, double *temps) {
+    /* Same as from_bits(ieval(n)) == eval(n), but an operand is only checked and */
+    /* rounded where it comes from a double, not between two bitwise operators. */
+    const int op = bitwise_op(n);
+    if (op == BIT_NONE) return to_bits(eval(n, frame, temps));
+
+    const int64_t a = ieval(n->parameters[0], frame, temps);
+    const int64_t b = ieval(n->parameters[1], frame, temps);
+    if (a < 0 || b < 0) return -1;
+    switch (op) {
+        case BIT_AND: return a & b;
+        case BIT_OR: return a | b;
+        case BIT_XOR: return a ^ b;
+        default: return b < MAX_BITWISE_WIDTH ? (a >> b) & 1 : -1;
+    }
+}
+
+static int pure_tree(const te_expr *n) {
+    /* Whether n can be evaluated twice, or not at all, without anyone noticing. */
+    int i;
+    switch (TYPE_MASK(n->type)) {
+        case TE_CONSTANT: case TE_VARIABLE: case TE_SLOT: case TE_VIEW: return 1;
+        case TE_ARRAY: case TE_SLOT_ARRAY: case TE_VIEW_ARRAY: break;
+        default: if (!IS_PURE(n->type)) return 0; break;
+    }
+    for (i = 0; i < ARITY(n->type); ++i) if (!pure_tree(n->parameters[i])) return 0;
+    return 1;
+}
+
+
+static te_expr *copy_tree(const te_expr *n) {
+    te_expr *ret = malloc(node_size(n->type));
+    int i;
+    CHECK_NULL(ret);
+
+    memcpy(ret, n, node_size(n->type));
+    if (slopes_size(n)) {
+        ret->parameters[3] = malloc(slopes_size(n));
+        CHECK_NULL(ret->parameters[3], free(ret));
+        memcpy(ret->parameters[3], n->parameters[3], slopes_size(n));
+    }
+    for (i = 0; i < ARITY(n->type); ++i) {
+        ret->parameters[i] = copy_tree(n->parameters[i]);
+        if (!ret->parameters[i]) {
+            while (i) te_free(ret->parameters[--i]);
+            if (slopes_size(n)) free(ret->parameters[3]);
+            free(ret);
+            return NULL;
+        }
+    }
+    return ret;
+}
+
+
+/* Node builders for the rewrites below. Each takes ownership of its arguments, */
+/* freeing them on failure, and passes NULL through. */
+
+static te_expr *call1(const void *function, te_expr *a) {
+    te_expr *ret = a ? NEW_EXPR(TE_FUNCTION1 | TE_FLAG_PURE, a) : 0;
+    CHECK_NULL(ret, te_free(a));
+    ret->function = function;
+    return ret;
+}
+
+
+static te_expr *call2(const void *function, te_expr *a, te_expr *b) {
+    te_expr *ret = a && b ? NEW_EXPR(TE_FUNCTION2 | TE_FLAG_PURE, a, b) : 0;
+    CHECK_NULL(ret, te_free(a), te_free(b));
+    ret->function = function;
+    return ret;
+}
+
+
+static te_expr *square(te_expr *a) {
+    return a ? call2(mul, a, copy_tree(a)) : 0;
+}
+
+
+static te_expr *reduce(te_expr *n, te_expr *keep) {
+    /* Frees n and all of its arguments but keep, and returns keep. */
+    int i;
+    for (i = 0; i < ARITY(n->type); ++i) {
+        if (n->parameters[i] != keep) te_free(n->parameters[i]);
+    }
+    free(n);
+    return keep;
+}
+
+
+static te_expr *rewrite(te_expr *n) {
+    /* Returns a cheaper equivalent of n, whose arguments are already rewritten. */
+    /* Whatever isn't kept is freed. Returns NULL when out of memory. */
+    te_expr *a, *b;
+
+    if (n->type == (TE_FUNCTION1 | TE_FLAG_PURE) && n->function == negate) {
+        /* -(-x) = x */
+        a = n->parameters[0];
+        if (a->type == (TE_FUNCTION1 | TE_FLAG_PURE) && a->function == negate) {
+            free(n);
+            return reduce(a, a->parameters[0]);
+        }
+        return n;
+    }
+
+    if (n->type != (TE_FUNCTION2 | TE_FLAG_PURE)) return n;
+    a = n->parameters[0];
+    b = n->parameters[1];
+
+    if ((n->function == add || n->function == mul) && a->type == TE_CONSTANT) {
+        /* Constants go on the right, where the rules below look for them. */
+        n->parameters[0] = b;
+        n->parameters[1] = a;
+        a = n->parameters[0];
+        b = n->parameters[1];
+    }
+    if (b->type != TE_CONSTANT) return n;
+    const double c = b->value;
+
+    if (n->function == pow) {
+        if (c == 1) return reduce(n, a);
+        if (c == 0 && pure_tree(a)) {
+            b->value = 1;
+            return reduce(n, b);
+        }
+        if (c == 2 && pure_tree(a)) return square(reduce(n, a));
+#ifdef TE_FAST_MATH
+        if (c == 0.5) return call1(sqrt, reduce(n, a));
+        if (c == 3 && pure_tree(a)) {
+            te_expr *x = reduce(n, a);
+            return call2(mul, square(copy_tree(x)), x);
+        }
+        if (c == 4 && pure_tree(a)) return square(square(reduce(n, a)));
+#endif
+        return n;
+    }
+
+    if (n->function == mul || n->function == divide) {
+        if (c == 1) return reduce(n, a);
+        if (c == -1) return call1(negate, reduce(n, a));
+    }
+
+    if (n->function == divide && c != 0 && isfinite(c)) {
+        /* Dividing by a power of two is exactly multiplying by its reciprocal. */
+        int exponent;
+        const double reciprocal = 1 / c;
+        int exact = fabs(frexp(c, &exponent)) == 0.5 && fpclassify(reciprocal) == FP_NORMAL;
+#ifdef TE_FAST_MATH
+        exact = isfinite(reciprocal);
+#endif
+        if (exact) {
+            n->function = mul;
+            b->value = reciprocal;
+        }
+    }
+
+    /* x-(+0) = x and x+(-0) = x, even when x is -0. */
+    if (n->function == sub && c == 0 && !signbit(c)) return reduce(n, a);
+    if (n->function == add && c == 0 && signbit(c)) return reduce(n, a);
+
+#ifdef TE_FAST_MATH
+    if (n->function == add && c == 0) return reduce(n, a);
+    if (n->function == sub) {
+        n->function = add;
+        b->value = -c;
+    }
+
+    /* (x+c1)+c2 = x+(c1+c2), and likewise for products. */
+    if ((n->function == add || n->function == mul)
+        && a->type == (TE_FUNCTION2 | TE_FLAG_PURE) && a->function == n->function
+        && ((te_expr*)a->parameters[1])->type == TE_CONSTANT) {
+        te_expr *c1 = a->parameters[1];
+        c1->value = n->function == add ? c1->value + b->value : c1->value * b->value;
+        return rewrite(reduce(n, a));
+    }
+#endif
+
+    return n;
+}
+
+
+static te_expr *optimize(te_expr *n) {
+    /* Evaluates as much as possible, then rewrites what's left, bottom up. */
+    /* Returns NULL when out of memory, having freed n. */
+    const int arity = ARITY(n->type);
+    int known = 1;
+    int i;
+    if (TYPE_MASK(n->type) == TE_IF) {
+        /* A known condition leaves only its branch, which may not even be pure. */
+        te_expr *c = n->parameters[0] = optimize(n->parameters[0]);
+        if (!c) {
+            te_free(n);
+            return NULL;
+        }
+        if (c->type == TE_CONSTANT) return optimize(reduce(n, n->parameters[c->value != 0 ? 1 : 2]));
+        known = 0;
+    }
+    for (i = TYPE_MASK(n->type) == TE_IF; i < arity; ++i) {
+        n->parameters[i] = optimize(n->parameters[i]);
+        if (!n->parameters[i]) {
+            te_free(n);
+            return NULL;
         }
-        if (known) {
-            const double value = te_eval(n);
-            te_free_parameters(n);
-            n->type = TE_CONSTANT;
-            n->value = value;
+        if (((te_expr*)(n->parameters[i]))->type != TE_CONSTANT) {
+            known = 0;
         }
     }
+
+    /* Only optimize out functions flagged as pure. */
+    if (IS_PURE(n->type) && known) {
+        const double value = te_eval(n);
+        te_free_parameters(n);
+        n->type = TE_CONSTANT;
+        n->value = value;
+        return n;
+    }
+
+    return rewrite(n);
 }
 
 
-te_expr *te_compile(const char *expression, const te_variable *variables, int var_count, int *error) {
-    state s;
-    s.start = s.next = expression;
-    s.lookup = variables;
-    s.lookup_len = var_count;
+typedef struct cse_entry {
+    unsigned hash;
+    int count, size;
+    te_expr *node;
+} cse_entry;
 
-    next_token(&s);
-    te_expr *root = list(&s);
-    if (root == NULL) {
-        if (error) *error = -1;
-        return NULL;
+
+static int count_nodes(const te_expr *n) {
+    int i, count = 1;
+    for (i = 0; i < ARITY(n->type); ++i) count += count_nodes(n->parameters[i]);
+    return count;
+}
+
+
+static unsigned hash_bytes(unsigned hash, const void *data, int size) {
+    /* FNV-1a. */
+    const unsigned char *p = data;
+    int i;
+    for (i = 0; i < size; ++i) hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+
+static int same_expr(const te_expr *a, const te_expr *b) {
+    int i;
+    if (a->type != b->type) return 0;
+
+    switch (TYPE_MASK(a->type)) {
+        case TE_CONSTANT: return memcmp(&a->value, &b->value, sizeof(double)) == 0;
+        case TE_VARIABLE: case TE_ARRAY: case TE_VIEW: case TE_VIEW_ARRAY: if (a->bound != b->bound) return 0; break;
+        case TE_SLOT: case TE_SLOT_ARRAY: case TE_TEMP: if (a->offset != b->offset) return 0; break;
+        default:
+            if (a->function != b->function) return 0;
+            if (IS_CLOSURE(a->type) && a->parameters[ARITY(a->type)] != b->parameters[ARITY(b->type)]) return 0;
+            if ((a->type & TE_FLAG_VECTOR) && VECTOR(a) != VECTOR(b)) return 0;
+            break;
     }
 
-    if (s.type != TOK_END) {
-        te_free(root);
-        if (error) {
-            *error = (s.next - s.start);
-            if (*error == 0) *error = 1;
+    for (i = 0; i < ARITY(a->type); ++i) {
+        if (!same_expr(a->parameters[i], b->parameters[i])) return 0;
+    }
+    return 1;
+}
+
+
+static int scan(te_expr *n, cse_entry *table, unsigned mask, unsigned *hash, int *size, int counted) {
+    /* Hashes n bottom up, and counts each subtree made only of pure operations, */
+    /* but not inside the branches of a TE_IF, whose subtrees may never run. */
+    /* Returns whether n is such a subtree. */
+    const int arity = ARITY(n->type);
+    int i, pure;
+
+    *hash = hash_bytes(2166136261u, &n->type, sizeof(int));
+    *size = 1;
+
+    switch (TYPE_MASK(n->type)) {
+        case TE_CONSTANT: *hash = hash_bytes(*hash, &n->value, sizeof(double)); return 1;
+        case TE_VARIABLE: case TE_VIEW: *hash = hash_bytes(*hash, &n->bound, sizeof(n->bound)); return 1;
+        case TE_SLOT: case TE_TEMP: *hash = hash_bytes(*hash, &n->offset, sizeof(int)); return 1;
+        case TE_ARRAY: case TE_VIEW_ARRAY: *hash = hash_bytes(*hash, &n->bound, sizeof(n->bound)); pure = 1; break;
+        case TE_SLOT_ARRAY: *hash = hash_bytes(*hash, &n->offset, sizeof(int)); pure = 1; break;
+        default:
+            /* Closures and functions not flagged pure may differ call to call. */
+            *hash = hash_bytes(*hash, &n->function, sizeof(n->function));
+            if (IS_CLOSURE(n->type)) *hash = hash_bytes(*hash, &n->parameters[arity], sizeof(void*));
+            pure = IS_PURE(n->type);
+            break;
+    }
+
+    for (i = 0; i < arity; ++i) {
+        unsigned h;
+        int s;
+        if (!scan(n->parameters[i], table, mask, &h, &s, counted && (i == 0 || TYPE_MASK(n->type) != TE_IF))) pure = 0;
+        *hash = hash_bytes(*hash, &h, sizeof(h));
+        *size += s;
+    }
+    if (!pure) return 0;
+    if (!counted) return 1;
+
+    cse_entry *e = table + (*hash & mask);
+    while (e->node && !(e->hash == *hash && same_expr(e->node, n))) {
+        e = table + ((e - table + 1) & mask);
+    }
+    if (!e->node) {
+        e->hash = *hash;
+        e->size = *size;
+        e->node = n;
+    }
+    ++e->count;
+    return 1;
+}
+
+
+static void replace(te_expr **slot, const te_expr *def, te_expr ***pool) {
+    /* Replaces each copy of def below slot with a temp from pool, detaching def itself. */
+    /* Like scan, it leaves the branches of an if alone. */
+    te_expr *n = *slot;
+    int i;
+    if (same_expr(n, def)) {
+        *slot = *(*pool)++;
+        if (n != def) te_free(n);
+        return;
+    }
+    for (i = 0; i < (TYPE_MASK(n->type) == TE_IF ? 1 : ARITY(n->type)); ++i) {
+        replace((te_expr**)&n->parameters[i], def, pool);
+    }
+}
+
+
+static void order_temps(const te_expr *n, te_expr *const *defs, char *seen, int *order, int *count) {
+    /* Lists the temps n reads, each after the temps its own definition reads. */
+    int i;
+    if (TYPE_MASK(n->type) == TE_TEMP && !seen[n->offset]) {
+        seen[n->offset] = 1;
+        order_temps(defs[n->offset], defs, seen, order, count);
+        order[(*count)++] = n->offset;
+    }
+    for (i = 0; i < ARITY(n->type); ++i) order_temps(n->parameters[i], defs, seen, order, count);
+}
+
+
+static void cse(te_expr **root) {
+    /* Evaluates each repeated pure subtree once, keeping it in a temp. */
+    /* The largest repeat is taken first, so nested repeats share one temp. */
+    te_expr *defs[TE_MAX_TEMPS], *lets[TE_MAX_TEMPS];
+    int count = 0, i;
+
+    while (count < TE_MAX_TEMPS) {
+        int nodes = count_nodes(*root);
+        for (i = 0; i < count; ++i) nodes += count_nodes(defs[i]);
+
+        unsigned mask = 1;
+        while (mask < (unsigned)nodes * 2) mask <<= 1;
+        cse_entry *table = calloc(mask, sizeof(cse_entry));
+        if (!table) break;
+        mask -= 1;
+
+        unsigned h;
+        int size;
+        scan(*root, table, mask, &h, &size, 1);
+        for (i = 0; i < count; ++i) scan(defs[i], table, mask, &h, &size, 1);
+
+        const cse_entry *best = 0;
+        unsigned j;
+        for (j = 0; j <= mask; ++j) {
+            if (table[j].count > 1 && (!best || table[j].size > best->size)) best = table + j;
         }
-        return 0;
-    } else {
-        optimize(root);
-        if (error) *error = 0;
-        return root;
+        te_expr *def = best ? best->node : 0;
+        const int uses = best ? best->count : 0;
+        free(table);
+        if (!def) break;
+
+        /* Allocate first, so replacing can't fail halfway. */
+        te_expr **pool = malloc(sizeof(te_expr*) * uses);
+        te_expr *let = new_expr(TE_LET, 0);
+        int allocated = 0;
+        while (pool && let && allocated < uses && (pool[allocated] = new_expr(TE_TEMP, 0))) {
+            pool[allocated++]->offset = count;
+        }
+        if (!pool || !let || allocated < uses) {
+            while (allocated) te_free(pool[--allocated]);
+            free(pool);
+            te_free(let);
+            break;
+        }
+
+        te_expr **next = pool;
+        replace(root, def, &next);
+        for (i = 0; i < count; ++i) replace(&defs[i], def, &next);
+        free(pool);
+
+        defs[count] = def;
+        lets[count++] = let;
+    }
+
+    /* Each definition goes before the temps that read it, outermost first. */
+    char seen[TE_MAX_TEMPS] = {0};
+    int order[TE_MAX_TEMPS], ordered = 0;
+    order_temps(*root, defs, seen, order, &ordered);
+
+    for (i = ordered - 1; i >= 0; --i) {
+        te_expr *let = lets[order[i]];
+        let->offset = order[i];
+        let->parameters[0] = defs[order[i]];
+        let->parameters[1] = *root;
+        *root = let;
     }
 }
 
 
-double te_interp(const char *expression, int *error) {
-    te_expr *n = te_compile(expression, 0, 0, error);
+static int temp_count(const te_expr *n);
 
-    double ret;
-    if (n) {
-        ret = te_eval(n);
-        te_free(n);
-    } else {
-        ret = NAN;
+
+static void find_reductions(te_expr *n, te_expr **found, int *count) {
+    /* Lists the calls that a fused pass could answer. */
+    int i;
+    if (TYPE_MASK(n->type) == TE_AGGREGATE && array_stat(n->function) &&
+        (TYPE_MASK(((const te_expr*)n->parameters[0])->type) == TE_VARIABLE || TYPE_MASK(((const te_expr*)n->parameters[0])->type) == TE_VIEW)) {
+        found[(*count)++] = n;
+        return;
     }
-    return ret;
+    /* A pass for a call in a branch would run whether or not the branch does. */
+    if (TYPE_MASK(n->type) == TE_IF) {
+        find_reductions(n->parameters[0], found, count);
+        return;
+    }
+    for (i = 0; i < ARITY(n->type); ++i) find_reductions(n->parameters[i], found, count);
 }
 
-static void pn (const te_expr *n, int depth) {
-    int i, arity;
-    printf("%*s", depth, "");
 
-    switch(TYPE_MASK(n->type)) {
-    case TE_CONSTANT: printf("%f\n", n->value); break;
-    case TE_VARIABLE: printf("bound %p\n", n->bound); break;
-    case TE_ARRAY: {
-            /* arr[0]=length; arr[1..length]=values */
-            const double *arrv = n->bound;
-            int len = (int)arrv[0];
-            int idx = (int)te_eval(n->parameters[0]);
-            if (idx < 0 || idx >= len) return NAN;
-            return arrv[idx + 1];
+static void fuse(te_expr **root) {
+    /* Answers the different reductions of one array from a single pass, e.g. */
+    /* arrmax(a) - arrmin(a) or sum(a) / variance(a), keeping them in temps. */
+    /* Runs after cse, so each call left is a different statistic. */
+    te_expr **found = malloc(sizeof(te_expr*) * count_nodes(*root));
+    int count = 0, i, j;
+    if (!found) return;
+    find_reductions(*root, found, &count);
+
+    for (i = 0; i < count; ++i) {
+        if (!found[i]) continue;
+        const te_expr *array = found[i]->parameters[0];
+        int stats = 0;
+        for (j = i; j < count; ++j) {
+            if (found[j] && same_expr(found[j]->parameters[0], array)) {
+                stats |= array_stat(found[j]->function);
+            }
         }
 
-    case TE_FUNCTION0: case TE_FUNCTION1: case TE_FUNCTION2: case TE_FUNCTION3:
-    case TE_FUNCTION4: case TE_FUNCTION5: case TE_FUNCTION6: case TE_FUNCTION7:
-    case TE_CLOSURE0: case TE_CLOSURE1: case TE_CLOSURE2: case TE_CLOSURE3:
-    case TE_CLOSURE4: case TE_CLOSURE5: case TE_CLOSURE6: case TE_CLOSURE7:
-         arity = ARITY(n->type);
-         printf("f%d", arity);
-         for(i = 0; i < arity; i++) {
-             printf(" %p", n->parameters[i]);
-         }
-         printf("\n");
-         for(i = 0; i < arity; i++) {
-             pn(n->parameters[i], depth + 1);
-         }
-         break;
+        const int base = temp_count(*root);
+        te_expr *reduce = 0;
+        if (stat_count(stats) > 1 && base + stat_count(stats) <= TE_MAX_TEMPS) {
+            reduce = new_expr(TE_REDUCE | (stats << 16), 0);
+        }
+
+        for (j = count - 1; j >= i; --j) {
+            te_expr *call = found[j];
+            if (!call || !same_expr(call->parameters[0], array)) continue;
+            found[j] = 0;
+            if (!reduce) continue;
+
+            /* The call becomes a read of its temp, keeping its array for the pass. */
+            const int stat = array_stat(call->function);
+            te_free(reduce->parameters[0]);
+            reduce->parameters[0] = call->parameters[0];
+            call->type = TE_TEMP;
+            call->offset = base + stat_count(stats & (stat - 1));
+        }
+
+        if (reduce) {
+            reduce->offset = base;
+            reduce->parameters[1] = *root;
+            *root = reduce;
+        }
     }
+    free(found);
 }
 
 
-void te_print(const te_expr *n) {
-    pn(n, 0);
+static void infer_bits(te_expr **n, int inside) {
+    /* Wraps each largest tree of bitwise operators, e.g. (a & b) | c, in a TE_BITWISE */
+    /* node, so its inner results stay integers. A lone operator saves nothing. */
+    const int op = bitwise_op(*n);
+    int i, nested = 0;
+    for (i = 0; i < ARITY((*n)->type); ++i) {
+        te_expr **child = (te_expr**)&(*n)->parameters[i];
+        nested |= op != BIT_NONE && bitwise_op(*child) != BIT_NONE;
+        infer_bits(child, op != BIT_NONE);
+    }
+    if (nested && !inside) {
+        te_expr *wrap = NEW_EXPR(TE_BITWISE | TE_FLAG_PURE, *n);
+        if (wrap) *n = wrap;
+    }
+}
+
+
+/* What prove knows of a value: it lies in [lo, hi], and is an integer if */
+/* integral, unless nan says that it may be NaN. */
+typedef struct value_range {
+    double lo, hi;
+    int nan, integral;
+} value_range;
+
+static value_range any_value(void) {
+    value_range r = {-INFINITY, INFINITY, 1, 0};
+    return r;
+}
+
+static value_range between(double lo, double hi, int integral) {
+    value_range r = {lo, hi, 0, integral};
+    return r;
+}
+
+static value_range exactly(double value) {
+    return isnan(value) ? any_value() : between(value, value, value == floor(value));
+}
+
+static int finite_range(const value_range *r) {
+    return !r->nan && isfinite(r->lo) && isfinite(r->hi);
+}
+
+static int valid_bits(const value_range *r, double limit) {
+    /* Whether every value is an integer the bitwise builtins take, up to limit. */
+    return !r->nan && r->integral && r->lo >= 0 && r->hi <= limit;
+}
+
+
+static value_range elements(const span *a, int from, int to) {
+    /* The range of the elements from index from to index to, both included. */
+    value_range r = between(INFINITY, -INFINITY, 1);
+    int i;
+    for (i = from; i <= to; ++i) {
+        const double v = AT(a, i);
+        if (isnan(v)) return any_value();
+        r.lo = fmin(r.lo, v);
+        r.hi = fmax(r.hi, v);
+        r.integral &= v == floor(v);
+    }
+    return r;
+}
+
+
+static value_range call_range(const te_expr *n, const value_range *r) {
+    /* The range of a builtin's result, for the builtins used to build indices. */
+    const void *f = n->function;
+    value_range ret;
+    if (TYPE_MASK(n->type) == TE_FUNCTION1) {
+        ret = r[0];
+        if (f == (const void*)negate) {
+            ret.lo = -r[0].hi;
+            ret.hi = -r[0].lo;
+        } else if (f == (const void*)floor || f == (const void*)ceil) {
+            ret.lo = f == (const void*)floor ? floor(r[0].lo) : ceil(r[0].lo);
+            ret.hi = f == (const void*)floor ? floor(r[0].hi) : ceil(r[0].hi);
+            ret.integral = 1;
+        } else if (f == (const void*)fabs) {
+            ret.lo = r[0].lo >= 0 ? r[0].lo : r[0].hi <= 0 ? -r[0].hi : 0;
+            ret.hi = fmax(fabs(r[0].lo), fabs(r[0].hi));
+        } else {
+            ret = any_value();
+        }
+        return ret;
+    }
+
+    if (TYPE_MASK(n->type) != TE_FUNCTION2) return any_value();
+    if (f == (const void*)less || f == (const void*)less_equal || f == (const void*)greater ||
+        f == (const void*)greater_equal || f == (const void*)equal || f == (const void*)not_equal) {
+        return between(0, 1, 1);
+    }
+    if (f == (const void*)comma || f == (const void*)join) return r[1];
+    if (!finite_range(&r[0]) || !finite_range(&r[1])) return any_value();
+
+    const int integral = r[0].integral && r[1].integral;
+    if (f == (const void*)add) return between(r[0].lo + r[1].lo, r[0].hi + r[1].hi, integral);
+    if (f == (const void*)sub) return between(r[0].lo - r[1].hi, r[0].hi - r[1].lo, integral);
+    if (f == (const void*)mul || (f == (const void*)divide && (r[1].lo > 0 || r[1].hi < 0))) {
+        const int product = f == (const void*)mul;
+        const double c[4] = {
+            product ? r[0].lo * r[1].lo : r[0].lo / r[1].lo, product ? r[0].lo * r[1].hi : r[0].lo / r[1].hi,
+            product ? r[0].hi * r[1].lo : r[0].hi / r[1].lo, product ? r[0].hi * r[1].hi : r[0].hi / r[1].hi};
+        return between(fmin(fmin(c[0], c[1]), fmin(c[2], c[3])), fmax(fmax(c[0], c[1]), fmax(c[2], c[3])),
+            product && integral);
+    }
+    if (f == (const void*)fmod && (r[1].lo > 0 || r[1].hi < 0)) {
+        /* The result takes a's sign, and is smaller than b. */
+        const double divisor = fmax(fabs(r[1].lo), fabs(r[1].hi));
+        const double dividend = fmax(fabs(r[0].lo), fabs(r[0].hi));
+        const double top = dividend < divisor ? dividend : nextafter(divisor, 0);
+        return between(r[0].lo >= 0 ? 0 : -top, r[0].hi <= 0 ? 0 : top, integral);
+    }
+    return any_value();
+}
+
+
+static value_range prove_bits(te_expr *n, value_range *r) {
+    /* Gives a bitwise builtin the form of bitwise_forms its operands allow, and its range. */
+    /* The operands of the others swap, if that proves b and they are pure. */
+    const int op = bitwise_form(n);
+    const double limit = op == BIT_BIT ? MAX_BITWISE_WIDTH - 1 : (double)MAX_BITWISE_VALUE;
+    int a = valid_bits(&r[0], (double)MAX_BITWISE_VALUE), b = valid_bits(&r[1], limit);
+    if (a && !b && op != BIT_BIT && pure_tree(n->parameters[0]) && pure_tree(n->parameters[1])) {
+        void *swap = n->parameters[0];
+        const value_range first = r[0];
+        n->parameters[0] = n->parameters[1];
+        n->parameters[1] = swap;
+        r[0] = r[1];
+        r[1] = first;
+        a = 0;
+        b = 1;
+    }
+    n->function = bitwise_forms[op][b ? 1 + a : 0];
+
+    value_range ret = between(0, op == BIT_BIT ? 1 : (double)MAX_BITWISE_VALUE, 1);
+    if (!a || !b) {
+        ret.nan = 1;
+    } else if (op == BIT_AND) {
+        ret.hi = fmin(r[0].hi, r[1].hi);
+    } else if (op != BIT_BIT) {
+        /* All the bits up to the highest one either might have. */
+        const double top = fmax(r[0].hi, r[1].hi);
+        for (ret.hi = 0; ret.hi < top; ret.hi = ret.hi * 2 + 1);
+    }
+    return ret;
+}
+
+
+static value_range prove(te_expr *n, value_range *temps) {
+    /* Works out the range of each subtree, from constants, comparisons and immutable */
+    /* arrays, and drops the checks it shows to be always passed: see TE_FLAG_PROVEN */
+    /* and bitwise_forms. temps holds the range of each temp. */
+    const int arity = ARITY(n->type);
+    value_range r[7], ret;
+    span a, b;
+    int i;
+
+    switch (TYPE_MASK(n->type)) {
+        case TE_CONSTANT: return exactly(n->value);
+        case TE_TEMP: return n->offset < TE_MAX_TEMPS ? temps[n->offset] : any_value();
+        case TE_LET:
+            r[0] = prove(n->parameters[0], temps);
+            if (n->offset < TE_MAX_TEMPS) temps[n->offset] = r[0];
+            return prove(n->parameters[1], temps);
+        case TE_REDUCE: {
+            double stats[7];
+            const int known = immutable(n->parameters[0]) && array_span(n->parameters[0], 0, &a);
+            if (known) reduce_stats(&a, REDUCE_STATS(n->type), stats);
+            for (i = 0; i < stat_count(REDUCE_STATS(n->type)) && n->offset + i < TE_MAX_TEMPS; ++i) {
+                temps[n->offset + i] = known ? exactly(stats[i]) : any_value();
+            }
+            return prove(n->parameters[1], temps);
+        }
+        default: break;
+    }
+
+    for (i = 0; i < arity; ++i) r[i] = prove(n->parameters[i], temps);
+
+    switch (TYPE_MASK(n->type)) {
+        case TE_BITWISE: return r[0];
+
+        case TE_IF:
+            ret = between(fmin(r[1].lo, r[2].lo), fmax(r[1].hi, r[2].hi), r[1].integral && r[2].integral);
+            ret.nan = r[1].nan || r[2].nan;
+            return ret;
+
+        case TE_ARRAY: case TE_VIEW_ARRAY:
+            /* Indices are truncated, so anything above -1 reads element 0. */
+            if (!immutable(n) || !array_span(n, 0, &a) || r[0].nan || !(r[0].lo > -1 && r[0].hi < a.len)) {
+                return any_value();
+            }
+            n->type |= TE_FLAG_PROVEN;
+            return elements(&a, (int)r[0].lo, (int)r[0].hi);
+
+        case TE_LERP:
+            /* Slopes are only worked out for a valid, immutable table. */
+            if (n->parameters[3] && !r[2].nan && array_span(n->parameters[0], 0, &a)) {
+                const double first = AT(&a, 0), last = AT(&a, a.len - 1);
+                if (r[2].lo >= fmin(first, last) && r[2].hi <= fmax(first, last)) n->type |= TE_FLAG_PROVEN;
+            }
+            return any_value();
+
+        case TE_AGGREGATE:
+            if (!immutable(n->parameters[0]) || !array_span(n->parameters[0], 0, &a)) return any_value();
+            return exactly(((double(*)(const span*))n->function)(&a));
+
+        case TE_DOT:
+            if (!immutable(n->parameters[0]) || !immutable(n->parameters[1]) ||
+                !array_span(n->parameters[0], 0, &a) || !array_span(n->parameters[1], 0, &b)) return any_value();
+            return exactly(te_dot(&a, &b));
+
+        case TE_FUNCTION1: case TE_FUNCTION2:
+            return bitwise_form(n) != BIT_NONE ? prove_bits(n, r) : call_range(n, r);
+
+        default: return any_value();
+    }
+}
+
+
+static void prove_tree(te_expr *n) {
+    value_range temps[TE_MAX_TEMPS];
+    int i;
+    for (i = 0; i < TE_MAX_TEMPS; ++i) temps[i] = any_value();
+    prove(n, temps);
+}
+
+
+static te_expr *parse(state *s, int *error) {
+#ifdef TE_PROFILE
+    const unsigned long long start = TICKS();
+    s->tokenize = 0;
+#endif
+    next_token(s);
+    te_expr *root = list(s);
+#ifdef TE_PROFILE
+    /* Parsing and tokenizing interleave, so parse time is the rest. */
+    const unsigned long long parsed = TICKS();
+    PROFILE_ADD(&compile_profile.tokenize, s->tokenize);
+    PROFILE_ADD(&compile_profile.parse, parsed - start - s->tokenize);
+    PROFILE_ADD(&compile_profile.compiles, 1);
+#endif
+    if (root == NULL) {
+        if (error) *error = -1;
+        return NULL;
+    }
+
+    if (s->type != TOK_END) {
+        discard(s, root);
+        if (error) {
+            *error = (s->next - s->start);
+            if (*error == 0) *error = 1;
+        }
+        return 0;
+    }
+    if (s->arena) return root; /* Its nodes can't be freed, so it is evaluated as it is. */
+
+    root = optimize(root);
+    if (root) prove_tree(root);
+#ifdef TE_PROFILE
+    PROFILE_ADD(&compile_profile.optimize, TICKS() - parsed);
+#endif
+    if (!root && error) *error = -1;
+    return root;
+}
+
+
+static te_expr *finish(te_expr *root, int *error) {
+#ifdef TE_PROFILE
+    const unsigned long long start = TICKS();
+#endif
+    cse(&root);
+    fuse(&root);
+    infer_bits(&root, 0);
+#ifdef TE_PROFILE
+    const unsigned long long optimized = TICKS();
+    PROFILE_ADD(&compile_profile.optimize, optimized - start);
+#endif
+
+    /* Move the tree into one block, so te_free is a single release. */
+    const int size = te_size(root);
+    te_expr *packed = te_pack(root, malloc(size), size);
+    te_free(root);
+#ifdef TE_PROFILE
+    PROFILE_ADD(&compile_profile.pack, TICKS() - optimized);
+#endif
+    if (!packed) {
+        if (error) *error = -1;
+        return 0;
+    }
+
+    if (error) *error = 0;
+    return packed;
+}
+
+
+static void begin(state *s, const char *expression, const te_variable *variables, int var_count) {
+    /* Only the fields the tokenizer and parser read; the rest is set as tokens are. */
+    s->start = s->next = expression;
+    s->lookup = variables;
+    s->lookup_len = var_count;
+    s->symbols = 0;
+    s->frame = 0;
+    s->frame_size = 0;
+    s->arena = 0;
+}
+
+
+static te_expr *compile(state *s, int *error) {
+    te_expr *root = parse(s, error);
+    return root ? finish(root, error) : 0;
+}
+
+
+te_expr *te_compile(const char *expression, const te_variable *variables, int var_count, int *error) {
+    state s;
+    begin(&s, expression, variables, var_count);
+    return compile(&s, error);
+}
+
+
+te_expr *te_compile_frame(const char *expression, const te_variable *variables, int var_count,
+        const void *frame, int frame_size, int *error) {
+    state s;
+    begin(&s, expression, variables, var_count);
+    s.frame = frame;
+    s.frame_size = frame ? frame_size : 0;
+    return compile(&s, error);
+}
+
+
+te_expr *te_compile_symbols(const char *expression, const te_symbols *symbols, int *error) {
+    state s;
+    begin(&s, expression, 0, 0);
+    s.symbols = symbols;
+    return compile(&s, error);
+}
+
+
+te_expr *te_compile_many(const char *const *expressions, int count, const te_variable *variables, int var_count,
+        int *failed, int *error) {
+    /* The expressions are joined into one tree, so cse shares their repeats. */
+    te_expr *root = 0, **tail = &root;
+    int i;
+    if (failed) *failed = -1;
+    if (count < 1) {
+        if (error) *error = -1;
+        return 0;
+    }
+
+    for (i = 0; i < count; ++i) {
+        state s;
+        begin(&s, expressions[i], variables, var_count);
+        te_expr *n = parse(&s, error);
+        te_expr *link = n && *tail ? new_expr(TE_FUNCTION2, (const te_expr*[]){*tail, n}) : n;
+        if (!link) {
+            if (n && error) *error = -1;
+            if (failed) *failed = i;
+            te_free(n);
+            te_free(root);
+            return 0;
+        }
+        if (!*tail) {
+            *tail = n;
+        } else {
+            link->function = join;
+            *tail = link;
+            tail = (te_expr**)&link->parameters[1];
+        }
+    }
+
+    return finish(root, error);
+}
+
+
+void te_eval_many(const te_expr *n, int count, double *outputs) {
+    double temps[TE_MAX_TEMPS];
+    int i;
+
+    /* Shared work sits in the chain of temps at the root. */
+    for (; n && (TYPE_MASK(n->type) == TE_LET || TYPE_MASK(n->type) == TE_REDUCE); n = n->parameters[1]) {
+        if (TYPE_MASK(n->type) == TE_LET) temps[n->offset] = eval(n->parameters[0], 0, temps);
+        else reduce_node(n, 0, temps + n->offset);
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (n && TYPE_MASK(n->type) == TE_FUNCTION2 && n->function == (const void*)join) {
+            outputs[i] = eval(n->parameters[0], 0, temps);
+            n = n->parameters[1];
+        } else {
+            outputs[i] = eval(n, 0, temps);
+            n = 0;
+        }
+    }
+}
+
+
+double te_interp(const char *expression, int *error) {
+    /* Without variables, optimize would fold the whole tree into the value that */
+    /* evaluating it as parsed gives, so it is parsed into the stack instead. */
+    double arena[TE_INTERP_BYTES / sizeof(double)];
+    state s;
+    begin(&s, expression, 0, 0);
+    s.arena = (char*)arena;
+    s.arena_size = sizeof(arena);
+    s.arena_used = 0;
+    s.arena_full = 0;
+    te_expr *root = parse(&s, error);
+    if (root) {
+        if (error) *error = 0;
+        return te_eval(root);
+    }
+    if (!s.arena_full) return NAN;
+
+    /* Too long for the stack. */
+    te_expr *n = te_compile(expression, 0, 0, error);
+
+    double ret;
+    if (n) {
+        ret = te_eval(n);
+        te_free(n);
+    } else {
+        ret = NAN;
+    }
+    return ret;
+}
+
+
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+/* Expression cache:                                                    */
+/*   a hash table over the entries, which also form a most recent first list */
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+
+typedef struct cache_entry {
+    struct cache_entry *chain; /* Next in the same bucket. */
+    struct cache_entry *newer, *older;
+    unsigned hash;
+    const te_variable *variables;
+    int var_count;
+    te_expr *expr;
+    char text[1];
+} cache_entry;
+
+struct te_cache {
+    int capacity, count;
+    unsigned mask;
+    long hits, misses;
+    cache_entry *newest, *oldest;
+    cache_entry *buckets[1];
+};
+
+
+te_cache *te_cache_new(int capacity) {
+    if (capacity < 1) return 0;
+    unsigned buckets = 1;
+    while (buckets < (unsigned)capacity * 2) buckets <<= 1;
+    te_cache *cache = calloc(1, sizeof(te_cache) + sizeof(cache_entry*) * (buckets - 1));
+    CHECK_NULL(cache);
+    cache->capacity = capacity;
+    cache->mask = buckets - 1;
+    return cache;
+}
+
+
+static void unlink_entry(te_cache *cache, cache_entry *e) {
+    if (e->newer) e->newer->older = e->older; else cache->newest = e->older;
+    if (e->older) e->older->newer = e->newer; else cache->oldest = e->newer;
+}
+
+
+static void push_newest(te_cache *cache, cache_entry *e) {
+    e->newer = 0;
+    e->older = cache->newest;
+    if (cache->newest) cache->newest->newer = e; else cache->oldest = e;
+    cache->newest = e;
+}
+
+
+const te_expr *te_cache_get(te_cache *cache, const char *expression,
+        const te_variable *variables, int var_count, int *error) {
+    const int len = strlen(expression);
+    unsigned hash = hash_bytes(2166136261u, expression, len);
+    hash = hash_bytes(hash, &variables, sizeof(variables));
+    hash = hash_bytes(hash, &var_count, sizeof(var_count));
+
+    cache_entry **slot = cache->buckets + (hash & cache->mask), *e;
+    for (e = *slot; e; e = e->chain) {
+        if (e->hash == hash && e->variables == variables && e->var_count == var_count &&
+            strcmp(e->text, expression) == 0) {
+            ++cache->hits;
+            unlink_entry(cache, e);
+            push_newest(cache, e);
+            if (error) *error = 0;
+            return e->expr;
+        }
+    }
+
+    ++cache->misses;
+    te_expr *n = te_compile(expression, variables, var_count, error);
+    if (!n) return 0;
+    e = malloc(sizeof(cache_entry) + len);
+    if (!e) {
+        te_free(n);
+        if (error) *error = -1;
+        return 0;
+    }
+    memcpy(e->text, expression, len + 1);
+    e->hash = hash;
+    e->variables = variables;
+    e->var_count = var_count;
+    e->expr = n;
+
+    if (cache->count == cache->capacity) {
+        /* Evict the least recently used entry. */
+        cache_entry *old = cache->oldest, **p = cache->buckets + (old->hash & cache->mask);
+        while (*p != old) p = &(*p)->chain;
+        *p = old->chain;
+        unlink_entry(cache, old);
+        te_free(old->expr);
+        free(old);
+        --cache->count;
+    }
+
+    e->chain = *slot;
+    *slot = e;
+    push_newest(cache, e);
+    ++cache->count;
+    return n;
+}
+
+
+long te_cache_hits(const te_cache *cache) {
+    return cache->hits;
+}
+
+
+long te_cache_misses(const te_cache *cache) {
+    return cache->misses;
+}
+
+
+void te_cache_free(te_cache *cache) {
+    if (!cache) return;
+    cache_entry *e = cache->newest;
+    while (e) {
+        cache_entry *older = e->older;
+        te_free(e->expr);
+        free(e);
+        e = older;
+    }
+    free(cache);
+}
+
+
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+/* Saved expressions:                                                   */
+/*   a header, the names that replace pointers, then the nodes depth first */
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+
+#define TE_BLOB_MAGIC 0x42584554u /* "TEXB" in little-endian order. */
+#define TE_BLOB_VERSION 3 /* 2: array builtins have their own node kinds. 3: the frame size. */
+#define TE_BLOB_HEADER 20 /* magic, version, size, name count, frame size */
+
+/* Nodes deep that te_load reads a blob to, at most. */
+#ifndef TE_LOAD_DEPTH
+#define TE_LOAD_DEPTH 4096
+#endif
+
+/* Where a saved name is looked up again. */
+enum {NAME_TABLE, NAME_BUILTIN, NAME_OPERATOR};
+
+/* Functions the parser uses for operators, which have no name of their own. */
+static const te_variable operators[] = {
+    {"+", add,           TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"-", sub,           TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"*", mul,           TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"/", divide,        TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"%", fmod,          TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"&", bitwise_and,   TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"|", bitwise_or,    TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"<", less,          TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"<=", less_equal,   TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {">", greater,       TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {">=", greater_equal, TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"==", equal,        TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {"!=", not_equal,    TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {",", comma,         TE_FUNCTION2 | TE_FLAG_PURE, 0},
+    {";", join,          TE_FUNCTION2, 0},
+    {"neg", negate,      TE_FUNCTION1 | TE_FLAG_PURE, 0},
+    {0, 0, 0, 0}
+};
+
+
+typedef struct blob_writer {
+    unsigned char *out; /* NULL while measuring. */
+    int size;
+    const te_variable *variables;
+    int var_count;
+    const te_variable **names;
+    unsigned char *kinds;
+    int name_count, name_capacity;
+    int frame_size; /* The end of the last frame variable read. */
+    int failed;
+} blob_writer;
+
+
+static void put(blob_writer *w, const void *data, int size) {
+    if (w->out) memcpy(w->out + w->size, data, size);
+    w->size += size;
+}
+
+
+static void put_name(blob_writer *w, const te_variable *var, int kind) {
+    unsigned i;
+    for (i = 0; i < (unsigned)w->name_count && w->names[i] != var; ++i);
+    if (i == (unsigned)w->name_count) {
+        if (w->name_count == w->name_capacity) {
+            const int capacity = w->name_capacity ? w->name_capacity * 2 : 16;
+            const te_variable **names = realloc(w->names, sizeof(*names) * capacity);
+            if (names) w->names = names;
+            unsigned char *kinds = realloc(w->kinds, capacity);
+            if (kinds) w->kinds = kinds;
+            if (!names || !kinds) {
+                w->failed = 1;
+                return;
+            }
+            w->name_capacity = capacity;
+        }
+        w->names[w->name_count] = var;
+        w->kinds[w->name_count++] = kind;
+    }
+    put(w, &i, sizeof(i));
+}
+
+
+static int call_type(int type) {
+    /* The te_variable type that a node's function or array is bound with. */
+    switch (TYPE_MASK(type)) {
+        case TE_AGGREGATE: return TE_FUNCTION1;
+        case TE_DOT: return TE_FUNCTION2;
+        case TE_ARRAY: return TE_VARIABLE;
+        case TE_VIEW_ARRAY: return TE_VIEW;
+        default: return TYPE_MASK(type);
+    }
+}
+
+
+static const void *checked_form(const te_expr *n) {
+    /* The function a builtin was parsed to, before prove picked a form of it. */
+    const int op = bitwise_form(n);
+    return op != BIT_NONE ? bitwise_forms[op][0] : n->function;
+}
+
+
+static void save_node(blob_writer *w, const te_expr *n) {
+    /* te_load proves the tree again, and takes immutability from its own variables. */
+    const unsigned type = n->type & ~(TE_FLAG_PACKED | TE_FLAG_PROVEN | TE_FLAG_IMMUTABLE);
+    const int arity = ARITY(n->type);
+    const te_variable *var = 0;
+    int i;
+
+    put(w, &type, sizeof(type));
+    switch (TYPE_MASK(n->type)) {
+        case TE_CONSTANT: put(w, &n->value, sizeof(double)); break;
+
+        case TE_SLOT: case TE_SLOT_ARRAY: case TE_TEMP: case TE_LET: case TE_REDUCE:
+            put(w, &n->offset, sizeof(int));
+            if ((TYPE_MASK(n->type) == TE_SLOT || TYPE_MASK(n->type) == TE_SLOT_ARRAY) &&
+                n->offset + (int)sizeof(double) > w->frame_size) w->frame_size = n->offset + (int)sizeof(double);
+            break;
+
+        case TE_LERP: break; /* Slopes are worked out again on loading. */
+        case TE_BITWISE: case TE_IF: break;
+
+        case TE_VARIABLE: case TE_ARRAY: case TE_VIEW: case TE_VIEW_ARRAY:
+            for (i = 0; i < w->var_count; ++i) {
+                var = w->variables + i;
+                if (var->address == n->bound && TYPE_MASK(var->type) == call_type(n->type)) break;
+            }
+            if (i == w->var_count) w->failed = 1; else put_name(w, var, NAME_TABLE);
+            break;
+
+        default:
+            /* Operators and builtins have no vector forms. */
+            for (var = operators; var->name; ++var) {
+                if (var->address == checked_form(n) && TYPE_MASK(var->type) == TYPE_MASK(n->type)) break;
+            }
+            if (var->name && !(n->type & TE_FLAG_VECTOR)) {
+                put_name(w, var, NAME_OPERATOR);
+                break;
+            }
+            for (var = functions; var->name; ++var) {
+                if (var->address == checked_form(n) && TYPE_MASK(var->type) == call_type(n->type)) break;
+            }
+            if (var->name && !(n->type & TE_FLAG_VECTOR)) {
+                put_name(w, var, NAME_BUILTIN);
+                break;
+            }
+            for (i = 0; i < w->var_count; ++i) {
+                var = w->variables + i;
+                if (var->address == n->function && TYPE_MASK(var->type) == TYPE_MASK(n->type) &&
+                    (!IS_CLOSURE(n->type) || var->context == n->parameters[arity]) &&
+                    vector_of(var) == (n->type & TE_FLAG_VECTOR ? VECTOR(n) : 0)) break;
+            }
+            if (i == w->var_count) w->failed = 1; else put_name(w, var, NAME_TABLE);
+            break;
+    }
+
+    for (i = 0; i < arity; ++i) save_node(w, n->parameters[i]);
+}
+
+
+int te_save(const te_expr *n, const te_variable *variables, int var_count, void *buffer, int size) {
+    blob_writer w;
+    memset(&w, 0, sizeof(w));
+    w.variables = variables;
+    w.var_count = variables ? var_count : 0;
+    if (!n) return -1;
+
+    /* Measure first, which also numbers the names. */
+    save_node(&w, n);
+    const int nodes = w.size;
+    int i, total = TE_BLOB_HEADER + nodes;
+    for (i = 0; i < w.name_count; ++i) total += 1 + sizeof(unsigned) + strlen(w.names[i]->name);
+
+    if (!w.failed && buffer && total <= size) {
+        const unsigned header[5] = {TE_BLOB_MAGIC, TE_BLOB_VERSION, total, w.name_count, w.frame_size};
+        w.out = buffer;
+        w.size = 0;
+        put(&w, header, sizeof(header));
+        for (i = 0; i < w.name_count; ++i) {
+            const unsigned len = strlen(w.names[i]->name);
+            put(&w, w.kinds + i, 1);
+            put(&w, &len, sizeof(len));
+            put(&w, w.names[i]->name, len);
+        }
+        save_node(&w, n);
+    }
+
+    free(w.names);
+    free(w.kinds);
+    return w.failed ? -1 : total;
+}
+
+
+typedef struct blob_reader {
+    const unsigned char *next, *end;
+    const te_variable **names;
+    unsigned name_count;
+    unsigned frame_size; /* From the header, which every frame variable must lie within. */
+    int depth;
+} blob_reader;
+
+
+static int get(blob_reader *r, void *data, int size) {
+    if (r->end - r->next < size) return 0;
+    memcpy(data, r->next, size);
+    r->next += size;
+    return 1;
+}
+
+
+static int valid_type(unsigned type) {
+    if (TYPE_MASK(type) == TE_REDUCE) {
+        return (type & ~(TE_REDUCE | TE_FLAG_PURE | 0x7F0000u)) == 0 && REDUCE_STATS(type) != 0;
+    }
+    if (TYPE_MASK(type) == TE_AGGREGATE || TYPE_MASK(type) == TE_DOT || TYPE_MASK(type) == TE_BITWISE ||
+        TYPE_MASK(type) == TE_IF) {
+        return type == (TYPE_MASK(type) | TE_FLAG_PURE);
+    }
+    if (TYPE_MASK(type) == TE_VIEW || TYPE_MASK(type) == TE_VIEW_ARRAY) return type == TYPE_MASK(type);
+    if (type & TE_FLAG_VECTOR) return (IS_FUNCTION(type) || IS_CLOSURE(type)) && valid_type(type & ~TE_FLAG_VECTOR);
+    return (type & ~(0x1Fu | TE_FLAG_PURE)) == 0 && TYPE_MASK(type) <= TE_CLOSURE7;
+}
+
+
+static int valid_arrays(const te_expr *n) {
+    /* Array builtins only come as their own kinds, on bare arrays, as the parser makes them. */
+    switch (TYPE_MASK(n->type)) {
+        case TE_AGGREGATE: return array_function(n->function) && bare_array(n->parameters[0]);
+        case TE_DOT: return n->function == (const void*)te_dot && bare_array(n->parameters[0]) && bare_array(n->parameters[1]);
+        case TE_LERP: return bare_array(n->parameters[0]) && bare_array(n->parameters[1]);
+        default:
+            return IS_CLOSURE(n->type) || !IS_FUNCTION(n->type) || (!array_function(n->function) &&
+                n->function != (const void*)te_dot && n->function != (const void*)te_lerp);
+    }
+}
+
+
+static te_expr *load_node(blob_reader *r) {
+    /* Returns NULL if the blob is malformed or memory runs out. */
+    unsigned type, index;
+    if (r->depth == TE_LOAD_DEPTH || !get(r, &type, sizeof(type)) || !valid_type(type)) return 0;
+
+    const int arity = ARITY(type);
+    te_expr *n = new_expr(type, 0);
+    const te_variable *var = 0;
+    int i, ok = n != 0;
+
+    switch (TYPE_MASK(type)) {
+        case TE_CONSTANT: ok = ok && get(r, &n->value, sizeof(double)); break;
+
+        case TE_SLOT: case TE_SLOT_ARRAY: case TE_TEMP: case TE_LET: case TE_REDUCE:
+            ok = ok && get(r, &n->offset, sizeof(int)) && n->offset >= 0;
+            /* An array's elements are the frame's to hold, as at te_compile_frame; its length must fit. */
+            if (TYPE_MASK(type) == TE_SLOT || TYPE_MASK(type) == TE_SLOT_ARRAY) {
+                ok = ok && r->frame_size >= sizeof(double) && (unsigned)n->offset <= r->frame_size - sizeof(double);
+            }
+            break;
+
+        case TE_LERP: case TE_BITWISE: break;
+        case TE_IF: if (ok) n->function = fn_if; break;
+
+        default:
+            ok = ok && get(r, &index, sizeof(index)) && index < r->name_count;
+            if (!ok) break;
+            var = r->names[index];
+            if (TYPE_MASK(type) == TE_VARIABLE || TYPE_MASK(type) == TE_ARRAY ||
+                TYPE_MASK(type) == TE_VIEW || TYPE_MASK(type) == TE_VIEW_ARRAY) {
+                ok = TYPE_MASK(var->type) == call_type(type);
+                n->bound = var->address;
+                n->type |= var->type & TE_FLAG_IMMUTABLE;
+            } else {
+                ok = TYPE_MASK(var->type) == call_type(type) && (vector_of(var) != 0) == ((type & TE_FLAG_VECTOR) != 0);
+                n->function = var->address;
+                if (IS_CLOSURE(type)) n->parameters[arity] = var->context;
+                if (type & TE_FLAG_VECTOR) VECTOR(n) = vector_of(var);
+            }
+            break;
+    }
+
+    ++r->depth;
+    for (i = 0; ok && i < arity; ++i) ok = (n->parameters[i] = load_node(r)) != 0;
+    --r->depth;
+    if (!ok || !valid_arrays(n)) {
+        te_free(n);
+        return 0;
+    }
+
+    if (TYPE_MASK(type) == TE_LERP && immutable(n->parameters[0]) && immutable(n->parameters[1])) {
+        span domain, range;
+        if (array_span(n->parameters[0], 0, &domain) && array_span(n->parameters[1], 0, &range)) {
+            n->parameters[3] = lerp_slopes(&domain, &range);
+        }
+    }
+    return n;
+}
+
+
+static int valid_temps(const te_expr *n, int temps, int chain) {
+    /* Temps may only be defined along the chain at the root, and only read below temps, */
+    /* which must fit the TE_MAX_TEMPS that evaluation keeps. */
+    int i;
+    if (temps > TE_MAX_TEMPS) return 0;
+    switch (TYPE_MASK(n->type)) {
+        case TE_TEMP: return n->offset < temps;
+        case TE_LET:
+            return chain && n->offset < temps &&
+                valid_temps(n->parameters[0], temps, 0) && valid_temps(n->parameters[1], temps, 1);
+        case TE_REDUCE:
+            return chain && n->offset <= temps - stat_count(REDUCE_STATS(n->type)) &&
+                (TYPE_MASK(((const te_expr*)n->parameters[0])->type) == TE_VARIABLE || TYPE_MASK(((const te_expr*)n->parameters[0])->type) == TE_VIEW) &&
+                valid_temps(n->parameters[1], temps, 1);
+        default:
+            for (i = 0; i < ARITY(n->type); ++i) if (!valid_temps(n->parameters[i], temps, 0)) return 0;
+            return 1;
+    }
+}
+
+
+te_expr *te_load_frame(const void *blob, int size, const te_variable *variables, int var_count,
+        int frame_size, int *error) {
+    unsigned header[5], i;
+    blob_reader r;
+    r.next = blob;
+    r.end = r.next + (blob && size > 0 ? size : 0);
+    r.names = 0;
+    r.depth = 0;
+    if (error) *error = -1;
+
+    if (!get(&r, header, sizeof(header)) || header[0] != TE_BLOB_MAGIC || header[1] != TE_BLOB_VERSION ||
+        header[2] > (unsigned)size || header[3] > header[2] / 5 || header[4] > INT_MAX) return 0;
+    if (frame_size >= 0 && header[4] > (unsigned)frame_size) return 0;
+    r.end = (const unsigned char*)blob + header[2];
+    r.name_count = header[3];
+    r.frame_size = header[4];
+    r.names = malloc(sizeof(te_variable*) * (r.name_count ? r.name_count : 1));
+    CHECK_NULL(r.names);
+
+    state s;
+    memset(&s, 0, sizeof(s));
+    s.lookup = variables;
+    s.lookup_len = variables ? var_count : 0;
+
+    for (i = 0; i < r.name_count; ++i) {
+        unsigned char kind;
+        unsigned len;
+        const te_variable *var = 0;
+        if (!get(&r, &kind, 1) || !get(&r, &len, sizeof(len)) || len > (unsigned)(r.end - r.next) ||
+            memchr(r.next, 0, len)) break;
+        const char *name = (const char*)r.next;
+        r.next += len;
+
+        if (kind == NAME_TABLE) {
+            var = find_lookup(&s, name, len);
+        } else if (kind == NAME_BUILTIN) {
+            var = find_builtin(name, len, name_hash(name, len));
+        } else if (kind == NAME_OPERATOR) {
+            for (var = operators; var->name && (strncmp(var->name, name, len) || var->name[len]); ++var);
+            if (!var->name) var = 0;
+        }
+        if (!var) {
+            /* A name the variables don't have is the caller's mistake, not the blob's. */
+            if (error && kind == NAME_TABLE) *error = 1;
+            free(r.names);
+            return 0;
+        }
+        r.names[i] = var;
+    }
+
+    te_expr *root = i == r.name_count ? load_node(&r) : 0;
+    free(r.names);
+    if (!root || r.next != r.end || !valid_temps(root, temp_count(root), 1)) {
+        te_free(root);
+        return 0;
+    }
+    prove_tree(root);
+
+    const int packed_size = te_size(root);
+    te_expr *packed = te_pack(root, malloc(packed_size), packed_size);
+    te_free(root);
+    if (packed && error) *error = 0;
+    return packed;
+}
+
+
+te_expr *te_load(const void *blob, int size, const te_variable *variables, int var_count, int *error) {
+    return te_load_frame(blob, size, variables, var_count, -1, error);
+}
+
+
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+/* Incremental evaluation:                                              */
+/*   one record per node, in preorder, keeping its last value           */
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+
+typedef struct inc_record {
+    double value;
+    int parent;
+    int size; /* Records in this subtree, this one included. */
+    int dirty;
+    int always; /* Reads a closure or impure function, so it is never clean. */
+    int defines, define_count; /* 1 + the first temp set from this: a TE_LET's value or a TE_REDUCE's array. */
+    int next_reader; /* The next TE_TEMP reading the same temp, or -1. */
+} inc_record;
+
+typedef struct inc_leaf {const void *address; int record;} inc_leaf;
+
+struct te_incremental {
+    const te_expr *root;
+    inc_record *records;
+    inc_leaf *leaves; /* Sorted by address. */
+    int leaf_count;
+    int readers[TE_MAX_TEMPS]; /* The first TE_TEMP reading each temp, or -1. */
+    int always[TE_MAX_TEMPS]; /* Whether each temp's definition is never clean. */
+    double temps[TE_MAX_TEMPS];
+};
+
+
+static int build_records(te_incremental *inc, const te_expr *n, int parent, int *next) {
+    /* Numbers n's subtree from *next, children before later siblings. Returns n's record. */
+    const int i = (*next)++, arity = ARITY(n->type);
+    inc_record *r = inc->records + i;
+    int k;
+    r->parent = parent;
+    r->dirty = 1;
+    r->defines = r->define_count = 0;
+    r->next_reader = -1;
+    r->always = IS_CLOSURE(n->type) || (IS_FUNCTION(n->type) && !IS_PURE(n->type));
+
+    for (k = 0; k < arity; ++k) {
+        const te_expr *child = n->parameters[k];
+        const int c = build_records(inc, child, i, next);
+        r = inc->records + i;
+        r->always |= inc->records[c].always;
+
+        /* Readers of a temp look at its definition. */
+        if (k == 0 && TYPE_MASK(n->type) == TE_LET) {
+            inc->records[c].defines = 1 + n->offset;
+            inc->records[c].define_count = 1;
+            inc->always[n->offset] = inc->records[c].always;
+        } else if (k == 0 && TYPE_MASK(n->type) == TE_REDUCE) {
+            const int count = stat_count(REDUCE_STATS(n->type));
+            int t;
+            inc->records[c].defines = 1 + n->offset;
+            inc->records[c].define_count = count;
+            for (t = 0; t < count; ++t) inc->always[n->offset + t] = 0;
+        }
+    }
+
+    switch (TYPE_MASK(n->type)) {
+        case TE_VARIABLE: case TE_ARRAY: case TE_VIEW: case TE_VIEW_ARRAY:
+            inc->leaves[inc->leaf_count].address = n->bound;
+            inc->leaves[inc->leaf_count++].record = i;
+            break;
+        case TE_TEMP:
+            r->always = inc->always[n->offset];
+            r->next_reader = inc->readers[n->offset];
+            inc->readers[n->offset] = i;
+            break;
+    }
+
+    r->size = *next - i;
+    return i;
+}
+
+
+static int compare_leaves(const void *a, const void *b) {
+    const size_t x = (size_t)((const inc_leaf*)a)->address, y = (size_t)((const inc_leaf*)b)->address;
+    return x < y ? -1 : x > y;
+}
+
+
+te_incremental *te_incremental_new(const te_expr *n) {
+    if (!n) return 0;
+    const int count = count_nodes(n);
+    te_incremental *inc = malloc(sizeof(te_incremental));
+    CHECK_NULL(inc);
+    inc->records = malloc(sizeof(inc_record) * count);
+    inc->leaves = malloc(sizeof(inc_leaf) * count);
+    CHECK_NULL(inc->records && inc->leaves ? inc : 0, te_incremental_free(inc));
+
+    int i, next = 0;
+    inc->root = n;
+    inc->leaf_count = 0;
+    for (i = 0; i < TE_MAX_TEMPS; ++i) {
+        inc->readers[i] = -1;
+        inc->always[i] = 0;
+    }
+    build_records(inc, n, -1, &next);
+    qsort(inc->leaves, inc->leaf_count, sizeof(inc_leaf), compare_leaves);
+    return inc;
+}
+
+
+static void mark(te_incremental *inc, int i) {
+    /* Every ancestor of a dirty record is dirty, so the walk stops at the first one. */
+    while (i >= 0 && !inc->records[i].dirty) {
+        inc_record *r = inc->records + i;
+        int t, reader;
+        r->dirty = 1;
+        for (t = r->defines - 1; t < r->defines - 1 + r->define_count; ++t) {
+            for (reader = inc->readers[t]; reader >= 0; reader = inc->records[reader].next_reader) mark(inc, reader);
+        }
+        i = r->parent;
+    }
+}
+
+
+void te_incremental_touch(te_incremental *inc, const void *address) {
+    if (!inc) return;
+    int lo = 0, hi = inc->leaf_count;
+    while (lo < hi) {
+        const int mid = lo + (hi - lo) / 2;
+        if ((size_t)inc->leaves[mid].address < (size_t)address) lo = mid + 1; else hi = mid;
+    }
+    for (; lo < inc->leaf_count && inc->leaves[lo].address == address; ++lo) mark(inc, inc->leaves[lo].record);
+}
+
+#define TE_FUN(...) ((double(*)(__VA_ARGS__))n->function)
+
+static double reeval(te_incremental *inc, const te_expr *n, int i) {
+    /* Same as eval, but a clean record returns its last value. */
+    inc_record *r = inc->records + i;
+    if (!r->dirty) return r->value;
+
+    const int arity = ARITY(n->type);
+    double v[7] = {0}, ret = NAN;
+    int k, c = i + 1;
+
+    switch (TYPE_MASK(n->type)) {
+        case TE_LET:
+            inc->temps[n->offset] = reeval(inc, n->parameters[0], c);
+            ret = reeval(inc, n->parameters[1], c + inc->records[c].size);
+            break;
+        case TE_REDUCE:
+            if (inc->records[c].dirty) {
+                reduce_node(n, 0, inc->temps + n->offset);
+                reeval(inc, n->parameters[0], c);
+            }
+            ret = reeval(inc, n->parameters[1], c + inc->records[c].size);
+            break;
+        case TE_IF: {
+            /* The branch not taken stays dirty, and only matters once the condition changes. */
+            const int then = c + inc->records[c].size;
+            if (reeval(inc, n->parameters[0], c) != 0) ret = reeval(inc, n->parameters[1], then);
+            else ret = reeval(inc, n->parameters[2], then + inc->records[then].size);
+            break;
+        }
+        default:
+            for (k = 0; k < arity; ++k) {
+                v[k] = reeval(inc, n->parameters[k], c);
+                c += inc->records[c].size;
+            }
+            break;
+    }
+
+    switch (TYPE_MASK(n->type)) {
+        case TE_LET: case TE_REDUCE: case TE_IF: break;
+        case TE_BITWISE: ret = v[0]; break;
+        case TE_CONSTANT: ret = n->value; break;
+        case TE_VARIABLE: ret = *n->bound; break;
+        case TE_TEMP: ret = inc->temps[n->offset]; break;
+        case TE_ARRAY: case TE_SLOT_ARRAY: case TE_VIEW_ARRAY: {
+            span a;
+            const int idx = (int)v[0];
+            if (array_span(n, 0, &a) && ((n->type & TE_FLAG_PROVEN) || (idx >= 0 && idx < a.len))) ret = AT(&a, idx);
+            break;
+        }
+        case TE_LERP: {
+            span domain, range;
+            if (array_span(n->parameters[0], 0, &domain) && array_span(n->parameters[1], 0, &range)) {
+                ret = (n->type & TE_FLAG_PROVEN ? lerp_segment : lerp)(&domain, &range, n->parameters[3], v[2], LERP_HINT(&n->offset));
+            }
+            break;
+        }
+        case TE_AGGREGATE: {
+            span a;
+            if (array_span(n->parameters[0], 0, &a)) ret = TE_FUN(const span*)(&a);
+            break;
+        }
+        case TE_DOT: {
+            span a, b;
+            if (array_span(n->parameters[0], 0, &a) && array_span(n->parameters[1], 0, &b)) ret = te_dot(&a, &b);
+            break;
+        }
+
+        case TE_FUNCTION0: case TE_FUNCTION1: case TE_FUNCTION2: case TE_FUNCTION3:
+        case TE_FUNCTION4: case TE_FUNCTION5: case TE_FUNCTION6: case TE_FUNCTION7:
+            switch (arity) {
+                case 0: ret = TE_FUN(void)(); break;
+                case 1: ret = TE_FUN(double)(v[0]); break;
+                case 2: ret = TE_FUN(double, double)(v[0], v[1]); break;
+                case 3: ret = TE_FUN(double, double, double)(v[0], v[1], v[2]); break;
+                case 4: ret = TE_FUN(double, double, double, double)(v[0], v[1], v[2], v[3]); break;
+                case 5: ret = TE_FUN(double, double, double, double, double)(v[0], v[1], v[2], v[3], v[4]); break;
+                case 6: ret = TE_FUN(double, double, double, double, double, double)(v[0], v[1], v[2], v[3], v[4], v[5]); break;
+                default: ret = TE_FUN(double, double, double, double, double, double, double)(v[0], v[1], v[2], v[3], v[4], v[5], v[6]); break;
+            }
+            break;
+
+        case TE_CLOSURE0: case TE_CLOSURE1: case TE_CLOSURE2: case TE_CLOSURE3:
+        case TE_CLOSURE4: case TE_CLOSURE5: case TE_CLOSURE6: case TE_CLOSURE7: {
+            void *context = n->parameters[arity];
+            switch (arity) {
+                case 0: ret = TE_FUN(void*)(context); break;
+                case 1: ret = TE_FUN(void*, double)(context, v[0]); break;
+                case 2: ret = TE_FUN(void*, double, double)(context, v[0], v[1]); break;
+                case 3: ret = TE_FUN(void*, double, double, double)(context, v[0], v[1], v[2]); break;
+                case 4: ret = TE_FUN(void*, double, double, double, double)(context, v[0], v[1], v[2], v[3]); break;
+                case 5: ret = TE_FUN(void*, double, double, double, double, double)(context, v[0], v[1], v[2], v[3], v[4]); break;
+                case 6: ret = TE_FUN(void*, double, double, double, double, double, double)(context, v[0], v[1], v[2], v[3], v[4], v[5]); break;
+                default: ret = TE_FUN(void*, double, double, double, double, double, double, double)(context, v[0], v[1], v[2], v[3], v[4], v[5], v[6]); break;
+            }
+            break;
+        }
+
+        default: break; /* Frame slots are NaN, as te_eval gives them. */
+    }
+
+    r = inc->records + i;
+    r->value = ret;
+    r->dirty = r->always;
+    return ret;
+}
+
+#undef TE_FUN
+
+
+double te_incremental_eval(te_incremental *inc) {
+    return inc ? reeval(inc, inc->root, 0) : NAN;
+}
+
+
+void te_incremental_free(te_incremental *inc) {
+    if (!inc) return;
+    free(inc->records);
+    free(inc->leaves);
+    free(inc);
+}
+
+
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+/* Flat programs:                                                       */
+/*   each op writes slot; its operands are slot, slot+1, ...            */
+/*   jumps go to the op at offset, OP_JUMPZ only if slot is zero        */
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+
+enum {
+    OP_CONST, OP_VAR, OP_SLOT, OP_ARRAY, OP_TEMP, OP_STORE,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW, OP_FMOD, OP_AND, OP_OR,
+    OP_NEG, OP_COMMA,
+    OP_SUM, OP_ARRLEN, OP_ARRMIN, OP_ARRMAX, OP_MEAN, OP_VARIANCE, OP_ARGMIN, OP_ARGMAX,
+    OP_DOT, OP_REDUCE, OP_LERP, OP_JUMP, OP_JUMPZ,
+    OP_INDEX, OP_SEGMENT, /* OP_ARRAY and OP_LERP, proven in bounds. */
+    OP_FUN0, OP_FUN1, OP_FUN2, OP_FUN3, OP_FUN4, OP_FUN5, OP_FUN6, OP_FUN7,
+    OP_CLO0, OP_CLO1, OP_CLO2, OP_CLO3, OP_CLO4, OP_CLO5, OP_CLO6, OP_CLO7
+};
+
+typedef struct te_op {
+    int code;
+    int slot;
+    union {double value; const double *bound; const void *function; int offset;};
+    union {void *context; const double *range; int range_offset;};
+    int framed; /* 1: offset replaces bound, 2: range_offset replaces range. */
+    int views; /* 1: bound points to a te_view, 2: range does. */
+    union {int hint; int stats;}; /* OP_LERP's last segment, OP_REDUCE's statistics. */
+    const double *slopes;
+} te_op;
+
+struct te_program {
+    int count;
+    int slots;
+    int result; /* Temps take the slots below it. */
+    double *tables; /* Slope tables are copied here, after the ops. */
+#ifdef TE_JIT_X86
+    int runs; /* Interpreted runs, counted until the program is compiled. */
+    int jit_failed;
+    int framed; /* Some op reads the frame, so frameless runs stay interpreted. */
+    double (*native)(const char *frame, double *r);
+    int native_size;
+    int native_scratch; /* Whether native uses r, for temps or spills. */
+#endif
+    te_op ops[1];
+};
+
+#define TE_PROGRAM_STACK_SLOTS 64
+
+
+static int temp_count(const te_expr *n) {
+    /* Temps are numbered from 0 by the chain of TE_LET and TE_REDUCE at the root. */
+    int count = 0;
+    for (;; n = n->parameters[1]) {
+        if (TYPE_MASK(n->type) == TE_LET) ++count;
+        else if (TYPE_MASK(n->type) == TE_REDUCE) count += stat_count(REDUCE_STATS(n->type));
+        else return count;
+    }
+}
+
+
+static int program_size(const te_expr *n) {
+    int i, size = 1;
+    /* Array builtins read their arrays directly. */
+    if (TYPE_MASK(n->type) == TE_AGGREGATE || TYPE_MASK(n->type) == TE_DOT) return 1;
+    if (TYPE_MASK(n->type) == TE_REDUCE) return 1 + program_size(n->parameters[1]);
+    if (TYPE_MASK(n->type) == TE_LERP) return 1 + program_size(n->parameters[2]);
+    if (TYPE_MASK(n->type) == TE_BITWISE) return program_size(n->parameters[0]);
+    if (TYPE_MASK(n->type) == TE_IF) size = 2;
+    for (i = 0; i < ARITY(n->type); ++i) size += program_size(n->parameters[i]);
+    return size;
+}
+
+
+static int program_tables(const te_expr *n) {
+    int i, size = slopes_size(n);
+    for (i = 0; i < ARITY(n->type); ++i) size += program_tables(n->parameters[i]);
+    return size;
+}
+
+
+static int infix_op(const void *function) {
+    if (function == (const void*)add) return OP_ADD;
+    if (function == (const void*)sub) return OP_SUB;
+    if (function == (const void*)mul) return OP_MUL;
+    if (function == (const void*)divide) return OP_DIV;
+    if (function == (const void*)pow) return OP_POW;
+    if (function == (const void*)fmod) return OP_FMOD;
+    if (function == (const void*)bitwise_and) return OP_AND;
+    if (function == (const void*)bitwise_or) return OP_OR;
+    if (function == (const void*)comma) return OP_COMMA;
+    return -1;
+}
+
+
+static int bind_array(te_op *op, const te_expr *arg, int range) {
+    /* Points op at an array argument, which may be in the frame or a te_view. */
+    if (TYPE_MASK(arg->type) == TE_VARIABLE || TYPE_MASK(arg->type) == TE_VIEW) {
+        if (range) op->range = arg->bound; else op->bound = arg->bound;
+        if (TYPE_MASK(arg->type) == TE_VIEW) op->views |= range ? 2 : 1;
+        return 1;
+    }
+    if (arg->type == TE_SLOT) {
+        if (range) op->range_offset = arg->offset; else op->offset = arg->offset;
+        op->framed |= range ? 2 : 1;
+        return 1;
+    }
+    return 0;
+}
+
+
+static void lower(te_program *p, const te_expr *n, int slot) {
+    const int arity = ARITY(n->type);
+    int i;
+
+    if (slot + (arity ? arity : 1) > p->slots) p->slots = slot + (arity ? arity : 1);
+
+    /* Operands are emitted first, so each op finds its inputs ready. */
+    te_op op;
+    memset(&op, 0, sizeof(op));
+    op.slot = slot;
+
+    switch (TYPE_MASK(n->type)) {
+        case TE_CONSTANT: op.code = OP_CONST; op.value = n->value; break;
+        case TE_VARIABLE: op.code = OP_VAR; op.bound = n->bound; break;
+        case TE_SLOT: op.code = OP_SLOT; op.offset = n->offset; break;
+        case TE_TEMP: op.code = OP_TEMP; op.offset = n->offset; break;
+
+        case TE_LET:
+            lower(p, n->parameters[0], slot);
+            op.code = OP_STORE; op.offset = n->offset;
+            p->ops[p->count++] = op;
+            lower(p, n->parameters[1], slot);
+            return;
+
+        case TE_BITWISE:
+            /* Opcodes work on doubles, so the tree is lowered as it is. */
+            lower(p, n->parameters[0], slot);
+            return;
+
+        case TE_IF: {
+            /* Both branches write the condition's slot; the jumps are patched once their targets are known. */
+            lower(p, n->parameters[0], slot);
+            const int skip = p->count;
+            op.code = OP_JUMPZ;
+            p->ops[p->count++] = op;
+            lower(p, n->parameters[1], slot);
+            const int join = p->count;
+            op.code = OP_JUMP;
+            p->ops[p->count++] = op;
+            p->ops[skip].offset = p->count;
+            lower(p, n->parameters[2], slot);
+            p->ops[join].offset = p->count;
+            return;
+        }
+
+        case TE_REDUCE:
+            /* The statistics go straight into their temps. */
+            op.code = OP_REDUCE; op.slot = n->offset;
+            bind_array(&op, n->parameters[0], 0);
+            op.stats = REDUCE_STATS(n->type);
+            p->ops[p->count++] = op;
+            lower(p, n->parameters[1], slot);
+            return;
+
+        case TE_ARRAY: case TE_VIEW_ARRAY:
+            lower(p, n->parameters[0], slot);
+            op.code = n->type & TE_FLAG_PROVEN ? OP_INDEX : OP_ARRAY;
+            op.bound = n->bound; op.views = TYPE_MASK(n->type) == TE_VIEW_ARRAY;
+            break;
+
+        case TE_SLOT_ARRAY:
+            lower(p, n->parameters[0], slot);
+            op.code = OP_ARRAY; op.offset = n->offset; op.framed = 1;
+            break;
+
+        case TE_AGGREGATE:
+            bind_array(&op, n->parameters[0], 0);
+            op.code = n->function == (const void*)te_sum ? OP_SUM
+                : n->function == (const void*)te_arrlen ? OP_ARRLEN
+                : n->function == (const void*)te_arrmin ? OP_ARRMIN
+                : n->function == (const void*)te_arrmax ? OP_ARRMAX
+                : n->function == (const void*)te_mean ? OP_MEAN
+                : n->function == (const void*)te_variance ? OP_VARIANCE
+                : n->function == (const void*)te_argmin ? OP_ARGMIN : OP_ARGMAX;
+            break;
+
+        case TE_DOT:
+            bind_array(&op, n->parameters[0], 0);
+            bind_array(&op, n->parameters[1], 1);
+            op.code = OP_DOT;
+            break;
+
+        case TE_FUNCTION1:
+            if (n->function == (const void*)negate) {
+                lower(p, n->parameters[0], slot);
+                op.code = OP_NEG;
+                break;
+            }
+            /* Falls through. */
+
+        case TE_FUNCTION0: case TE_FUNCTION2: case TE_FUNCTION3:
+        case TE_FUNCTION4: case TE_FUNCTION5: case TE_FUNCTION6: case TE_FUNCTION7:
+            for (i = 0; i < arity; ++i) lower(p, n->parameters[i], slot + i);
+            op.code = arity == 2 ? infix_op(n->function) : -1;
+            if (op.code < 0) op.code = OP_FUN0 + arity;
+            op.function = n->function;
+            break;
+
+        case TE_LERP:
+            lower(p, n->parameters[2], slot);
+            bind_array(&op, n->parameters[0], 0);
+            bind_array(&op, n->parameters[1], 1);
+            op.code = n->type & TE_FLAG_PROVEN ? OP_SEGMENT : OP_LERP;
+            if (slopes_size(n)) {
+                op.slopes = memcpy(p->tables, n->parameters[3], slopes_size(n));
+                p->tables += slopes_size(n) / sizeof(double);
+            }
+            break;
+
+        case TE_CLOSURE0: case TE_CLOSURE1: case TE_CLOSURE2: case TE_CLOSURE3:
+        case TE_CLOSURE4: case TE_CLOSURE5: case TE_CLOSURE6: case TE_CLOSURE7:
+            for (i = 0; i < arity; ++i) lower(p, n->parameters[i], slot + i);
+            op.code = OP_CLO0 + arity;
+            op.function = n->function;
+            op.context = n->parameters[arity];
+            break;
+
+        default: op.code = OP_CONST; op.value = NAN; break;
+    }
+
+    p->ops[p->count++] = op;
+}
+
+
+te_program *te_lower(const te_expr *n) {
+    if (!n) return 0;
+    const int size = program_size(n);
+    te_program *p = malloc(sizeof(te_program) + sizeof(te_op) * (size - 1) + program_tables(n));
+    CHECK_NULL(p);
+
+    p->count = 0;
+    p->tables = (double*)(p->ops + size);
+    p->result = p->slots = temp_count(n);
+    lower(p, n, p->result);
+#ifdef TE_JIT_X86
+    int i;
+    p->runs = p->jit_failed = p->framed = 0;
+    p->native = 0;
+    for (i = 0; i < p->count; ++i) p->framed |= p->ops[i].framed || p->ops[i].code == OP_SLOT;
+#endif
+    return p;
+}
+
+
+static span op_span(const double *arr, int view) {
+    return view ? view_span((const te_view*)(const void*)arr) : prefix_span(arr);
+}
+
+
+static void array_step(const te_op *op, double *a, const double *arr, const double *range) {
+    /* The ops reading arrays, each of which is length prefixed or a te_view. */
+    const span x = op_span(arr, op->views & 1);
+    span y;
+    switch (op->code) {
+        case OP_ARRAY: {
+            const int idx = (int)a[0];
+            a[0] = (idx < 0 || idx >= x.len) ? NAN : AT(&x, idx);
+            break;
+        }
+        case OP_INDEX: a[0] = AT(&x, (int)a[0]); break;
+        case OP_SUM: a[0] = te_sum(&x); break;
+        case OP_ARRLEN: a[0] = te_arrlen(&x); break;
+        case OP_ARRMIN: a[0] = te_arrmin(&x); break;
+        case OP_ARRMAX: a[0] = te_arrmax(&x); break;
+        case OP_MEAN: a[0] = te_mean(&x); break;
+        case OP_VARIANCE: a[0] = te_variance(&x); break;
+        case OP_ARGMIN: a[0] = te_argmin(&x); break;
+        case OP_ARGMAX: a[0] = te_argmax(&x); break;
+        case OP_REDUCE: reduce_stats(&x, op->stats, a); break;
+        case OP_DOT:
+            y = op_span(range, op->views & 2);
+            a[0] = te_dot(&x, &y);
+            break;
+        case OP_LERP:
+            y = op_span(range, op->views & 2);
+            a[0] = lerp(&x, &y, op->slopes, a[0], LERP_HINT(&op->hint));
+            break;
+        case OP_SEGMENT:
+            y = op_span(range, op->views & 2);
+            a[0] = lerp_segment(&x, &y, op->slopes, a[0], LERP_HINT(&op->hint));
+            break;
+    }
+}
+
+
+#define TE_FUN(...) ((double(*)(__VA_ARGS__))op->function)
+
+static inline void step(const te_op *op, double *r, const char *frame) {
+    double *a = r + op->slot;
+    const double *arr = op->bound, *range = op->range;
+    if (op->framed) {
+        if (!frame) { a[0] = NAN; return; }
+        if (op->framed & 1) arr = (const double*)(frame + op->offset);
+        if (op->framed & 2) range = (const double*)(frame + op->range_offset);
+    }
+
+    switch (op->code) {
+        case OP_CONST: a[0] = op->value; break;
+        case OP_VAR: a[0] = *op->bound; break;
+        case OP_SLOT: a[0] = frame ? *(const double*)(frame + op->offset) : NAN; break;
+        case OP_TEMP: a[0] = r[op->offset]; break;
+        case OP_STORE: r[op->offset] = a[0]; break;
+        case OP_ARRAY: array_step(op, a, arr, range); break;
+
+        case OP_ADD: a[0] = a[0] + a[1]; break;
+        case OP_SUB: a[0] = a[0] - a[1]; break;
+        case OP_MUL: a[0] = a[0] * a[1]; break;
+        case OP_DIV: a[0] = a[0] / a[1]; break;
+        case OP_POW: a[0] = pow(a[0], a[1]); break;
+        case OP_FMOD: a[0] = fmod(a[0], a[1]); break;
+        case OP_AND: a[0] = bitwise_and(a[0], a[1]); break;
+        case OP_OR: a[0] = bitwise_or(a[0], a[1]); break;
+        case OP_NEG: a[0] = -a[0]; break;
+        case OP_COMMA: a[0] = a[1]; break;
+
+        case OP_SUM: case OP_ARRLEN: case OP_ARRMIN: case OP_ARRMAX: case OP_MEAN: case OP_VARIANCE:
+        case OP_ARGMIN: case OP_ARGMAX: case OP_DOT: case OP_REDUCE: case OP_LERP:
+        case OP_INDEX: case OP_SEGMENT:
+            array_step(op, a, arr, range);
+            break;
+
+        case OP_FUN0: a[0] = TE_FUN(void)(); break;
+        case OP_FUN1: a[0] = TE_FUN(double)(a[0]); break;
+        case OP_FUN2: a[0] = TE_FUN(double, double)(a[0], a[1]); break;
+        case OP_FUN3: a[0] = TE_FUN(double, double, double)(a[0], a[1], a[2]); break;
+        case OP_FUN4: a[0] = TE_FUN(double, double, double, double)(a[0], a[1], a[2], a[3]); break;
+        case OP_FUN5: a[0] = TE_FUN(double, double, double, double, double)(a[0], a[1], a[2], a[3], a[4]); break;
+        case OP_FUN6: a[0] = TE_FUN(double, double, double, double, double, double)(a[0], a[1], a[2], a[3], a[4], a[5]); break;
+        case OP_FUN7: a[0] = TE_FUN(double, double, double, double, double, double, double)(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+
+        case OP_CLO0: a[0] = TE_FUN(void*)(op->context); break;
+        case OP_CLO1: a[0] = TE_FUN(void*, double)(op->context, a[0]); break;
+        case OP_CLO2: a[0] = TE_FUN(void*, double, double)(op->context, a[0], a[1]); break;
+        case OP_CLO3: a[0] = TE_FUN(void*, double, double, double)(op->context, a[0], a[1], a[2]); break;
+        case OP_CLO4: a[0] = TE_FUN(void*, double, double, double, double)(op->context, a[0], a[1], a[2], a[3]); break;
+        case OP_CLO5: a[0] = TE_FUN(void*, double, double, double, double, double)(op->context, a[0], a[1], a[2], a[3], a[4]); break;
+        case OP_CLO6: a[0] = TE_FUN(void*, double, double, double, double, double, double)(op->context, a[0], a[1], a[2], a[3], a[4], a[5]); break;
+        case OP_CLO7: a[0] = TE_FUN(void*, double, double, double, double, double, double, double)(op->context, a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+    }
+}
+
+
+#ifdef TE_JIT_X86
+/* Native code for x86-64 (System V calls).
+ * Slot result+i lives in xmm i, so the result is already in xmm0 at the end.
+ * Temps and spilled slots live in r, and the frame is read in place. Code that
+ * makes no calls keeps both pointers in rsi and rdi, where they arrive; other
+ * code moves them to rbx and r12, which calls preserve. Calls clobber every
+ * xmm register, so the slots below a call are spilled around it. Ops with no
+ * inline form call step on their te_op. */
+
+#define JIT_REGISTERS 14 /* xmm14 and xmm15 are scratch. */
+#define JIT_OP_BYTES 384 /* Enough for the longest op: a call with every register live. */
+
+enum {RAX = 0, RDX = 2, RBX = 3, RSI = 6, RDI = 7, R12 = 12};
+enum {SD = 0xF2, PD = 0x66};
+enum {MOVSD_LOAD = 0x10, MOVSD_STORE = 0x11, MOVAPD = 0x28, UCOMISD = 0x2E, SQRTSD = 0x51, ANDPD = 0x54, XORPD = 0x57,
+    ADDSD = 0x58, MULSD = 0x59, SUBSD = 0x5C, DIVSD = 0x5E};
+
+typedef struct jit_buffer {
+    unsigned char *code;
+    int size;
+    int r, frame; /* The registers holding r and the frame. */
+} jit_buffer;
+
+
+static void emit(jit_buffer *b, const char *bytes, int count) {
+    memcpy(b->code + b->size, bytes, count);
+    b->size += count;
+}
+
+
+static void emit_byte(jit_buffer *b, int byte) {
+    b->code[b->size++] = (unsigned char)byte;
+}
+
+
+static void emit_imm64(jit_buffer *b, int reg, const void *bits) {
+    /* mov reg, imm64 */
+    emit_byte(b, 0x48 | (reg >= 8));
+    emit_byte(b, 0xB8 + (reg & 7));
+    emit(b, bits, 8);
+}
+
+
+static void emit_rr(jit_buffer *b, int prefix, int opcode, int dst, int src) {
+    emit_byte(b, prefix);
+    if (dst >= 8 || src >= 8) emit_byte(b, 0x40 | (dst >= 8) << 2 | (src >= 8));
+    emit_byte(b, 0x0F);
+    emit_byte(b, opcode);
+    emit_byte(b, 0xC0 | (dst & 7) << 3 | (src & 7));
+}
+
+
+static void emit_rm(jit_buffer *b, int opcode, int xmm, int base, int disp) {
+    /* movsd between xmm and [base + disp32] */
+    emit_byte(b, SD);
+    if (xmm >= 8 || base >= 8) emit_byte(b, 0x40 | (xmm >= 8) << 2 | (base >= 8));
+    emit_byte(b, 0x0F);
+    emit_byte(b, opcode);
+    emit_byte(b, 0x80 | (xmm & 7) << 3 | (base & 7));
+    if ((base & 7) == 4) emit_byte(b, 0x24);
+    emit(b, (const char*)&disp, 4);
+}
+
+
+static void emit_movq(jit_buffer *b, int xmm) {
+    /* movq xmm, rax */
+    emit_byte(b, PD);
+    emit_byte(b, 0x48 | (xmm >= 8) << 2);
+    emit_byte(b, 0x0F);
+    emit_byte(b, 0x6E);
+    emit_byte(b, 0xC0 | (xmm & 7) << 3);
+}
+
+
+static void emit_spill(jit_buffer *b, const te_program *p, int count, int opcode) {
+    int i;
+    for (i = 0; i < count; ++i) emit_rm(b, opcode, i, b->r, 8 * (p->result + i));
+}
+
+
+static void emit_call(jit_buffer *b, const void *function) {
+    emit_imm64(b, RAX, &function);
+    emit(b, "\xFF\xD0", 2); /* call rax */
+}
+
+
+static void emit_function(jit_buffer *b, const te_program *p, int reg, int arity,
+        const void *function, const void *context, int closure) {
+    int i;
+    emit_spill(b, p, reg, MOVSD_STORE);
+    /* Arguments move down to xmm0..., which never overwrites one still to move. */
+    for (i = 0; i < arity && reg; ++i) emit_rr(b, PD, MOVAPD, i, reg + i);
+    if (closure) emit_imm64(b, RDI, &context);
+    emit_call(b, function);
+    if (reg) emit_rr(b, PD, MOVAPD, reg, 0);
+    emit_spill(b, p, reg, MOVSD_LOAD);
+}
+
+
+static void jit_step(const te_op *op, double *r, const char *frame) {
+    step(op, r, frame);
+}
+
+
+static int inline_op(const te_op *op) {
+    /* Whether emit_op codes op without a call. */
+    if (op->framed) return 0;
+    if (op->code == OP_FUN1) return op->function == (const void*)sqrt || op->function == (const void*)fabs;
+    return (op->code <= OP_DIV && op->code != OP_ARRAY) || op->code == OP_NEG || op->code == OP_COMMA ||
+        op->code == OP_JUMP || op->code == OP_JUMPZ || (op->code == OP_INDEX && !op->views);
+}
+
+
+static void emit_op(jit_buffer *b, const te_program *p, const te_op *op) {
+    static const unsigned char arithmetic[] = {ADDSD, SUBSD, MULSD, DIVSD};
+    static const unsigned long long sign = 0x8000000000000000ULL, magnitude = ~sign;
+    const int reg = op->slot - p->result;
+
+    if (op->framed) goto fallback;
+    switch (op->code) {
+        case OP_CONST: emit_imm64(b, RAX, &op->value); emit_movq(b, reg); return;
+        case OP_VAR: emit_imm64(b, RAX, &op->bound); emit_rm(b, MOVSD_LOAD, reg, RAX, 0); return;
+        case OP_SLOT: emit_rm(b, MOVSD_LOAD, reg, b->frame, op->offset); return;
+        case OP_TEMP: emit_rm(b, MOVSD_LOAD, reg, b->r, 8 * op->offset); return;
+        case OP_STORE: emit_rm(b, MOVSD_STORE, reg, b->r, 8 * op->offset); return;
+
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+            emit_rr(b, SD, arithmetic[op->code - OP_ADD], reg, reg + 1);
+            return;
+        case OP_NEG:
+            emit_imm64(b, RAX, &sign);
+            emit_movq(b, 15);
+            emit_rr(b, PD, XORPD, reg, 15);
+            return;
+        case OP_COMMA: emit_rr(b, PD, MOVAPD, reg, reg + 1); return;
+
+        /* jit patches the rel32 that ends each jump. */
+        case OP_JUMP: emit(b, "\xE9\0\0\0\0", 5); return;
+        case OP_JUMPZ:
+            /* NaN compares unordered, which is not zero, so jp skips the je. */
+            emit_rr(b, PD, XORPD, 15, 15);
+            emit_rr(b, PD, UCOMISD, reg, 15);
+            emit(b, "\x7A\x06\x0F\x84\0\0\0\0", 8);
+            return;
+
+        case OP_INDEX: {
+            /* Views have a stride, so they go to step. */
+            if (op->views) break;
+            const double *data = op->bound + 1;
+            emit_byte(b, SD); /* cvttsd2si rax, xmm */
+            emit_byte(b, 0x48 | (reg >= 8));
+            emit(b, "\x0F\x2C", 2);
+            emit_byte(b, 0xC0 | (reg & 7));
+            emit_imm64(b, RDX, &data);
+            emit_byte(b, SD); /* movsd xmm, [rdx + rax*8] */
+            if (reg >= 8) emit_byte(b, 0x44);
+            emit(b, "\x0F\x10", 2);
+            emit_byte(b, 0x04 | (reg & 7) << 3);
+            emit_byte(b, 0xC2);
+            return;
+        }
+
+        case OP_POW: emit_function(b, p, reg, 2, (const void*)pow, 0, 0); return;
+        case OP_FMOD: emit_function(b, p, reg, 2, (const void*)fmod, 0, 0); return;
+        case OP_AND: emit_function(b, p, reg, 2, (const void*)bitwise_and, 0, 0); return;
+        case OP_OR: emit_function(b, p, reg, 2, (const void*)bitwise_or, 0, 0); return;
+
+        case OP_FUN1:
+            if (op->function == (const void*)sqrt) {
+                emit_rr(b, SD, SQRTSD, reg, reg);
+                return;
+            }
+            if (op->function == (const void*)fabs) {
+                emit_imm64(b, RAX, &magnitude);
+                emit_movq(b, 15);
+                emit_rr(b, PD, ANDPD, reg, 15);
+                return;
+            }
+            emit_function(b, p, reg, 1, op->function, 0, 0);
+            return;
+
+        default:
+            if (op->code >= OP_FUN0 && op->code <= OP_FUN7) {
+                emit_function(b, p, reg, op->code - OP_FUN0, op->function, 0, 0);
+                return;
+            }
+            if (op->code >= OP_CLO0 && op->code <= OP_CLO7) {
+                emit_function(b, p, reg, op->code - OP_CLO0, op->function, op->context, 1);
+                return;
+            }
+            break;
+    }
+
+fallback: {
+        /* step reads its operand from r and writes its result there. */
+        const int live = reg >= 0 ? reg + 1 : 0;
+        void (*helper)(const te_op*, double*, const char*) = jit_step;
+        emit_spill(b, p, live, MOVSD_STORE);
+        emit_imm64(b, RDI, &op);
+        emit(b, "\x48\x89\xDE\x4C\x89\xE2", 6); /* mov rsi, rbx; mov rdx, r12 */
+        emit_imm64(b, RAX, &helper);
+        emit(b, "\xFF\xD0", 2);
+        emit_spill(b, p, live, MOVSD_LOAD);
+    }
+}
+
+
+static void jit(te_program *p) {
+    /* Leaves p->native NULL if the program needs more registers than there are. */
+    if (p->slots - p->result > JIT_REGISTERS || p->slots > TE_PROGRAM_STACK_SLOTS) return;
+
+    int i, leaf = 1;
+    for (i = 0; i < p->count; ++i) leaf &= inline_op(p->ops + i);
+
+    /* Where each op's code starts, for the jumps to it. */
+    int *starts = malloc(sizeof(int) * (p->count + 1));
+    if (!starts) return;
+
+    jit_buffer b;
+    const int size = 64 + JIT_OP_BYTES * p->count;
+    b.code = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    b.size = 0;
+    b.r = leaf ? RSI : RBX;
+    b.frame = leaf ? RDI : R12;
+    if (b.code == MAP_FAILED) {
+        free(starts);
+        return;
+    }
+
+    /* push rbx; push r12; sub rsp, 8; mov r12, rdi; mov rbx, rsi */
+    if (!leaf) emit(&b, "\x53\x41\x54\x48\x83\xEC\x08\x49\x89\xFC\x48\x89\xF3", 13);
+    for (i = 0; i < p->count; ++i) {
+        starts[i] = b.size;
+        emit_op(&b, p, p->ops + i);
+    }
+    starts[p->count] = b.size;
+    for (i = 0; i < p->count; ++i) {
+        if (p->ops[i].code != OP_JUMP && p->ops[i].code != OP_JUMPZ) continue;
+        const int end = starts[i + 1], rel = starts[p->ops[i].offset] - end;
+        memcpy(b.code + end - 4, &rel, 4);
+    }
+    free(starts);
+    /* add rsp, 8; pop r12; pop rbx */
+    if (!leaf) emit(&b, "\x48\x83\xC4\x08\x41\x5C\x5B", 7);
+    emit_byte(&b, 0xC3); /* ret */
+
+    if (mprotect(b.code, size, PROT_READ | PROT_EXEC)) {
+        munmap(b.code, size);
+        return;
+    }
+    p->native_size = size;
+    p->native_scratch = !leaf || p->result > 0;
+    __atomic_store_n(&p->native, (double(*)(const char*, double*))(void*)b.code, __ATOMIC_RELEASE);
+}
+
+
+static double (*native_code(const te_program *program, const char *frame))(const char*, double*) {
+    te_program *p = (te_program*)program;
+    double (*native)(const char*, double*) = __atomic_load_n(&p->native, __ATOMIC_ACQUIRE);
+    if (!native && !__atomic_load_n(&p->jit_failed, __ATOMIC_RELAXED) &&
+        __atomic_fetch_add(&p->runs, 1, __ATOMIC_RELAXED) == TE_JIT_THRESHOLD) {
+        /* Only the call that counts the threshold compiles; others interpret meanwhile. */
+        jit(p);
+        native = p->native;
+        if (!native) __atomic_store_n(&p->jit_failed, 1, __ATOMIC_RELAXED);
+    }
+    return native && (frame || !p->framed) ? native : 0;
+}
+#endif
+
+
+#ifdef TE_JIT_X86
+__attribute__((noinline)) /* Keeps the interpreter's prologue off the native path. */
+#endif
+static double run(const te_program *p, const char *frame) {
+    if (!p) return NAN;
+
+    double stack[TE_PROGRAM_STACK_SLOTS];
+    double *r = stack;
+    if (p->slots > TE_PROGRAM_STACK_SLOTS) {
+        r = malloc(sizeof(double) * p->slots);
+        if (!r) return NAN;
+    }
+    r[p->result] = NAN;
+
+    const te_op *op = p->ops, *end = p->ops + p->count;
+    while (op < end) {
+        if (op->code == OP_JUMP || op->code == OP_JUMPZ) {
+            op = op->code == OP_JUMP || r[op->slot] == 0 ? p->ops + op->offset : op + 1;
+            continue;
+        }
+        step(op++, r, frame);
+    }
+
+    const double ret = r[p->result];
+    if (r != stack) free(r);
+    return ret;
+}
+
+#undef TE_FUN
+
+
+static double evaluate(const te_program *p, const char *frame) {
+#ifdef TE_JIT_X86
+    double (*native)(const char*, double*) = p ? native_code(p, frame) : 0;
+    if (native && !p->native_scratch) return native(frame, 0);
+    if (native) {
+        double r[TE_PROGRAM_STACK_SLOTS];
+        return native(frame, r);
+    }
+#endif
+    return run(p, frame);
+}
+
+
+double te_program_eval(const te_program *p) {
+    return evaluate(p, 0);
+}
+
+
+double te_program_eval_frame(const te_program *p, const void *frame) {
+    return evaluate(p, frame);
+}
+
+
+void te_program_free(te_program *p) {
+#ifdef TE_JIT_X86
+    if (p && p->native) munmap((void*)p->native, p->native_size);
+#endif
+    free(p);
+}
+
+
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+/* Batch evaluation:                                                    */
+/*   each node is evaluated for a whole block of rows at a time         */
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+
+#define TE_BATCH_BLOCK 128
+
+/* Block kernels for pure builtins. Every kernel gives the same result as
+ * calling its builtin on each element (NaN payloads aside):
+ *   sqrt        correctly rounded, 0 ulp
+ *   abs         exact
+ *   floor, ceil exact
+ *   + - * /     correctly rounded, 0 ulp
+ * The remaining builtins (sin, cos, exp, ln, log, pow, ...) have no kernel
+ * and call libm per element, so their accuracy is libm's. The float kernels
+ * of te_eval_batchf compare the same way to sqrtf, fabsf, floorf, ceilf and
+ * float arithmetic, and are keyed by the same builtins. */
+typedef struct kernel1 {const void *function; void (*run)(double *x, int count);} kernel1;
+typedef struct kernel2 {int op; void (*run)(double *a, const double *b, int count);} kernel2;
+typedef struct kernelf1 {const void *function; void (*run)(float *x, int count);} kernelf1;
+typedef struct kernelf2 {int op; void (*run)(float *a, const float *b, int count);} kernelf2;
+
+/* Vector body over whole vectors of WIDTH lanes, scalar tail. */
+#define KERNEL1(NAME, ATTR, WIDTH, VEC, SCALAR) \
+    ATTR static void NAME(double *x, int count) { \
+        int i = 0; \
+        for (; i + WIDTH <= count; i += WIDTH) VEC; \
+        for (; i < count; ++i) x[i] = SCALAR(x[i]); \
+    }
+#define KERNEL2(NAME, ATTR, WIDTH, VEC, OP) \
+    ATTR static void NAME(double *a, const double *b, int count) { \
+        int i = 0; \
+        for (; i + WIDTH <= count; i += WIDTH) VEC; \
+        for (; i < count; ++i) a[i] = a[i] OP b[i]; \
+    }
+#define KERNEL1F(NAME, ATTR, WIDTH, VEC, SCALAR) \
+    ATTR static void NAME(float *x, int count) { \
+        int i = 0; \
+        for (; i + WIDTH <= count; i += WIDTH) VEC; \
+        for (; i < count; ++i) x[i] = SCALAR(x[i]); \
+    }
+#define KERNEL2F(NAME, ATTR, WIDTH, VEC, OP) \
+    ATTR static void NAME(float *a, const float *b, int count) { \
+        int i = 0; \
+        for (; i + WIDTH <= count; i += WIDTH) VEC; \
+        for (; i < count; ++i) a[i] = a[i] OP b[i]; \
+    }
+
+#ifdef TE_SIMD_X86
+
+KERNEL1(sse2_sqrt, SSE2, 2, _mm_storeu_pd(x + i, _mm_sqrt_pd(_mm_loadu_pd(x + i))), sqrt)
+KERNEL1(sse2_fabs, SSE2, 2, _mm_storeu_pd(x + i, _mm_andnot_pd(_mm_set1_pd(-0.0), _mm_loadu_pd(x + i))), fabs)
+KERNEL2(sse2_add, SSE2, 2, _mm_storeu_pd(a + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))), +)
+KERNEL2(sse2_sub, SSE2, 2, _mm_storeu_pd(a + i, _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))), -)
+KERNEL2(sse2_mul, SSE2, 2, _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))), *)
+KERNEL2(sse2_div, SSE2, 2, _mm_storeu_pd(a + i, _mm_div_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))), /)
+
+KERNEL1(avx2_sqrt, AVX2, 4, _mm256_storeu_pd(x + i, _mm256_sqrt_pd(_mm256_loadu_pd(x + i))), sqrt)
+KERNEL1(avx2_fabs, AVX2, 4, _mm256_storeu_pd(x + i, _mm256_andnot_pd(_mm256_set1_pd(-0.0), _mm256_loadu_pd(x + i))), fabs)
+KERNEL1(avx2_floor, AVX2, 4, _mm256_storeu_pd(x + i, _mm256_floor_pd(_mm256_loadu_pd(x + i))), floor)
+KERNEL1(avx2_ceil, AVX2, 4, _mm256_storeu_pd(x + i, _mm256_ceil_pd(_mm256_loadu_pd(x + i))), ceil)
+KERNEL2(avx2_add, AVX2, 4, _mm256_storeu_pd(a + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))), +)
+KERNEL2(avx2_sub, AVX2, 4, _mm256_storeu_pd(a + i, _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))), -)
+KERNEL2(avx2_mul, AVX2, 4, _mm256_storeu_pd(a + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))), *)
+KERNEL2(avx2_div, AVX2, 4, _mm256_storeu_pd(a + i, _mm256_div_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))), /)
+
+KERNEL1(avx512_sqrt, AVX512, 8, _mm512_storeu_pd(x + i, _mm512_sqrt_pd(_mm512_loadu_pd(x + i))), sqrt)
+KERNEL1(avx512_fabs, AVX512, 8, _mm512_storeu_pd(x + i, _mm512_abs_pd(_mm512_loadu_pd(x + i))), fabs)
+KERNEL1(avx512_floor, AVX512, 8, _mm512_storeu_pd(x + i, _mm512_roundscale_pd(_mm512_loadu_pd(x + i), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)), floor)
+KERNEL1(avx512_ceil, AVX512, 8, _mm512_storeu_pd(x + i, _mm512_roundscale_pd(_mm512_loadu_pd(x + i), _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC)), ceil)
+KERNEL2(avx512_add, AVX512, 8, _mm512_storeu_pd(a + i, _mm512_add_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i))), +)
+KERNEL2(avx512_sub, AVX512, 8, _mm512_storeu_pd(a + i, _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i))), -)
+KERNEL2(avx512_mul, AVX512, 8, _mm512_storeu_pd(a + i, _mm512_mul_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i))), *)
+KERNEL2(avx512_div, AVX512, 8, _mm512_storeu_pd(a + i, _mm512_div_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i))), /)
+
+static const kernel1 sse2_kernels1[] = {{sqrt, sse2_sqrt}, {fabs, sse2_fabs}, {0, 0}};
+static const kernel2 sse2_kernels2[] = {{OP_ADD, sse2_add}, {OP_SUB, sse2_sub}, {OP_MUL, sse2_mul}, {OP_DIV, sse2_div}, {0, 0}};
+static const kernel1 avx2_kernels1[] = {{sqrt, avx2_sqrt}, {fabs, avx2_fabs}, {floor, avx2_floor}, {ceil, avx2_ceil}, {0, 0}};
+static const kernel2 avx2_kernels2[] = {{OP_ADD, avx2_add}, {OP_SUB, avx2_sub}, {OP_MUL, avx2_mul}, {OP_DIV, avx2_div}, {0, 0}};
+static const kernel1 avx512_kernels1[] = {{sqrt, avx512_sqrt}, {fabs, avx512_fabs}, {floor, avx512_floor}, {ceil, avx512_ceil}, {0, 0}};
+static const kernel2 avx512_kernels2[] = {{OP_ADD, avx512_add}, {OP_SUB, avx512_sub}, {OP_MUL, avx512_mul}, {OP_DIV, avx512_div}, {0, 0}};
+
+static void select_kernels(const kernel1 **k1, const kernel2 **k2) {
+    if (__builtin_cpu_supports("avx512f")) {
+        *k1 = avx512_kernels1; *k2 = avx512_kernels2;
+    } else if (__builtin_cpu_supports("avx2")) {
+        *k1 = avx2_kernels1; *k2 = avx2_kernels2;
+    } else {
+        *k1 = sse2_kernels1; *k2 = sse2_kernels2;
+    }
+}
+
+/* Twice the lanes of the double kernels. */
+KERNEL1F(sse2_sqrtf, SSE2, 4, _mm_storeu_ps(x + i, _mm_sqrt_ps(_mm_loadu_ps(x + i))), sqrtf)
+KERNEL1F(sse2_fabsf, SSE2, 4, _mm_storeu_ps(x + i, _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_loadu_ps(x + i))), fabsf)
+KERNEL2F(sse2_addf, SSE2, 4, _mm_storeu_ps(a + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))), +)
+KERNEL2F(sse2_subf, SSE2, 4, _mm_storeu_ps(a + i, _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))), -)
+KERNEL2F(sse2_mulf, SSE2, 4, _mm_storeu_ps(a + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))), *)
+KERNEL2F(sse2_divf, SSE2, 4, _mm_storeu_ps(a + i, _mm_div_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i))), /)
+
+KERNEL1F(avx2_sqrtf, AVX2, 8, _mm256_storeu_ps(x + i, _mm256_sqrt_ps(_mm256_loadu_ps(x + i))), sqrtf)
+KERNEL1F(avx2_fabsf, AVX2, 8, _mm256_storeu_ps(x + i, _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_loadu_ps(x + i))), fabsf)
+KERNEL1F(avx2_floorf, AVX2, 8, _mm256_storeu_ps(x + i, _mm256_floor_ps(_mm256_loadu_ps(x + i))), floorf)
+KERNEL1F(avx2_ceilf, AVX2, 8, _mm256_storeu_ps(x + i, _mm256_ceil_ps(_mm256_loadu_ps(x + i))), ceilf)
+KERNEL2F(avx2_addf, AVX2, 8, _mm256_storeu_ps(a + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))), +)
+KERNEL2F(avx2_subf, AVX2, 8, _mm256_storeu_ps(a + i, _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))), -)
+KERNEL2F(avx2_mulf, AVX2, 8, _mm256_storeu_ps(a + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))), *)
+KERNEL2F(avx2_divf, AVX2, 8, _mm256_storeu_ps(a + i, _mm256_div_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i))), /)
+
+KERNEL1F(avx512_sqrtf, AVX512, 16, _mm512_storeu_ps(x + i, _mm512_sqrt_ps(_mm512_loadu_ps(x + i))), sqrtf)
+KERNEL1F(avx512_fabsf, AVX512, 16, _mm512_storeu_ps(x + i, _mm512_abs_ps(_mm512_loadu_ps(x + i))), fabsf)
+KERNEL1F(avx512_floorf, AVX512, 16, _mm512_storeu_ps(x + i, _mm512_roundscale_ps(_mm512_loadu_ps(x + i), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)), floorf)
+KERNEL1F(avx512_ceilf, AVX512, 16, _mm512_storeu_ps(x + i, _mm512_roundscale_ps(_mm512_loadu_ps(x + i), _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC)), ceilf)
+KERNEL2F(avx512_addf, AVX512, 16, _mm512_storeu_ps(a + i, _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))), +)
+KERNEL2F(avx512_subf, AVX512, 16, _mm512_storeu_ps(a + i, _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))), -)
+KERNEL2F(avx512_mulf, AVX512, 16, _mm512_storeu_ps(a + i, _mm512_mul_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))), *)
+KERNEL2F(avx512_divf, AVX512, 16, _mm512_storeu_ps(a + i, _mm512_div_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i))), /)
+
+static const kernelf1 sse2_kernelsf1[] = {{sqrt, sse2_sqrtf}, {fabs, sse2_fabsf}, {0, 0}};
+static const kernelf2 sse2_kernelsf2[] = {{OP_ADD, sse2_addf}, {OP_SUB, sse2_subf}, {OP_MUL, sse2_mulf}, {OP_DIV, sse2_divf}, {0, 0}};
+static const kernelf1 avx2_kernelsf1[] = {{sqrt, avx2_sqrtf}, {fabs, avx2_fabsf}, {floor, avx2_floorf}, {ceil, avx2_ceilf}, {0, 0}};
+static const kernelf2 avx2_kernelsf2[] = {{OP_ADD, avx2_addf}, {OP_SUB, avx2_subf}, {OP_MUL, avx2_mulf}, {OP_DIV, avx2_divf}, {0, 0}};
+static const kernelf1 avx512_kernelsf1[] = {{sqrt, avx512_sqrtf}, {fabs, avx512_fabsf}, {floor, avx512_floorf}, {ceil, avx512_ceilf}, {0, 0}};
+static const kernelf2 avx512_kernelsf2[] = {{OP_ADD, avx512_addf}, {OP_SUB, avx512_subf}, {OP_MUL, avx512_mulf}, {OP_DIV, avx512_divf}, {0, 0}};
+
+static void select_kernelsf(const kernelf1 **k1, const kernelf2 **k2) {
+    if (__builtin_cpu_supports("avx512f")) {
+        *k1 = avx512_kernelsf1; *k2 = avx512_kernelsf2;
+    } else if (__builtin_cpu_supports("avx2")) {
+        *k1 = avx2_kernelsf1; *k2 = avx2_kernelsf2;
+    } else {
+        *k1 = sse2_kernelsf1; *k2 = sse2_kernelsf2;
+    }
+}
+
+#undef SSE2
+#undef AVX2
+#undef AVX512
+
+#elif defined(TE_SIMD_NEON)
+
+KERNEL1(neon_sqrt, , 2, vst1q_f64(x + i, vsqrtq_f64(vld1q_f64(x + i))), sqrt)
+KERNEL1(neon_fabs, , 2, vst1q_f64(x + i, vabsq_f64(vld1q_f64(x + i))), fabs)
+KERNEL1(neon_floor, , 2, vst1q_f64(x + i, vrndmq_f64(vld1q_f64(x + i))), floor)
+KERNEL1(neon_ceil, , 2, vst1q_f64(x + i, vrndpq_f64(vld1q_f64(x + i))), ceil)
+KERNEL2(neon_add, , 2, vst1q_f64(a + i, vaddq_f64(vld1q_f64(a + i), vld1q_f64(b + i))), +)
+KERNEL2(neon_sub, , 2, vst1q_f64(a + i, vsubq_f64(vld1q_f64(a + i), vld1q_f64(b + i))), -)
+KERNEL2(neon_mul, , 2, vst1q_f64(a + i, vmulq_f64(vld1q_f64(a + i), vld1q_f64(b + i))), *)
+KERNEL2(neon_div, , 2, vst1q_f64(a + i, vdivq_f64(vld1q_f64(a + i), vld1q_f64(b + i))), /)
+
+static const kernel1 neon_kernels1[] = {{sqrt, neon_sqrt}, {fabs, neon_fabs}, {floor, neon_floor}, {ceil, neon_ceil}, {0, 0}};
+static const kernel2 neon_kernels2[] = {{OP_ADD, neon_add}, {OP_SUB, neon_sub}, {OP_MUL, neon_mul}, {OP_DIV, neon_div}, {0, 0}};
+
+static void select_kernels(const kernel1 **k1, const kernel2 **k2) {
+    *k1 = neon_kernels1; *k2 = neon_kernels2;
+}
+
+KERNEL1F(neon_sqrtf, , 4, vst1q_f32(x + i, vsqrtq_f32(vld1q_f32(x + i))), sqrtf)
+KERNEL1F(neon_fabsf, , 4, vst1q_f32(x + i, vabsq_f32(vld1q_f32(x + i))), fabsf)
+KERNEL1F(neon_floorf, , 4, vst1q_f32(x + i, vrndmq_f32(vld1q_f32(x + i))), floorf)
+KERNEL1F(neon_ceilf, , 4, vst1q_f32(x + i, vrndpq_f32(vld1q_f32(x + i))), ceilf)
+KERNEL2F(neon_addf, , 4, vst1q_f32(a + i, vaddq_f32(vld1q_f32(a + i), vld1q_f32(b + i))), +)
+KERNEL2F(neon_subf, , 4, vst1q_f32(a + i, vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i))), -)
+KERNEL2F(neon_mulf, , 4, vst1q_f32(a + i, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i))), *)
+KERNEL2F(neon_divf, , 4, vst1q_f32(a + i, vdivq_f32(vld1q_f32(a + i), vld1q_f32(b + i))), /)
+
+static const kernelf1 neon_kernelsf1[] = {{sqrt, neon_sqrtf}, {fabs, neon_fabsf}, {floor, neon_floorf}, {ceil, neon_ceilf}, {0, 0}};
+static const kernelf2 neon_kernelsf2[] = {{OP_ADD, neon_addf}, {OP_SUB, neon_subf}, {OP_MUL, neon_mulf}, {OP_DIV, neon_divf}, {0, 0}};
+
+static void select_kernelsf(const kernelf1 **k1, const kernelf2 **k2) {
+    *k1 = neon_kernelsf1; *k2 = neon_kernelsf2;
+}
+
+#else
+
+KERNEL2(plain_add, , 1, a[i] = a[i] + b[i], +)
+KERNEL2(plain_sub, , 1, a[i] = a[i] - b[i], -)
+KERNEL2(plain_mul, , 1, a[i] = a[i] * b[i], *)
+KERNEL2(plain_div, , 1, a[i] = a[i] / b[i], /)
+
+static const kernel1 plain_kernels1[] = {{0, 0}};
+static const kernel2 plain_kernels2[] = {{OP_ADD, plain_add}, {OP_SUB, plain_sub}, {OP_MUL, plain_mul}, {OP_DIV, plain_div}, {0, 0}};
+
+static void select_kernels(const kernel1 **k1, const kernel2 **k2) {
+    *k1 = plain_kernels1; *k2 = plain_kernels2;
+}
+
+KERNEL2F(plain_addf, , 1, a[i] = a[i] + b[i], +)
+KERNEL2F(plain_subf, , 1, a[i] = a[i] - b[i], -)
+KERNEL2F(plain_mulf, , 1, a[i] = a[i] * b[i], *)
+KERNEL2F(plain_divf, , 1, a[i] = a[i] / b[i], /)
+
+static const kernelf1 plain_kernelsf1[] = {{0, 0}};
+static const kernelf2 plain_kernelsf2[] = {{OP_ADD, plain_addf}, {OP_SUB, plain_subf}, {OP_MUL, plain_mulf}, {OP_DIV, plain_divf}, {0, 0}};
+
+static void select_kernelsf(const kernelf1 **k1, const kernelf2 **k2) {
+    *k1 = plain_kernelsf1; *k2 = plain_kernelsf2;
+}
+
+#endif
+
+#undef KERNEL1
+#undef KERNEL2
+#undef KERNEL1F
+#undef KERNEL2F
+
+
+typedef struct batch {
+    const te_column *columns;
+    int column_count;
+    const char *frames;
+    int frame_size;
+    double *temps; /* TE_BATCH_BLOCK rows per temp. */
+    int row;
+    const kernel1 *kernels1;
+    const kernel2 *kernels2;
+
+    /* Only for te_eval_batchf. */
+    const te_columnf *fcolumns;
+    float *ftemps; /* As temps, which hold the same values widened. */
+    te_column *wide; /* Each column's block as doubles, for subtrees run in double. */
+    const kernelf1 *fkernels1;
+    const kernelf2 *fkernels2;
+} batch;
+
+
+static void eval_block(const te_expr *n, const batch *b, int count, double *out);
+
+
+static void fill_block(double *out, int count, double value) {
+    int i;
+    for (i = 0; i < count; ++i) out[i] = value;
+}
+
+
+static const char *row_frame(const batch *b, int i) {
+    /* Row i of a block reads the (row + i)th frame. */
+    return b->frames ? b->frames + (size_t)(b->row + i) * b->frame_size : 0;
+}
+
+
+static void load_block(const te_expr *n, const batch *b, int count, double *out) {
+    int i, c;
+    for (c = 0; c < b->column_count; ++c) {
+        const te_column *col = b->columns + c;
+        if (col->address != n->bound) continue;
+
+        if (col->stride == 1) {
+            memcpy(out, col->data + b->row, sizeof(double) * count);
+        } else {
+            const double *src = col->data + (size_t)b->row * col->stride;
+            for (i = 0; i < count; ++i) out[i] = src[(size_t)i * col->stride];
+        }
+        return;
+    }
+
+    /* Not a column: every row sees the bound value. */
+    fill_block(out, count, *n->bound);
+}
+
+
+#define TE_FUN(...) ((double(*)(__VA_ARGS__))n->function)
+
+static void call_block(const te_expr *n, const batch *b, int count, double *out) {
+    /* Functions of three or more arguments, called once per row. */
+    double args[7][TE_BATCH_BLOCK];
+    const int arity = ARITY(n->type);
+    void *ctx = IS_CLOSURE(n->type) ? n->parameters[arity] : 0;
+    int i, j;
+
+    for (j = 0; j < arity; ++j) eval_block(n->parameters[j], b, count, args[j]);
+
+    for (i = 0; i < count; ++i) {
+        double a[7];
+        for (j = 0; j < arity; ++j) a[j] = args[j][i];
+
+        if (IS_CLOSURE(n->type)) {
+            switch (arity) {
+                case 3: out[i] = TE_FUN(void*, double, double, double)(ctx, a[0], a[1], a[2]); break;
+                case 4: out[i] = TE_FUN(void*, double, double, double, double)(ctx, a[0], a[1], a[2], a[3]); break;
+                case 5: out[i] = TE_FUN(void*, double, double, double, double, double)(ctx, a[0], a[1], a[2], a[3], a[4]); break;
+                case 6: out[i] = TE_FUN(void*, double, double, double, double, double, double)(ctx, a[0], a[1], a[2], a[3], a[4], a[5]); break;
+                case 7: out[i] = TE_FUN(void*, double, double, double, double, double, double, double)(ctx, a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+            }
+        } else {
+            switch (arity) {
+                case 3: out[i] = TE_FUN(double, double, double)(a[0], a[1], a[2]); break;
+                case 4: out[i] = TE_FUN(double, double, double, double)(a[0], a[1], a[2], a[3]); break;
+                case 5: out[i] = TE_FUN(double, double, double, double, double)(a[0], a[1], a[2], a[3], a[4]); break;
+                case 6: out[i] = TE_FUN(double, double, double, double, double, double)(a[0], a[1], a[2], a[3], a[4], a[5]); break;
+                case 7: out[i] = TE_FUN(double, double, double, double, double, double, double)(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+            }
+        }
+    }
+}
+
+
+static void vector_block(const te_expr *n, const batch *b, int count, double *out) {
+    /* A function with a vector form is called once for the whole block. */
+    double args[7][TE_BATCH_BLOCK];
+    const double *columns[7];
+    const int arity = ARITY(n->type);
+    int j;
+
+    for (j = 0; j < arity; ++j) {
+        eval_block(n->parameters[j], b, count, args[j]);
+        columns[j] = args[j];
+    }
+    VECTOR(n)(IS_CLOSURE(n->type) ? n->parameters[arity] : 0, columns, out, count);
+}
+
+
+#ifdef TE_PROFILE
+static void eval_rows(const te_expr *n, const batch *b, int count, double *out);
+
+static void eval_block(const te_expr *n, const batch *b, int count, double *out) {
+    /* Each row counts as one evaluation of n. */
+    const unsigned long long start = TICKS();
+    eval_rows(n, b, count, out);
+    PROFILE_ADD(&STATS(n)->ticks, TICKS() - start);
+    PROFILE_ADD(&STATS(n)->count, count);
+}
+#else
+#define eval_rows eval_block
+#endif
+
+static void eval_rows(const te_expr *n, const batch *b, int count, double *out) {
+    double tmp[TE_BATCH_BLOCK];
+    const kernel1 *k1;
+    const kernel2 *k2;
+    int i, op;
+
+    if (n->type & TE_FLAG_VECTOR) {
+        vector_block(n, b, count, out);
+        return;
+    }
+
+    switch (TYPE_MASK(n->type)) {
+        case TE_CONSTANT: fill_block(out, count, n->value); return;
+        case TE_VARIABLE: load_block(n, b, count, out); return;
+
+        case TE_SLOT:
+            if (!b->frames) {
+                fill_block(out, count, NAN);
+                return;
+            }
+            for (i = 0; i < count; ++i) out[i] = *(const double*)(row_frame(b, i) + n->offset);
+            return;
+
+        case TE_TEMP: memcpy(out, b->temps + n->offset * TE_BATCH_BLOCK, sizeof(double) * count); return;
+
+        case TE_LET:
+            eval_block(n->parameters[0], b, count, b->temps + n->offset * TE_BATCH_BLOCK);
+            eval_block(n->parameters[1], b, count, out);
+            return;
+
+        case TE_BITWISE: eval_block(n->parameters[0], b, count, out); return;
+
+        case TE_IF: {
+            /* A branch only runs for the block if some row takes it; mixed blocks select per row. */
+            double other[TE_BATCH_BLOCK];
+            int taken = 0;
+            eval_block(n->parameters[0], b, count, tmp);
+            for (i = 0; i < count; ++i) taken += tmp[i] != 0;
+            if (taken) eval_block(n->parameters[1], b, count, out);
+            if (taken == count) return;
+            eval_block(n->parameters[2], b, count, taken ? other : out);
+            if (!taken) return;
+            for (i = 0; i < count; ++i) out[i] = tmp[i] != 0 ? out[i] : other[i];
+            return;
+        }
+
+        case TE_REDUCE: {
+            double stats[7];
+            reduce_node(n, 0, stats);
+            for (i = 0; i < stat_count(REDUCE_STATS(n->type)); ++i) {
+                fill_block(b->temps + (n->offset + i) * TE_BATCH_BLOCK, count, stats[i]);
+            }
+            eval_block(n->parameters[1], b, count, out);
+            return;
+        }
+
+        case TE_ARRAY: case TE_VIEW_ARRAY: {
+            span a;
+            array_span(n, 0, &a);
+            eval_block(n->parameters[0], b, count, out);
+            if (n->type & TE_FLAG_PROVEN) {
+                for (i = 0; i < count; ++i) out[i] = AT(&a, (int)out[i]);
+                return;
+            }
+            for (i = 0; i < count; ++i) {
+                const int idx = (int)out[i];
+                out[i] = (idx < 0 || idx >= a.len) ? NAN : AT(&a, idx);
+            }
+            return;
+        }
+
+        case TE_SLOT_ARRAY:
+            eval_block(n->parameters[0], b, count, out);
+            for (i = 0; i < count; ++i) {
+                span a;
+                const int idx = (int)out[i];
+                out[i] = (!array_span(n, row_frame(b, i), &a) || idx < 0 || idx >= a.len) ? NAN : AT(&a, idx);
+            }
+            return;
+
+        case TE_FUNCTION0:
+            for (i = 0; i < count; ++i) out[i] = TE_FUN(void)();
+            return;
+
+        case TE_CLOSURE0:
+            for (i = 0; i < count; ++i) out[i] = TE_FUN(void*)(n->parameters[0]);
+            return;
+
+        case TE_AGGREGATE: case TE_DOT:
+            if (((const te_expr*)n->parameters[0])->type == TE_SLOT ||
+                (TYPE_MASK(n->type) == TE_DOT && ((const te_expr*)n->parameters[1])->type == TE_SLOT)) {
+                /* Each row has its own array. */
+                for (i = 0; i < count; ++i) out[i] = eval(n, row_frame(b, i), 0);
+                return;
+            }
+            /* Arrays are not columns, so the aggregate is the same for every row. */
+            fill_block(out, count, te_eval(n));
+            return;
+
+        case TE_FUNCTION1:
+            eval_block(n->parameters[0], b, count, out);
+            if (n->function == (const void*)negate) {
+                for (i = 0; i < count; ++i) out[i] = -out[i];
+                return;
+            }
+            for (k1 = b->kernels1; k1->function; ++k1) {
+                if (k1->function == n->function) {
+                    k1->run(out, count);
+                    return;
+                }
+            }
+            for (i = 0; i < count; ++i) out[i] = TE_FUN(double)(out[i]);
+            return;
+
+        case TE_CLOSURE1:
+            eval_block(n->parameters[0], b, count, out);
+            for (i = 0; i < count; ++i) out[i] = TE_FUN(void*, double)(n->parameters[1], out[i]);
+            return;
+
+        case TE_FUNCTION2: case TE_CLOSURE2:
+            eval_block(n->parameters[0], b, count, out);
+            eval_block(n->parameters[1], b, count, tmp);
+            if (IS_CLOSURE(n->type)) {
+                for (i = 0; i < count; ++i) out[i] = TE_FUN(void*, double, double)(n->parameters[2], out[i], tmp[i]);
+                return;
+            }
+            op = infix_op(n->function);
+            if (op == OP_COMMA) {
+                memcpy(out, tmp, sizeof(double) * count);
+                return;
+            }
+            for (k2 = b->kernels2; k2->run; ++k2) {
+                if (k2->op == op) {
+                    k2->run(out, tmp, count);
+                    return;
+                }
+            }
+            for (i = 0; i < count; ++i) out[i] = TE_FUN(double, double)(out[i], tmp[i]);
+            return;
+
+        case TE_LERP: {
+            /* Neighbouring rows tend to fall in the same segment. */
+            const te_expr *d = n->parameters[0], *r = n->parameters[1];
+            int hint = 0;
+            eval_block(n->parameters[2], b, count, out);
+            if (n->type & TE_FLAG_PROVEN) {
+                /* prove only marks immutable tables, whose spans are the same for every row. */
+                span domain, range;
+                array_span(d, 0, &domain);
+                array_span(r, 0, &range);
+                for (i = 0; i < count; ++i) out[i] = lerp_segment(&domain, &range, n->parameters[3], out[i], &hint);
+                return;
+            }
+            for (i = 0; i < count; ++i) {
+                span domain, range;
+                out[i] = array_span(d, row_frame(b, i), &domain) && array_span(r, row_frame(b, i), &range)
+                    ? lerp(&domain, &range, n->parameters[3], out[i], &hint) : NAN;
+            }
+            return;
+        }
+
+        case TE_FUNCTION3: case TE_FUNCTION4: case TE_FUNCTION5: case TE_FUNCTION6: case TE_FUNCTION7:
+        case TE_CLOSURE3: case TE_CLOSURE4: case TE_CLOSURE5: case TE_CLOSURE6: case TE_CLOSURE7:
+            call_block(n, b, count, out);
+            return;
+
+        default: fill_block(out, count, NAN); return;
+    }
+}
+
+#undef TE_FUN
+
+
+static void run_block(const te_expr *n, batch *b, int temps, int rows, double *out) {
+    /* Evaluates the block of rows starting at b->row. */
+    const int count = rows - b->row < TE_BATCH_BLOCK ? rows - b->row : TE_BATCH_BLOCK;
+    if (n && (b->temps || !temps)) {
+        eval_block(n, b, count, out + b->row);
+    } else {
+        fill_block(out + b->row, count, NAN);
+    }
+}
+
+
+static void run_batch(const te_expr *n, batch *b, int rows, double *out) {
+    const int temps = n ? temp_count(n) : 0;
+    select_kernels(&b->kernels1, &b->kernels2);
+    b->temps = temps ? malloc(sizeof(double) * TE_BATCH_BLOCK * temps) : 0;
+
+    for (b->row = 0; b->row < rows; b->row += TE_BATCH_BLOCK) run_block(n, b, temps, rows, out);
+
+    free(b->temps);
+}
+
+
+void te_eval_batch(const te_expr *n, const te_column *columns, int column_count, int rows, double *out) {
+    batch b;
+    b.columns = columns;
+    b.column_count = columns ? column_count : 0;
+    b.frames = 0;
+    b.frame_size = 0;
+    run_batch(n, &b, rows, out);
+}
+
+
+void te_eval_batch_frame(const te_expr *n, const void *frames, int frame_size, int rows, double *out) {
+    batch b;
+    b.columns = 0;
+    b.column_count = 0;
+    b.frames = frames;
+    b.frame_size = frame_size;
+    run_batch(n, &b, rows, out);
+}
+
+
+static float single_add(float a, float b) {return a + b;}
+static float single_sub(float a, float b) {return a - b;}
+static float single_mul(float a, float b) {return a * b;}
+static float single_divide(float a, float b) {return a / b;}
+static float single_negate(float a) {return -a;}
+static float single_comma(float a, float b) {(void)a; return b;}
+static float single_less(float a, float b) {return a < b;}
+static float single_less_equal(float a, float b) {return a <= b;}
+static float single_greater(float a, float b) {return a > b;}
+static float single_greater_equal(float a, float b) {return a >= b;}
+static float single_equal(float a, float b) {return a == b;}
+static float single_not_equal(float a, float b) {return a != b;}
+
+/* The builtins that te_eval_batchf runs in single precision, and how. */
+static const struct {const void *function, *single;} singles[] = {
+    {add, single_add}, {sub, single_sub}, {mul, single_mul}, {divide, single_divide},
+    {negate, single_negate}, {comma, single_comma}, {fmod, fmodf}, {pow, powf}, {atan2, atan2f},
+    {fabs, fabsf}, {acos, acosf}, {asin, asinf}, {atan, atanf}, {ceil, ceilf}, {cos, cosf},
+    {cosh, coshf}, {exp, expf}, {floor, floorf}, {log, logf}, {log10, log10f}, {sin, sinf},
+    {sinh, sinhf}, {sqrt, sqrtf}, {tan, tanf}, {tanh, tanhf},
+    {less, single_less}, {less_equal, single_less_equal}, {greater, single_greater},
+    {greater_equal, single_greater_equal}, {equal, single_equal}, {not_equal, single_not_equal},
+    {0, 0}
+};
+
+
+static const void *single_of(const te_expr *n) {
+    int i;
+    if (TYPE_MASK(n->type) != TE_FUNCTION1 && TYPE_MASK(n->type) != TE_FUNCTION2) return 0;
+    if (n->type & TE_FLAG_VECTOR) return 0;
+    for (i = 0; singles[i].function; ++i) if (singles[i].function == n->function) return singles[i].single;
+    return 0;
+}
+
+
+static int in_single(const te_expr *n) {
+    /* Whether te_eval_batchf runs n in single precision. Its children decide for themselves. */
+    switch (TYPE_MASK(n->type)) {
+        case TE_CONSTANT: case TE_VARIABLE: case TE_TEMP: case TE_LET: case TE_REDUCE: case TE_IF: return 1;
+        default: return single_of(n) != 0;
+    }
+}
+
+
+static int all_single(const te_expr *n) {
+    int i;
+    if (!in_single(n)) return 0;
+    for (i = 0; i < ARITY(n->type); ++i) if (!all_single(n->parameters[i])) return 0;
+    return 1;
+}
+
+
+static void fillf_block(float *out, int count, float value) {
+    int i;
+    for (i = 0; i < count; ++i) out[i] = value;
+}
+
+
+static void loadf_block(const te_expr *n, const batch *b, int count, float *out) {
+    int i, c;
+    for (c = 0; c < b->column_count; ++c) {
+        const te_columnf *col = b->fcolumns + c;
+        if (col->address != n->bound) continue;
+
+        if (col->stride == 1) {
+            memcpy(out, col->data + b->row, sizeof(float) * count);
+        } else {
+            const float *src = col->data + (size_t)b->row * col->stride;
+            for (i = 0; i < count; ++i) out[i] = src[(size_t)i * col->stride];
+        }
+        return;
+    }
+    fillf_block(out, count, (float)*n->bound);
+}
+
+
+static void widen_block(const te_expr *n, const batch *b, int count, float *out) {
+    /* Runs n in double, on this block of the columns widened, and rounds its results. */
+    double wide[TE_BATCH_BLOCK];
+    batch d = *b;
+    int i;
+    d.columns = b->wide;
+    d.column_count = b->wide ? b->column_count : 0;
+    d.row = 0;
+    eval_rows(n, &d, count, wide);
+    for (i = 0; i < count; ++i) out[i] = (float)wide[i];
+}
+
+
+#ifdef TE_PROFILE
+static void evalf_rows(const te_expr *n, const batch *b, int count, float *out);
+
+static void evalf_block(const te_expr *n, const batch *b, int count, float *out) {
+    const unsigned long long start = TICKS();
+    evalf_rows(n, b, count, out);
+    PROFILE_ADD(&STATS(n)->ticks, TICKS() - start);
+    PROFILE_ADD(&STATS(n)->count, count);
+}
+#else
+#define evalf_rows evalf_block
+#endif
+
+static void evalf_rows(const te_expr *n, const batch *b, int count, float *out) {
+    float tmp[TE_BATCH_BLOCK];
+    const kernelf1 *k1;
+    const kernelf2 *k2;
+    int i, op;
+
+    switch (in_single(n) ? TYPE_MASK(n->type) : -1) {
+        case TE_CONSTANT: fillf_block(out, count, (float)n->value); return;
+        case TE_VARIABLE: loadf_block(n, b, count, out); return;
+        case TE_TEMP: memcpy(out, b->ftemps + n->offset * TE_BATCH_BLOCK, sizeof(float) * count); return;
+
+        case TE_LET: {
+            float *value = b->ftemps + n->offset * TE_BATCH_BLOCK;
+            evalf_block(n->parameters[0], b, count, value);
+            for (i = 0; i < count; ++i) b->temps[n->offset * TE_BATCH_BLOCK + i] = value[i];
+            evalf_block(n->parameters[1], b, count, out);
+            return;
+        }
+
+        case TE_REDUCE: {
+            double stats[7];
+            reduce_node(n, 0, stats);
+            for (i = 0; i < stat_count(REDUCE_STATS(n->type)); ++i) {
+                fill_block(b->temps + (n->offset + i) * TE_BATCH_BLOCK, count, stats[i]);
+                fillf_block(b->ftemps + (n->offset + i) * TE_BATCH_BLOCK, count, (float)stats[i]);
+            }
+            evalf_block(n->parameters[1], b, count, out);
+            return;
+        }
+
+        case TE_IF: {
+            float other[TE_BATCH_BLOCK];
+            int taken = 0;
+            evalf_block(n->parameters[0], b, count, tmp);
+            for (i = 0; i < count; ++i) taken += tmp[i] != 0;
+            if (taken) evalf_block(n->parameters[1], b, count, out);
+            if (taken == count) return;
+            evalf_block(n->parameters[2], b, count, taken ? other : out);
+            if (!taken) return;
+            for (i = 0; i < count; ++i) out[i] = tmp[i] != 0 ? out[i] : other[i];
+            return;
+        }
+
+        case TE_FUNCTION1:
+            evalf_block(n->parameters[0], b, count, out);
+            for (k1 = b->fkernels1; k1->function; ++k1) {
+                if (k1->function == n->function) {
+                    k1->run(out, count);
+                    return;
+                }
+            }
+            for (i = 0; i < count; ++i) out[i] = ((float(*)(float))single_of(n))(out[i]);
+            return;
+
+        case TE_FUNCTION2:
+            evalf_block(n->parameters[0], b, count, out);
+            evalf_block(n->parameters[1], b, count, tmp);
+            op = infix_op(n->function);
+            for (k2 = b->fkernels2; k2->run; ++k2) {
+                if (k2->op == op) {
+                    k2->run(out, tmp, count);
+                    return;
+                }
+            }
+            for (i = 0; i < count; ++i) out[i] = ((float(*)(float, float))single_of(n))(out[i], tmp[i]);
+            return;
+
+        default: widen_block(n, b, count, out); return;
+    }
+}
+
+
+static int single_buffers(batch *b, const te_expr *n, int temps) {
+    /* Gives b its temps, and its wide columns if some of n runs in double. */
+    const int wide = n && b->column_count && !all_single(n);
+    const size_t head = (sizeof(te_column) * b->column_count + sizeof(double) - 1) / sizeof(double);
+    int c;
+    select_kernels(&b->kernels1, &b->kernels2);
+    select_kernelsf(&b->fkernels1, &b->fkernels2);
+    b->temps = temps ? malloc(sizeof(double) * TE_BATCH_BLOCK * temps) : 0;
+    b->ftemps = temps ? malloc(sizeof(float) * TE_BATCH_BLOCK * temps) : 0;
+    b->wide = wide ? malloc(sizeof(double) * (head + (size_t)TE_BATCH_BLOCK * b->column_count)) : 0;
+
+    for (c = 0; b->wide && c < b->column_count; ++c) {
+        b->wide[c].address = b->fcolumns[c].address;
+        b->wide[c].data = (const double*)b->wide + head + (size_t)TE_BATCH_BLOCK * c;
+        b->wide[c].stride = 1;
+    }
+    return (!temps || (b->temps && b->ftemps)) && (!wide || b->wide);
+}
+
+
+static void free_single_buffers(batch *b) {
+    free(b->temps);
+    free(b->ftemps);
+    free(b->wide);
+}
+
+
+static void run_fblock(const te_expr *n, batch *b, int rows, float *out) {
+    /* Evaluates the block of rows starting at b->row, given single_buffers. */
+    const int count = rows - b->row < TE_BATCH_BLOCK ? rows - b->row : TE_BATCH_BLOCK;
+    int i, c;
+    if (!n) {
+        fillf_block(out + b->row, count, NAN);
+        return;
+    }
+    for (c = 0; b->wide && c < b->column_count; ++c) {
+        const te_columnf *col = b->fcolumns + c;
+        const float *src = col->data + (size_t)b->row * col->stride;
+        double *dst = (double*)b->wide[c].data;
+        for (i = 0; i < count; ++i) dst[i] = src[(size_t)i * col->stride];
+    }
+    evalf_block(n, b, count, out + b->row);
+}
+
+
+void te_eval_batchf(const te_expr *n, const te_columnf *columns, int column_count, int rows, float *out) {
+    batch b;
+    b.columns = 0;
+    b.fcolumns = columns;
+    b.column_count = columns ? column_count : 0;
+    b.frames = 0;
+    b.frame_size = 0;
+    if (single_buffers(&b, n, n ? temp_count(n) : 0)) {
+        for (b.row = 0; b.row < rows; b.row += TE_BATCH_BLOCK) run_fblock(n, &b, rows, out);
+    } else {
+        fillf_block(out, rows, NAN);
+    }
+    free_single_buffers(&b);
+}
+
+
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+/* Thread pool:                                                         */
+/*   each call is split into tasks, and each worker owns a range of     */
+/*   them; a worker that runs out takes tasks from another's range      */
+/*–––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––––*/
+
+typedef void (*pool_task)(void *job, int worker, long task);
+
+typedef struct pool_range {
+    long next, end; /* Owner and thieves alike claim next by atomic increment. */
+    char pad[64 - 2 * sizeof(long)]; /* One cache line per worker. */
+} pool_range;
+
+struct te_pool {
+    int threads; /* Workers, counting the thread that calls in. */
+    int flags;
+    pool_range *ranges;
+    pool_task task;
+    void *job;
+#ifdef TE_THREADS_POSIX
+    pthread_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    long generation;
+    int busy, stop;
+#endif
+};
+
+
+#ifdef TE_THREADS_POSIX
+#define CLAIM(p) __atomic_fetch_add((p), 1, __ATOMIC_RELAXED)
+#else
+#define CLAIM(p) ((*(p))++)
+#endif
+
+static void work(te_pool *pool, int worker) {
+    long task;
+    int k;
+    for (k = 0; k < pool->threads; ++k) {
+        /* Own range first, then the others in turn, unless results must not depend on timing. */
+        pool_range *range = pool->ranges + (worker + k) % pool->threads;
+        if (k && (pool->flags & TE_POOL_DETERMINISTIC)) break;
+        while ((task = CLAIM(&range->next)) < range->end) pool->task(pool->job, worker, task);
+    }
+}
+
+#undef CLAIM
+
+
+#ifdef TE_THREADS_POSIX
+typedef struct pool_start {te_pool *pool; int worker;} pool_start;
+
+static void *worker_main(void *arg) {
+    te_pool *pool = ((pool_start*)arg)->pool;
+    const int worker = ((pool_start*)arg)->worker;
+    long seen = 0;
+    free(arg);
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->generation == seen) pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->stop) break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        work(pool, worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+#endif
+
+
+static void pool_run(te_pool *pool, pool_task task, void *job, long tasks) {
+    /* Runs every task once, returning when all are done. */
+    int i;
+    if (!pool || pool->threads == 1 || tasks <= 1) {
+        for (i = 0; i < tasks; ++i) task(job, 0, i);
+        return;
+    }
+
+    pool->task = task;
+    pool->job = job;
+    for (i = 0; i < pool->threads; ++i) {
+        pool->ranges[i].next = tasks * i / pool->threads;
+        pool->ranges[i].end = tasks * (i + 1) / pool->threads;
+    }
+
+#ifdef TE_THREADS_POSIX
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = pool->threads - 1;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    work(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+#else
+    work(pool, 0);
+#endif
+}
+
+
+te_pool *te_pool_new(int threads, int flags) {
+#ifdef TE_THREADS_POSIX
+    if (threads <= 0) {
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+#else
+    threads = 1;
+#endif
+
+    te_pool *pool = malloc(sizeof(te_pool));
+    CHECK_NULL(pool);
+    pool->threads = threads;
+    pool->flags = flags;
+    pool->ranges = malloc(sizeof(pool_range) * threads);
+    CHECK_NULL(pool->ranges, free(pool));
+
+#ifdef TE_THREADS_POSIX
+    pool->workers = malloc(sizeof(pthread_t) * threads);
+    CHECK_NULL(pool->workers, free(pool->ranges), free(pool));
+    pthread_mutex_init(&pool->lock, 0);
+    pthread_cond_init(&pool->wake, 0);
+    pthread_cond_init(&pool->done, 0);
+    pool->generation = 0;
+    pool->busy = pool->stop = 0;
+
+    /* Worker 0 is the calling thread. A pool with fewer threads than asked still works. */
+    int i;
+    for (i = 1; i < threads; ++i) {
+        pool_start *start = malloc(sizeof(pool_start));
+        if (start) {
+            start->pool = pool;
+            start->worker = i;
+        }
+        if (!start || pthread_create(pool->workers + i, 0, worker_main, start) != 0) {
+            free(start);
+            break;
+        }
+    }
+    pool->threads = i;
+#endif
+
+    return pool;
+}
+
+
+int te_pool_threads(const te_pool *pool) {
+    return pool ? pool->threads : 1;
+}
+
+
+void te_pool_free(te_pool *pool) {
+    if (!pool) return;
+#ifdef TE_THREADS_POSIX
+    int i;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 1; i < pool->threads; ++i) pthread_join(pool->workers[i], 0);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+#endif
+    free(pool->ranges);
+    free(pool);
+}
+
+
+typedef struct batch_job {
+    const te_expr *n;
+    batch *workers; /* One copy of the batch per worker, each with its own temps. */
+    int temps, rows;
+    double *out;
+    float *fout; /* Instead of out, for te_pool_eval_batchf. */
+} batch_job;
+
+static void batch_task(void *job, int worker, long task) {
+    batch_job *j = job;
+    batch *b = j->workers + worker;
+    b->row = (int)task * TE_BATCH_BLOCK;
+    if (j->fout) run_fblock(j->n, b, j->rows, j->fout);
+    else run_block(j->n, b, j->temps, j->rows, j->out);
+}
+
+
+static void pool_batchf(te_pool *pool, const te_expr *n, const batch *b, int rows, float *out) {
+    /* As pool_batch, with each worker's buffers from single_buffers. */
+    const int threads = pool ? pool->threads : 1;
+    batch_job j;
+    int i, ready;
+    j.n = n;
+    j.temps = n ? temp_count(n) : 0;
+    j.rows = rows;
+    j.out = 0;
+    j.fout = out;
+    j.workers = malloc(sizeof(batch) * threads);
+    if (!j.workers) {
+        fillf_block(out, rows, NAN);
+        return;
+    }
+
+    for (i = 0, ready = 1; i < threads; ++i) {
+        j.workers[i] = *b;
+        ready &= single_buffers(j.workers + i, n, j.temps);
+    }
+    if (ready) pool_run(pool, batch_task, &j, (rows + TE_BATCH_BLOCK - 1) / TE_BATCH_BLOCK);
+    else fillf_block(out, rows, NAN);
+
+    for (i = 0; i < threads; ++i) free_single_buffers(j.workers + i);
+    free(j.workers);
+}
+
+
+static void pool_batch(te_pool *pool, const te_expr *n, const batch *b, int rows, double *out) {
+    /* Splits on block boundaries, so every row gets the bits it would get from run_batch. */
+    const int threads = pool ? pool->threads : 1;
+    const int temps = n ? temp_count(n) : 0;
+    batch_job j;
+    int i;
+    j.n = n;
+    j.temps = temps;
+    j.rows = rows;
+    j.out = out;
+    j.fout = 0;
+    j.workers = malloc(sizeof(batch) * threads);
+    double *buffers = temps ? malloc(sizeof(double) * TE_BATCH_BLOCK * temps * threads) : 0;
+
+    if (!j.workers) {
+        free(buffers);
+        fill_block(out, rows, NAN);
+        return;
+    }
+    for (i = 0; i < threads; ++i) {
+        j.workers[i] = *b;
+        select_kernels(&j.workers[i].kernels1, &j.workers[i].kernels2);
+        j.workers[i].temps = buffers ? buffers + (size_t)TE_BATCH_BLOCK * temps * i : 0;
+    }
+
+    pool_run(pool, batch_task, &j, (rows + TE_BATCH_BLOCK - 1) / TE_BATCH_BLOCK);
+    free(buffers);
+    free(j.workers);
+}
+
+
+void te_pool_eval_batch(te_pool *pool, const te_expr *n, const te_column *columns, int column_count,
+        int rows, double *out) {
+    batch b;
+    b.columns = columns;
+    b.column_count = columns ? column_count : 0;
+    b.frames = 0;
+    b.frame_size = 0;
+    pool_batch(pool, n, &b, rows, out);
+}
+
+
+void te_pool_eval_batch_frame(te_pool *pool, const te_expr *n, const void *frames, int frame_size,
+        int rows, double *out) {
+    batch b;
+    b.columns = 0;
+    b.column_count = 0;
+    b.frames = frames;
+    b.frame_size = frame_size;
+    pool_batch(pool, n, &b, rows, out);
+}
+
+
+void te_pool_eval_batchf(te_pool *pool, const te_expr *n, const te_columnf *columns, int column_count,
+        int rows, float *out) {
+    batch b;
+    b.columns = 0;
+    b.fcolumns = columns;
+    b.column_count = columns ? column_count : 0;
+    b.frames = 0;
+    b.frame_size = 0;
+    pool_batchf(pool, n, &b, rows, out);
+}
+
+
+typedef struct many_job {
+    const te_expr **roots;
+    const double *temps; /* Only TE_LET and TE_REDUCE write temps, so workers share them. */
+    double *outputs;
+} many_job;
+
+static void many_task(void *job, int worker, long task) {
+    many_job *j = job;
+    (void)worker;
+    j->outputs[task] = eval(j->roots[task], 0, (double*)j->temps);
+}
+
+
+void te_pool_eval_many(te_pool *pool, const te_expr *n, int count, double *outputs) {
+    /* The shared temps come first, on the calling thread; then each expression is a task. */
+    double temps[TE_MAX_TEMPS];
+    many_job j;
+    int i;
+    if (count <= 0) return;
+
+    j.roots = malloc(sizeof(te_expr*) * count);
+    if (!j.roots) {
+        te_eval_many(n, count, outputs);
+        return;
+    }
+    for (; n && (TYPE_MASK(n->type) == TE_LET || TYPE_MASK(n->type) == TE_REDUCE); n = n->parameters[1]) {
+        if (TYPE_MASK(n->type) == TE_LET) temps[n->offset] = eval(n->parameters[0], 0, temps);
+        else reduce_node(n, 0, temps + n->offset);
+    }
+    for (i = 0; i < count; ++i) {
+        if (n && TYPE_MASK(n->type) == TE_FUNCTION2 && n->function == (const void*)join) {
+            j.roots[i] = n->parameters[0];
+            n = n->parameters[1];
+        } else {
+            j.roots[i] = n;
+            n = 0;
+        }
+    }
+
+    j.temps = temps;
+    j.outputs = outputs;
+    pool_run(pool, many_task, &j, count);
+    free(j.roots);
+}
+
+
+static void pn (const te_expr *n, int depth) {
+    int i, arity;
+    printf("%*s", depth, "");
+
+    switch(TYPE_MASK(n->type)) {
+    case TE_CONSTANT: printf("%f\n", n->value); break;
+    case TE_VARIABLE: printf("bound %p\n", n->bound); break;
+    case TE_VIEW: printf("view %p\n", (const void*)n->view); break;
+    case TE_SLOT: printf("slot %d\n", n->offset); break;
+    case TE_TEMP: printf("temp %d\n", n->offset); break;
+    case TE_REDUCE:
+         printf("reduce %d into temp %d\n", REDUCE_STATS(n->type), n->offset);
+         pn(n->parameters[0], depth + 1);
+         pn(n->parameters[1], depth + 1);
+         break;
+    case TE_LET:
+         printf("let temp %d\n", n->offset);
+         pn(n->parameters[0], depth + 1);
+         pn(n->parameters[1], depth + 1);
+         break;
+    case TE_ARRAY:
+         printf("array %p\n", n->bound);
+         pn(n->parameters[0], depth + 1);
+         break;
+    case TE_LERP:
+         printf("lerp%s\n", n->parameters[3] ? " with slopes" : "");
+         for (i = 0; i < 3; i++) pn(n->parameters[i], depth + 1);
+         break;
+    case TE_SLOT_ARRAY:
+         printf("slot array %d\n", n->offset);
+         pn(n->parameters[0], depth + 1);
+         break;
+    case TE_VIEW_ARRAY:
+         printf("view array %p\n", (const void*)n->view);
+         pn(n->parameters[0], depth + 1);
+         break;
+    case TE_BITWISE:
+         printf("bitwise\n");
+         pn(n->parameters[0], depth + 1);
+         break;
+    case TE_IF:
+         printf("if\n");
+         for (i = 0; i < 3; i++) pn(n->parameters[i], depth + 1);
+         break;
+    case TE_AGGREGATE: case TE_DOT:
+         printf("array f%d\n", ARITY(n->type));
+         for (i = 0; i < ARITY(n->type); i++) pn(n->parameters[i], depth + 1);
+         break;
+
+    case TE_FUNCTION0: case TE_FUNCTION1: case TE_FUNCTION2: case TE_FUNCTION3:
+    case TE_FUNCTION4: case TE_FUNCTION5: case TE_FUNCTION6: case TE_FUNCTION7:
+    case TE_CLOSURE0: case TE_CLOSURE1: case TE_CLOSURE2: case TE_CLOSURE3:
+    case TE_CLOSURE4: case TE_CLOSURE5: case TE_CLOSURE6: case TE_CLOSURE7:
+         arity = ARITY(n->type);
+         printf("f%d", arity);
+         for(i = 0; i < arity; i++) {
+             printf(" %p", n->parameters[i]);
+         }
+         printf("\n");
+         for(i = 0; i < arity; i++) {
+             pn(n->parameters[i], depth + 1);
+         }
+         break;
+    }
+}
+
+
+void te_print(const te_expr *n) {
+    pn(n, 0);
+}
+
+
+#ifdef TE_PROFILE
+static const char *function_name(const void *function) {
+    const te_variable *v;
+    for (v = operators; v->name; ++v) if (v->address == function) return v->name;
+    for (v = functions; v->name; ++v) if (v->address == function) return v->name;
+    return 0;
+}
+
+
+static void pp(const te_expr *n, int depth, double total) {
+    /* Total, then self time (less the children's) as a share of the root's, then calls. */
+    const node_stats *st = STATS(n);
+    unsigned long long self = st->ticks;
+    int i;
+    for (i = 0; i < ARITY(n->type); ++i) {
+        const unsigned long long child = STATS((const te_expr*)n->parameters[i])->ticks;
+        self = self > child ? self - child : 0;
+    }
+    printf("%6.2f%% %6.2f%% %10llu  %*s", 100 * st->ticks / total, 100 * self / total, st->count, depth, "");
+
+    switch (TYPE_MASK(n->type)) {
+        case TE_CONSTANT: printf("%g\n", n->value); break;
+        case TE_VARIABLE: printf("bound %p\n", (const void*)n->bound); break;
+        case TE_SLOT: printf("slot %d\n", n->offset); break;
+        case TE_TEMP: printf("temp %d\n", n->offset); break;
+        case TE_REDUCE: printf("reduce %d into temp %d\n", REDUCE_STATS(n->type), n->offset); break;
+        case TE_LET: printf("let temp %d\n", n->offset); break;
+        case TE_ARRAY: printf("array %p\n", (const void*)n->bound); break;
+        case TE_SLOT_ARRAY: printf("slot array %d\n", n->offset); break;
+        case TE_VIEW: printf("view %p\n", (const void*)n->view); break;
+        case TE_VIEW_ARRAY: printf("view array %p\n", (const void*)n->view); break;
+        case TE_LERP: printf("linear_interpolate\n"); break;
+        case TE_BITWISE: printf("bitwise\n"); break;
+        default: {
+            const char *name = function_name(checked_form(n));
+            if (name) printf("%s\n", name);
+            else printf("%s%d %p\n", IS_CLOSURE(n->type) ? "closure" : "f", ARITY(n->type), n->function);
+            break;
+        }
+    }
+
+    for (i = 0; i < ARITY(n->type); ++i) pp(n->parameters[i], depth + 2, total);
+}
+
+
+static void reset(const te_expr *n) {
+    int i;
+    memset(STATS(n), 0, sizeof(node_stats));
+    for (i = 0; i < ARITY(n->type); ++i) reset(n->parameters[i]);
+}
+#endif
+
+
+void te_profile_print(const te_expr *n) {
+#ifdef TE_PROFILE
+    if (!n) return;
+    const te_compile_profile c = te_profile_compile();
+    printf("te_compile: %ld calls, ticks tokenize %llu, parse %llu, optimize %llu, pack %llu\n",
+            c.compiles, c.tokenize, c.parse, c.optimize, c.pack);
+    printf("  total    self      calls  node\n");
+    pp(n, 0, STATS(n)->ticks ? (double)STATS(n)->ticks : 1);
+#else
+    (void)n;
+    printf("te_profile_print: build with TE_PROFILE\n");
+#endif
+}
+
+
+long te_profile_calls(const te_expr *n) {
+#ifdef TE_PROFILE
+    return n ? (long)STATS(n)->count : 0;
+#else
+    (void)n;
+    return 0;
+#endif
+}
+
+
+unsigned long long te_profile_ticks(const te_expr *n) {
+#ifdef TE_PROFILE
+    return n ? STATS(n)->ticks : 0;
+#else
+    (void)n;
+    return 0;
+#endif
+}
+
+
+te_compile_profile te_profile_compile(void) {
+#ifdef TE_PROFILE
+    return compile_profile;
+#else
+    te_compile_profile none = {0, 0, 0, 0, 0};
+    return none;
+#endif
+}
+
+
+void te_profile_reset(const te_expr *n) {
+#ifdef TE_PROFILE
+    if (n) reset(n);
+    else memset(&compile_profile, 0, sizeof(compile_profile));
+#else
+    (void)n;
+#endif
 }
@@ -27,19 +27,55 @@
 #define TINYEXPR_H
 
 
+#include <stddef.h>
+
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 
 
+/* An array of length elements at data[0], data[stride], data[2*stride], ... */
+/* Bind its address with type TE_VIEW; it is read at every evaluation, so it may */
+/* change in between. If length_ptr is not NULL, the length is read from it instead. */
+typedef struct te_view {
+    const double *data;
+    int length;
+    int stride;
+    const int *length_ptr;
+} te_view;
+
+
 typedef struct te_expr {
     int type;
-    union {double value; const double *bound; const void *function;};
+    union {double value; const double *bound; const void *function; int offset; const te_view *view;};
     void *parameters[1];
 } te_expr;
 
 
+typedef struct te_program te_program;
+typedef struct te_symbols te_symbols;
+typedef struct te_cache te_cache;
+typedef struct te_incremental te_incremental;
+typedef struct te_pool te_pool;
+
+
+typedef struct te_column {
+    const double *address;
+    const double *data;
+    int stride;
+} te_column;
+
+
+/* A column of floats, e.g. a float32 sensor channel, for te_eval_batchf. */
+typedef struct te_columnf {
+    const double *address;
+    const float *data;
+    int stride;
+} te_columnf;
+
+
 enum {
     TE_VARIABLE = 0,
 
@@ -50,14 +86,39 @@ enum {
     TE_CLOSURE0 = 16, TE_CLOSURE1, TE_CLOSURE2, TE_CLOSURE3,
     TE_CLOSURE4, TE_CLOSURE5, TE_CLOSURE6, TE_CLOSURE7,
 
-    TE_FLAG_PURE = 32
+    TE_FLAG_PURE = 32,
+
+    /* For arrays bound through a te_view, rather than laid out after their length. */
+    TE_VIEW = 259,
+
+    /* For array variables whose contents never change after te_compile. */
+    TE_FLAG_IMMUTABLE = 128,
+
+    /* For functions and closures whose te_variable also gives a vector form. */
+    TE_FLAG_VECTOR = 512
+};
+
+enum {
+    /* For pools whose workers always run the same tasks, in the same order. */
+    TE_POOL_DETERMINISTIC = 1
 };
 
+/* Ticks spent in each phase of te_compile, over every call so far (see TE_PROFILE). */
+typedef struct te_compile_profile {
+    long compiles;
+    unsigned long long tokenize, parse, optimize, pack;
+} te_compile_profile;
+
+/* Computes out[i] for i < n from args[0][i], args[1][i], ... as the function */
+/* would. context is the closure's context, or NULL for a function. */
+typedef void (*te_vector_function)(void *context, const double **args, double *out, size_t n);
+
 typedef struct te_variable {
     const char *name;
     const void *address;
     int type;
     void *context;
+    te_vector_function vector; /* With TE_FLAG_VECTOR, used by the batch evaluators. */
 } te_variable;
 
 
@@ -67,15 +128,183 @@ typedef struct te_variable {
 double te_interp(const char *expression, int *error);
 
 /* Parses the input expression and binds variables. */
+/* The tree is allocated as one block. */
 /* Returns NULL on error. */
 te_expr *te_compile(const char *expression, const te_variable *variables, int var_count, int *error);
 
+/* Compiles count expressions into one tree, in which repeated pure subexpressions, */
+/* even across expressions, are evaluated once. On error, *failed is the index of */
+/* the expression that failed and *error is as te_compile gives for it alone. */
+/* Returns NULL on error. */
+te_expr *te_compile_many(const char *const *expressions, int count, const te_variable *variables, int var_count,
+        int *failed, int *error);
+
+/* Builds a sorted index over a variable table, for compiling many */
+/* expressions against it. The table must outlive the index. */
+/* Returns NULL on error. */
+te_symbols *te_symbols_new(const te_variable *variables, int var_count);
+
+/* Frees the index. Expressions compiled with it remain valid. */
+void te_symbols_free(te_symbols *symbols);
+
+/* Same as te_compile, but finds variables with a binary search of symbols. */
+te_expr *te_compile_symbols(const char *expression, const te_symbols *symbols, int *error);
+
+/* Same as te_compile, but variables and arrays whose address lies inside the */
+/* frame_size bytes at frame are read, at the same offset, from the frame given */
+/* to te_eval_frame. frame is only a template; it need not outlive the expression. */
+te_expr *te_compile_frame(const char *expression, const te_variable *variables, int var_count,
+        const void *frame, int frame_size, int *error);
+
+/* Creates a cache of up to capacity compiled expressions. */
+/* A cache is not safe to share between threads. */
+/* Returns NULL on error. */
+te_cache *te_cache_new(int capacity);
+
+/* Same as te_compile, but returns the cached expression if this text was already */
+/* compiled against this same variables table, which must not change meanwhile. */
+/* The cache owns the expression. It stays valid until the cache is freed or */
+/* evicts it, which takes at least capacity calls looking up other expressions. */
+const te_expr *te_cache_get(te_cache *cache, const char *expression,
+        const te_variable *variables, int var_count, int *error);
+
+/* Counts the calls to te_cache_get that found, or had to compile, their expression. */
+long te_cache_hits(const te_cache *cache);
+long te_cache_misses(const te_cache *cache);
+
+/* Frees the cache and every expression in it. */
+/* This is safe to call on NULL pointers. */
+void te_cache_free(te_cache *cache);
+
 /* Evaluates the expression. */
+/* Threads may share one expression: the only writes evaluation makes to it are */
+/* relaxed atomics, to the segment hint under TE_LERP_CACHE and to the node */
+/* counters under TE_PROFILE. */
 double te_eval(const te_expr *n);
 
+/* Evaluates a tree from te_compile_many, writing the value of each of its count */
+/* first expressions to outputs. te_eval on the tree gives the last expression. */
+void te_eval_many(const te_expr *n, int count, double *outputs);
+
+/* Evaluates an expression from te_compile_frame, reading its frame variables from frame. */
+/* Frame variables are NaN when evaluated with te_eval. */
+double te_eval_frame(const te_expr *n, const void *frame);
+
+/* Returns the number of bytes te_pack needs to copy the expression. */
+int te_size(const te_expr *n);
+
+/* Copies the expression into buffer, which must hold te_size(n) bytes */
+/* and be aligned for double. Returns NULL if buffer is too small. */
+/* te_free on the copy frees buffer, so only call it if buffer came from malloc. */
+te_expr *te_pack(const te_expr *n, void *buffer, int size);
+
+/* Writes a relocatable copy of the expression to buffer, naming each variable and */
+/* function by its entry in variables rather than by address. Returns the number */
+/* of bytes the copy takes, and writes nothing if that is more than size. */
+/* Returns -1 if the expression uses an address that variables lacks. */
+int te_save(const te_expr *n, const te_variable *variables, int var_count, void *buffer, int size);
+
+/* Rebuilds an expression from te_save's bytes, binding its names in variables */
+/* as te_compile would. blob is only read, and need not be aligned, so it may */
+/* point into a mapped file. Returns NULL on error, setting *error to 1 if a */
+/* name is missing from variables, or to -1 if the blob is malformed. */
+te_expr *te_load(const void *blob, int size, const te_variable *variables, int var_count, int *error);
+
+/* Same as te_load, but also fails, setting *error to -1, if the expression reads */
+/* frame variables past the first frame_size bytes of a frame. */
+te_expr *te_load_frame(const void *blob, int size, const te_variable *variables, int var_count,
+        int frame_size, int *error);
+
+/* Creates a cache of the value of every subtree of the expression, which must */
+/* outlive it. It is not safe to share between threads. */
+/* Returns NULL on error. */
+te_incremental *te_incremental_new(const te_expr *n);
+
+/* Marks the variable or array bound at address as changed. */
+void te_incremental_touch(te_incremental *inc, const void *address);
+
+/* Same as te_eval, but only recomputes subtrees that read a variable or array */
+/* touched since the last call, a closure, or a function without TE_FLAG_PURE. */
+double te_incremental_eval(te_incremental *inc);
+
+/* Frees the cache. The expression is not freed. */
+/* This is safe to call on NULL pointers. */
+void te_incremental_free(te_incremental *inc);
+
+/* Lowers a compiled expression into a flat program of opcodes. */
+/* The program does not reference the expression, which may be freed. */
+/* Returns NULL on error. */
+te_program *te_lower(const te_expr *n);
+
+/* Evaluates the program. Gives the same result as te_eval on its expression. */
+/* With TE_JIT, a program that has run often enough is compiled to native code. */
+double te_program_eval(const te_program *p);
+
+/* Evaluates the program, reading frame variables from frame. */
+double te_program_eval_frame(const te_program *p, const void *frame);
+
+/* Frees the program. */
+/* This is safe to call on NULL pointers. */
+void te_program_free(te_program *p);
+
+/* Evaluates the expression once per row, writing rows results to out. */
+/* A variable compiled with a column's address reads row i from data[i*stride]. */
+/* Variables without a column read their bound value for every row. */
+void te_eval_batch(const te_expr *n, const te_column *columns, int column_count, int rows, double *out);
+
+/* Evaluates an expression from te_compile_frame once per row, where row i */
+/* reads its frame variables from the frame_size bytes at frames + i*frame_size. */
+void te_eval_batch_frame(const te_expr *n, const void *frames, int frame_size, int rows, double *out);
+
+/* Same as te_eval_batch, with float columns and results. The arithmetic operators */
+/* and the builtins with an f-suffixed libm form (sqrtf, sinf, powf, ...) run in */
+/* single precision. Anything else, such as a table function, closure or array, */
+/* runs in double on its widened float inputs, and its result is rounded to float. */
+void te_eval_batchf(const te_expr *n, const te_columnf *columns, int column_count, int rows, float *out);
+
+/* Starts a pool of threads, counting the calling thread, or one per core if */
+/* threads is 0. Without TE_THREADS, the pool only uses the calling thread. */
+/* A pool runs one call at a time. Returns NULL on error. */
+te_pool *te_pool_new(int threads, int flags);
+
+/* Returns the number of threads the pool uses. */
+int te_pool_threads(const te_pool *pool);
+
+/* Stops the threads and frees the pool. */
+/* This is safe to call on NULL pointers. */
+void te_pool_free(te_pool *pool);
+
+/* Same as te_eval_batch and te_eval_batch_frame, with blocks of rows spread */
+/* over the pool. Every row gets the same result as it would from one thread. */
+void te_pool_eval_batch(te_pool *pool, const te_expr *n, const te_column *columns, int column_count,
+        int rows, double *out);
+void te_pool_eval_batch_frame(te_pool *pool, const te_expr *n, const void *frames, int frame_size,
+        int rows, double *out);
+void te_pool_eval_batchf(te_pool *pool, const te_expr *n, const te_columnf *columns, int column_count,
+        int rows, float *out);
+
+/* Same as te_eval_many, with the expressions spread over the pool once their */
+/* shared subexpressions are evaluated. */
+void te_pool_eval_many(te_pool *pool, const te_expr *n, int count, double *outputs);
+
 /* Prints debugging information on the syntax tree. */
 void te_print(const te_expr *n);
 
+/* With TE_PROFILE, prints the tree annotated with each node's share of the */
+/* time in the whole tree, its own share (less its children), and its calls. */
+void te_profile_print(const te_expr *n);
+
+/* With TE_PROFILE, returns how often the node was evaluated (each row of a */
+/* batch counts), and the ticks spent in it: cycles on x86, else nanoseconds. */
+long te_profile_calls(const te_expr *n);
+unsigned long long te_profile_ticks(const te_expr *n);
+
+/* With TE_PROFILE, returns the total ticks te_compile has spent in each phase. */
+te_compile_profile te_profile_compile(void);
+
+/* Clears the counts of every node of the expression, or of te_compile if n is NULL. */
+void te_profile_reset(const te_expr *n);
+
 /* Frees the expression. */
 /* This is safe to call on NULL pointers. */
 void te_free(te_expr *n);
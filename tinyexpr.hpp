@@ -0,0 +1,623 @@
+// SPDX-License-Identifier: Zlib
+/*
+ * TINYEXPR - Tiny recursive descent parser and evaluation engine in C
+ *
+ * Copyright (c) 2015-2020 Lewis Van Winkle
+ *
+ * http://CodePlea.com
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ * claim that you wrote the original software. If you use this software
+ * in a product, an acknowledgement in the product documentation would be
+ * appreciated but is not required.
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ * misrepresented as being the original software.
+ * 3. This notice may not be removed or altered from any source distribution.
+ */
+
+#ifndef TINYEXPR_HPP
+#define TINYEXPR_HPP
+
+/* Fixed expressions for C++17: the text is parsed by the C++ compiler, with
+ * tinyexpr's grammar, into a tree that is evaluated by inlined code.
+ *
+ *     auto hyp = te::compile(TE_EXPR("sqrt(x^2+y^2)"), vars, 2, &err);
+ *     double h = te::eval(hyp);
+ *
+ * Names are still bound at run time, by te::compile, from a te_variable table.
+ * Whatever the inlined code can't reproduce exactly (user functions, array and
+ * other non-libm builtins, names that shadow a builtin, hex or long numbers,
+ * syntax errors) makes te::compile fall back to te_compile, which also gives
+ * the error position. Define the same TE_POW_FROM_RIGHT and TE_NAT_LOG as for
+ * tinyexpr.c; if they differ, every expression falls back. */
+
+#include "tinyexpr.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace te {
+namespace detail {
+
+enum {
+    NUMBER, VARIABLE, INDEX, NEGATE, ADD, SUB, MUL, DIV, POW, MOD, AND, OR, COMMA,
+    CALL0, CALL1, CALL2
+};
+
+/* Builtins whose C functions the header can call, in tinyexpr.c's order. */
+enum {
+    F_ABS, F_ACOS, F_ASIN, F_ATAN, F_ATAN2, F_BIT, F_CEIL, F_COS, F_COSH, F_E, F_EXP,
+    F_FLOOR, F_LN, F_LOG, F_LOG10, F_PI, F_POW, F_SIN, F_SINH, F_SQRT, F_TAN, F_TANH, F_XOR
+};
+
+struct builtin {const char *name; int arity; int id;};
+
+constexpr builtin builtins[] = {
+    {"abs", 1, F_ABS}, {"acos", 1, F_ACOS}, {"asin", 1, F_ASIN}, {"atan", 1, F_ATAN},
+    {"atan2", 2, F_ATAN2}, {"bit", 2, F_BIT}, {"ceil", 1, F_CEIL}, {"cos", 1, F_COS},
+    {"cosh", 1, F_COSH}, {"e", 0, F_E}, {"exp", 1, F_EXP}, {"floor", 1, F_FLOOR},
+    {"ln", 1, F_LN}, {"log", 1, F_LOG}, {"log10", 1, F_LOG10}, {"pi", 0, F_PI},
+    {"pow", 2, F_POW}, {"sin", 1, F_SIN}, {"sinh", 1, F_SINH}, {"sqrt", 1, F_SQRT},
+    {"tan", 1, F_TAN}, {"tanh", 1, F_TANH}, {"xor", 2, F_XOR},
+};
+
+/* Other builtins, which only te_compile can bind. */
+constexpr const char *unsupported[] = {
+    "argmax", "argmin", "arrlen", "arrmax", "arrmin", "dot", "fac", "if", "linear_interpolate",
+    "mean", "ncr", "npr", "sum", "variance",
+};
+
+struct node {
+    int kind;
+    double value;
+    int a, b; /* Children, or NAME's index for VARIABLE and INDEX, or the builtin for CALLs. */
+};
+
+struct name {int begin, length, variable;};
+
+template <int N>
+struct tree {
+    node nodes[N];
+    name names[N];
+    int count, name_count, root;
+    int fixed; /* 0 when te::compile must use te_compile. */
+};
+
+enum {
+    T_END, T_NUMBER, T_NAME, T_BUILTIN, T_ADD, T_SUB, T_MUL, T_DIV, T_POW, T_MOD, T_AND, T_OR,
+    T_OPEN, T_CLOSE, T_OPEN_BRACKET, T_CLOSE_BRACKET, T_SEP, T_ERROR
+};
+
+
+constexpr int length(const char *text) {
+    int i = 0;
+    while (text[i]) ++i;
+    return i;
+}
+
+
+constexpr bool same(const char *text, int begin, int len, const char *word) {
+    if (length(word) != len) return false;
+    for (int i = 0; i < len; ++i) if (text[begin + i] != word[i]) return false;
+    return true;
+}
+
+
+template <int N>
+struct parser {
+    /* Mirrors next_token, base, power, factor, term, expr and list in tinyexpr.c. */
+    const char *text;
+    int next;
+    int token;
+    double value;
+    int begin, len, arity, id;
+    tree<N> t;
+
+    constexpr parser(const char *s) : text(s), next(0), token(T_END), value(0), begin(0), len(0),
+        arity(0), id(0), t() {t.fixed = 1;}
+
+    constexpr static bool alpha(char c) {return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');}
+    constexpr static bool digit(char c) {return c >= '0' && c <= '9';}
+
+    constexpr void fail() {
+        t.fixed = 0;
+        token = T_ERROR;
+    }
+
+    constexpr void number() {
+        /* Only numbers that strtod rounds the same as one exact multiply or divide. */
+        if (text[next] == '0' && (text[next + 1] == 'x' || text[next + 1] == 'X')) return fail();
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0, any = 0;
+        for (; digit(text[next]); ++next, any = 1) {
+            if (mantissa || text[next] != '0') ++digits;
+            if (digits > 19) return fail();
+            mantissa = mantissa * 10 + (text[next] - '0');
+        }
+        if (text[next] == '.') {
+            for (++next; digit(text[next]); ++next, any = 1) {
+                if (mantissa || text[next] != '0') ++digits;
+                if (digits > 19) return fail();
+                mantissa = mantissa * 10 + (text[next] - '0');
+                --exponent;
+            }
+        }
+        if (!any) return fail();
+        if (text[next] == 'e' || text[next] == 'E') {
+            int i = next + 1, sign = 1, e = 0;
+            if (text[i] == '+' || text[i] == '-') sign = text[i++] == '-' ? -1 : 1;
+            if (digit(text[i])) {
+                for (; digit(text[i]); ++i) if ((e = e * 10 + (text[i] - '0')) > 10000) return fail();
+                exponent += sign * e;
+                next = i;
+            }
+        }
+        while (mantissa && mantissa % 10 == 0 && exponent < 0) {
+            mantissa /= 10;
+            ++exponent;
+        }
+        if (mantissa > (uint64_t(1) << 53) || (mantissa && (exponent > 22 || exponent < -22))) return fail();
+        double scale = 1;
+        for (int i = 0; i < (exponent < 0 ? -exponent : exponent); ++i) scale *= 10;
+        value = exponent < 0 ? double(mantissa) / scale : double(mantissa) * scale;
+        token = T_NUMBER;
+    }
+
+    constexpr void next_token() {
+        for (;;) {
+            const char c = text[next];
+            if (!c) {
+                token = T_END;
+                return;
+            }
+            if (digit(c) || c == '.') return number();
+            if (alpha(c)) {
+                begin = next;
+                while (alpha(text[next]) || digit(text[next]) || text[next] == '_') ++next;
+                len = next - begin;
+                token = T_NAME;
+                for (const builtin &b : builtins) {
+                    if (same(text, begin, len, b.name)) {
+                        token = T_BUILTIN;
+                        arity = b.arity;
+                        id = b.id;
+                    }
+                }
+                for (const char *u : unsupported) if (same(text, begin, len, u)) return fail();
+                add_name(token == T_NAME);
+                return;
+            }
+            ++next;
+            switch (c) {
+                case '+': token = T_ADD; return;
+                case '-': token = T_SUB; return;
+                case '*': token = T_MUL; return;
+                case '/': token = T_DIV; return;
+                case '^': token = T_POW; return;
+                case '%': token = T_MOD; return;
+                case '&': token = T_AND; return;
+                case '|': token = T_OR; return;
+                case '(': token = T_OPEN; return;
+                case ')': token = T_CLOSE; return;
+                case '[': token = T_OPEN_BRACKET; return;
+                case ']': token = T_CLOSE_BRACKET; return;
+                case ',': token = T_SEP; return;
+                case ' ': case '\t': case '\n': case '\r': break;
+                default: return fail();
+            }
+        }
+    }
+
+    constexpr void add_name(int variable) {
+        /* Every name is checked against the table by te::compile, builtins included. */
+        int i = 0;
+        for (; i < t.name_count; ++i) {
+            if (t.names[i].length != len) continue;
+            int k = 0;
+            while (k < len && text[t.names[i].begin + k] == text[begin + k]) ++k;
+            if (k == len) break;
+        }
+        if (i == t.name_count) t.names[t.name_count++] = name{begin, len, variable};
+        if (variable) id = i;
+    }
+
+    constexpr int make(int kind, double v, int a, int b) {
+        /* Only a failing parse can run out of nodes. */
+        if (t.count == N) {
+            fail();
+            return 0;
+        }
+        t.nodes[t.count] = node{kind, v, a, b};
+        return t.count++;
+    }
+
+    constexpr int base() {
+        int ret = -1;
+        switch (token) {
+            case T_NUMBER:
+                ret = make(NUMBER, value, 0, 0);
+                next_token();
+                break;
+
+            case T_NAME:
+                ret = make(VARIABLE, 0, id, 0);
+                next_token();
+                while (token == T_OPEN_BRACKET) {
+                    if (t.nodes[ret].kind != VARIABLE) {
+                        fail();
+                        return ret;
+                    }
+                    const int array = t.nodes[ret].a;
+                    next_token();
+                    const int index = list();
+                    if (token != T_CLOSE_BRACKET) {
+                        fail();
+                        return ret;
+                    }
+                    next_token();
+                    ret = make(INDEX, 0, array, index);
+                }
+                break;
+
+            case T_BUILTIN: {
+                const int f = id;
+                if (arity == 0) {
+                    ret = make(CALL0, 0, f, 0);
+                    next_token();
+                    if (token == T_OPEN) {
+                        next_token();
+                        if (token != T_CLOSE) fail(); else next_token();
+                    }
+                } else if (arity == 1) {
+                    next_token();
+                    const int a = power();
+                    ret = make(CALL1, 0, f, a);
+                } else {
+                    next_token();
+                    if (token != T_OPEN) {
+                        fail();
+                        return make(NUMBER, 0, 0, 0);
+                    }
+                    next_token();
+                    const int a = expr();
+                    if (token != T_SEP) {
+                        fail();
+                        return a;
+                    }
+                    next_token();
+                    const int b = expr();
+                    if (token != T_CLOSE) {
+                        fail();
+                        return b;
+                    }
+                    next_token();
+                    /* CALL2 keeps the builtin in value, its arguments in a and b. */
+                    ret = make(CALL2, f, a, b);
+                }
+                break;
+            }
+
+            case T_OPEN:
+                next_token();
+                ret = list();
+                if (token != T_CLOSE) fail(); else next_token();
+                break;
+
+            default:
+                fail();
+                ret = make(NUMBER, 0, 0, 0);
+                break;
+        }
+        return ret;
+    }
+
+    constexpr int power() {
+        int sign = 1;
+        while (token == T_ADD || token == T_SUB) {
+            if (token == T_SUB) sign = -sign;
+            next_token();
+        }
+        const int b = base();
+        return sign == 1 ? b : make(NEGATE, 0, b, 0);
+    }
+
+#ifdef TE_POW_FROM_RIGHT
+    constexpr int factor() {
+        int ret = power();
+        int neg = 0;
+        if (t.nodes[ret].kind == NEGATE) {
+            ret = t.nodes[ret].a;
+            neg = 1;
+        }
+        int insertion = -1;
+        while (token == T_POW) {
+            next_token();
+            const int p = power();
+            if (insertion >= 0) {
+                const int insert = make(POW, 0, t.nodes[insertion].b, p);
+                t.nodes[insertion].b = insert;
+                insertion = insert;
+            } else {
+                ret = make(POW, 0, ret, p);
+                insertion = ret;
+            }
+        }
+        return neg ? make(NEGATE, 0, ret, 0) : ret;
+    }
+#else
+    constexpr int factor() {
+        int ret = power();
+        while (token == T_POW) {
+            next_token();
+            const int p = power();
+            ret = make(POW, 0, ret, p);
+        }
+        return ret;
+    }
+#endif
+
+    constexpr int term() {
+        int ret = factor();
+        while (token == T_MUL || token == T_DIV || token == T_MOD || token == T_OR || token == T_AND) {
+            const int kind = token == T_MUL ? MUL : token == T_DIV ? DIV : token == T_MOD ? MOD
+                : token == T_OR ? OR : AND;
+            next_token();
+            const int f = factor();
+            ret = make(kind, 0, ret, f);
+        }
+        return ret;
+    }
+
+    constexpr int expr() {
+        int ret = term();
+        while (token == T_ADD || token == T_SUB) {
+            const int kind = token == T_ADD ? ADD : SUB;
+            next_token();
+            const int f = term();
+            ret = make(kind, 0, ret, f);
+        }
+        return ret;
+    }
+
+    constexpr int list() {
+        int ret = expr();
+        while (token == T_SEP) {
+            next_token();
+            const int e = expr();
+            ret = make(COMMA, 0, ret, e);
+        }
+        return ret;
+    }
+};
+
+
+template <int N>
+constexpr tree<N> parse(const char *text) {
+    parser<N> p(text);
+    p.next_token();
+    if (p.t.fixed) p.t.root = p.list();
+    if (p.token != T_END) p.t.fixed = 0;
+    return p.t;
+}
+
+
+template <class Text>
+struct program {
+    static constexpr int size = length(Text::str()) + 1;
+    static constexpr tree<size> value = parse<size>(Text::str());
+};
+
+
+/* The same operations as tinyexpr.c's, so results match to the bit. */
+inline bool bitwise_operand(double x) {
+    return !(x < 0) && round(x) <= (double)((1ULL << 53) - 1);
+}
+
+inline double call(int f, double a, double b) {
+    switch (f) {
+        case F_ABS: return fabs(a);
+        case F_ACOS: return acos(a);
+        case F_ASIN: return asin(a);
+        case F_ATAN: return atan(a);
+        case F_ATAN2: return atan2(a, b);
+        case F_BIT: {
+            if (!bitwise_operand(a) || !bitwise_operand(b)) return NAN;
+            const int64_t iv = (int64_t)round(a), bi = (int64_t)round(b);
+            if (bi >= 53) return NAN;
+            return (iv & (1LL << bi)) ? 1.0 : 0.0;
+        }
+        case F_CEIL: return ceil(a);
+        case F_COS: return cos(a);
+        case F_COSH: return cosh(a);
+        case F_E: return 2.71828182845904523536;
+        case F_EXP: return exp(a);
+        case F_FLOOR: return floor(a);
+        case F_LN: return log(a);
+#ifdef TE_NAT_LOG
+        case F_LOG: return log(a);
+#else
+        case F_LOG: return log10(a);
+#endif
+        case F_LOG10: return log10(a);
+        case F_PI: return 3.14159265358979323846;
+        case F_POW: return pow(a, b);
+        case F_SIN: return sin(a);
+        case F_SINH: return sinh(a);
+        case F_SQRT: return sqrt(a);
+        case F_TAN: return tan(a);
+        case F_TANH: return tanh(a);
+        case F_XOR:
+            if (!bitwise_operand(a) || !bitwise_operand(b)) return NAN;
+            return (double)((int64_t)round(a) ^ (int64_t)round(b));
+        default: return NAN;
+    }
+}
+
+
+template <class Text, int I>
+inline double eval(const double *const *vars) {
+    constexpr node n = program<Text>::value.nodes[I];
+    if constexpr (n.kind == NUMBER) {
+        return n.value;
+    } else if constexpr (n.kind == VARIABLE) {
+        return *vars[n.a];
+    } else if constexpr (n.kind == INDEX) {
+        const double *arr = vars[n.a];
+        const int len = (int)arr[0];
+        const int idx = (int)eval<Text, n.b>(vars);
+        if (idx < 0 || idx >= len) return NAN;
+        return arr[idx + 1];
+    } else if constexpr (n.kind == NEGATE) {
+        return -eval<Text, n.a>(vars);
+    } else if constexpr (n.kind == CALL0) {
+        return call(n.a, 0, 0);
+    } else if constexpr (n.kind == CALL1) {
+        return call(n.a, eval<Text, n.b>(vars), 0);
+    } else {
+        const double a = eval<Text, n.a>(vars), b = eval<Text, n.b>(vars);
+        if constexpr (n.kind == ADD) return a + b;
+        else if constexpr (n.kind == SUB) return a - b;
+        else if constexpr (n.kind == MUL) return a * b;
+        else if constexpr (n.kind == DIV) return a / b;
+        else if constexpr (n.kind == POW) return pow(a, b);
+        else if constexpr (n.kind == MOD) return fmod(a, b);
+        else if constexpr (n.kind == COMMA) return b;
+        else if constexpr (n.kind == CALL2) return call((int)n.value, a, b);
+        else {
+            if (!bitwise_operand(a) || !bitwise_operand(b)) return NAN;
+            const int64_t ia = (int64_t)round(a), ib = (int64_t)round(b);
+            return (double)(n.kind == AND ? ia & ib : ia | ib);
+        }
+    }
+}
+
+
+inline bool same_options() {
+    /* Whether tinyexpr.c was built with this header's TE_POW_FROM_RIGHT and TE_NAT_LOG. */
+    static const bool same = [] {
+#ifdef TE_POW_FROM_RIGHT
+        const double power = -4;
+#else
+        const double power = 4;
+#endif
+#ifdef TE_NAT_LOG
+        const double logarithm = log(100.0);
+#else
+        const double logarithm = 2;
+#endif
+        return te_interp("-2^2", 0) == power && te_interp("log(100)", 0) == logarithm;
+    }();
+    return same;
+}
+
+} /* namespace detail */
+
+
+template <class Text>
+class fixed_expr {
+public:
+    fixed_expr() : fallback_(0), valid_(false) {}
+    fixed_expr(fixed_expr &&other) : fallback_(other.fallback_), valid_(other.valid_) {
+        memcpy(vars_, other.vars_, sizeof(vars_));
+        other.fallback_ = 0;
+        other.valid_ = false;
+    }
+    fixed_expr &operator=(fixed_expr &&other) {
+        if (this != &other) {
+            te_free(fallback_);
+            fallback_ = other.fallback_;
+            valid_ = other.valid_;
+            memcpy(vars_, other.vars_, sizeof(vars_));
+            other.fallback_ = 0;
+            other.valid_ = false;
+        }
+        return *this;
+    }
+    fixed_expr(const fixed_expr &) = delete;
+    fixed_expr &operator=(const fixed_expr &) = delete;
+    ~fixed_expr() {te_free(fallback_);}
+
+    /* False if the expression failed to compile. */
+    explicit operator bool() const {return valid_;}
+
+    /* True if evaluation runs the inlined code rather than te_eval. */
+    bool inlined() const {return valid_ && !fallback_;}
+
+    double eval() const {
+        if (fallback_) return te_eval(fallback_);
+        if (!valid_) return NAN;
+        if constexpr (detail::program<Text>::value.fixed != 0) {
+            return detail::eval<Text, detail::program<Text>::value.root>(vars_);
+        } else {
+            return NAN;
+        }
+    }
+
+private:
+    template <class T>
+    friend fixed_expr<T> compile(T, const te_variable *, int, int *);
+
+    const double *vars_[detail::program<Text>::size];
+    te_expr *fallback_;
+    bool valid_;
+};
+
+
+/* Same as te_compile, for text from TE_EXPR. */
+template <class Text>
+fixed_expr<Text> compile(Text, const te_variable *variables, int var_count, int *error = 0) {
+    constexpr auto &t = detail::program<Text>::value;
+    const char *text = Text::str();
+    fixed_expr<Text> ret;
+    bool fixed = t.fixed && detail::same_options();
+
+    for (int i = 0; fixed && i < t.name_count; ++i) {
+        /* The first entry of that name, as te_compile's lookup finds. */
+        const te_variable *var = 0;
+        for (int k = 0; !var && variables && k < var_count; ++k) {
+            if (strncmp(variables[k].name, text + t.names[i].begin, t.names[i].length) == 0 &&
+                variables[k].name[t.names[i].length] == '\0') var = variables + k;
+        }
+        if (t.names[i].variable) {
+            fixed = var && (var->type & 0x1F) == TE_VARIABLE;
+            if (fixed) ret.vars_[i] = (const double*)var->address;
+        } else {
+            fixed = !var; /* A table entry would shadow the builtin. */
+        }
+    }
+
+    if (fixed) {
+        ret.valid_ = true;
+        if (error) *error = 0;
+    } else {
+        ret.fallback_ = te_compile(text, variables, var_count, error);
+        ret.valid_ = ret.fallback_ != 0;
+    }
+    return ret;
+}
+
+
+/* Same as te_eval. */
+template <class Text>
+double eval(const fixed_expr<Text> &n) {
+    return n.eval();
+}
+
+} /* namespace te */
+
+
+/* Wraps a string literal for te::compile. */
+#define TE_EXPR(text) ([] { \
+        struct te_text {static constexpr const char *str() {return text;}}; \
+        return te_text(); \
+    }())
+
+#endif /*TINYEXPR_HPP*/